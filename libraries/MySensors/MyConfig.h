@@ -10,6 +10,194 @@
 #define RF24_PA_LEVEL_GW   RF24_PA_LOW  //Gateway PA Level, defaults to Sensor net PA Level.  Tune here if using an amplified nRF2401+ in your gateway.
 #define BASE_RADIO_ID 	   ((uint64_t)0xA8A8E1FC00LL) // This is also act as base value for sensor nodeId addresses. Change this (or channel) if you have more than one sensor network.
 
+/***
+ * Routing table of repeaters and the gateway. Routes are stored in EEPROM, one
+ * byte per node id. RAM keeps a sorted copy of up to ROUTING_TABLE_SIZE of them,
+ * 2 bytes each; routes beyond that are looked up in EEPROM.
+ * Set ROUTING_TABLE_SIZE to 0 to keep the flat 256 byte copy in RAM instead.
+ */
+#define ROUTING_TABLE_SIZE 32  // Routes, 2 bytes of RAM each
+
+/***
+ * EEPROM write-back cache. Routes, node config and saveState() values are
+ * written to RAM first; process() writes one pending byte whenever the EEPROM
+ * is idle, and sleep() writes everything first. A value changed several times
+ * before it is written costs one write cycle (~3.4 ms, ~100 000 per byte).
+ * Set EEPROM_CACHE_SIZE to 0 to write through, blocking each time.
+ */
+#define EEPROM_CACHE_SIZE  8   // Pending writes, 3 bytes of RAM each
+
+/***
+ * Transmit queue for relayed messages. A repeater queues what it forwards and
+ * process() sends it without blocking: the RX FIFO keeps being read while the
+ * radio retries, and between retry rounds the radio is back listening.
+ * Messages are sent by priority, each behind those of the same priority:
+ * internal messages and acks first, then commands from the gateway, readings
+ * of the nodes and last streams and firmware. Only the message already on the
+ * air is never overtaken.
+ * Set TX_QUEUE_SIZE to 0 to forward with blocking writes instead.
+ */
+#define TX_QUEUE_SIZE      4   // Messages, 37 bytes of RAM each
+#define TX_QUEUE_RETRIES   5   // Hardware auto retries per round (0-15)
+#define TX_QUEUE_ROUNDS    3   // Rounds before a queued message is dropped
+
+/***
+ * Receive queue. process() empties the radio's 3 deep RX FIFO into this queue
+ * on every call, so a burst of messages is acked instead of dropped while the
+ * first one is handled. With a msgCallback all queued messages are handled in
+ * one process() call; without one process() returns after each message addressed
+ * to this node so getLastMessage() keeps working.
+ * Set RX_QUEUE_SIZE to 0 to read one payload per process() call instead.
+ */
+#define RX_QUEUE_SIZE      4   // Messages (power of 2), 35 bytes of RAM each
+
+/***
+ * Duplicate suppression. Every message carries a sequence number of its
+ * sender. Repeaters and the gateway remember the last DUPLICATE_CACHE_SIZE
+ * messages they received and drop copies of them, sent again after a lost ack
+ * or come back round a routing loop, instead of relaying or handling them
+ * again. Set DUPLICATE_CACHE_SIZE to 0 to let every copy through.
+ */
+#define DUPLICATE_CACHE_SIZE 8 // Messages, 3 bytes of RAM each
+
+/***
+ * End-to-end acks. A node keeps each message it sends with an ack requested
+ * until the ack comes back from the destination, and sends it again when none
+ * came within ACK_TIMEOUT, twice as long after each try, up to ACK_RETRIES
+ * times. The ack callback (setAckCallback()) tells how each one ended, and
+ * sleep() stays awake for them for as long as it was asked to sleep: up to
+ * 7.5 s of radio on for every lost ack, a lot for a battery node. So waiting
+ * for acks is left to the sketch unless ACK_TABLE_SIZE is set here or with
+ * -DACK_TABLE_SIZE=2.
+ */
+#ifndef ACK_TABLE_SIZE
+#define ACK_TABLE_SIZE     0   // Messages, 39 bytes of RAM each
+#endif
+#define ACK_TIMEOUT        500 // ms
+#define ACK_RETRIES        3
+
+/***
+ * Interrupt driven receive. Connect the radio IRQ pin to this Arduino pin and
+ * a pin change interrupt reads arriving payloads into the receive queue, so
+ * process() no longer polls the radio over SPI and wait() idles the CPU until
+ * the next interrupt. Needs RX_QUEUE_SIZE > 0.
+ * The interrupt only knows when the library itself is using SPI. Other SPI
+ * devices (the W5100 of the Ethernet gateway, SD cards, displays) are safe only
+ * with an Arduino core and libraries that use SPI transactions; with older
+ * ones the radio has to be alone on the bus.
+ */
+//#define RF24_IRQ_PIN     2
+
+/***
+ * Retries and parent search. Each node keeps running averages of delivered
+ * writes to its parent and of the hardware retransmissions they took
+ * (MyLinkQuality). The auto retry delay grows with the retransmissions and is
+ * jittered so neighbours that collided do not collide again on every retry, and
+ * a parent that stopped acking gets fewer retries. A new parent is searched
+ * after more than SEARCH_FAILURES failures in a row, or when delivery drops
+ * under PARENT_SEARCH_QUALITY. Until delivery recovers each search doubles the
+ * wait before the next one, from PARENT_SEARCH_BACKOFF up to 64 times that.
+ * A node without a parent searches after any failed write, at most once per
+ * PARENT_SEARCH_BACKOFF.
+ */
+#define SEARCH_FAILURES        5     // Failed writes in a row
+#define PARENT_SEARCH_QUALITY  64    // Share of writes delivered, 0-255
+#define PARENT_SEARCH_BACKOFF  2000  // ms
+
+/***
+ * Parent selection. A parent search keeps the responses of up to
+ * PARENT_CANDIDATES repeaters and then picks the one with the lowest score:
+ * 4 per hop to the gateway, 3 more for a weak signal (RPD not set) and 3 more
+ * for the current parent when writes to it have been failing. Repeaters answer
+ * a search after a random delay of up to a second, from process() rather than
+ * by blocking in delay(), for up to PARENT_RESPONSES searching nodes at a time.
+ */
+#define PARENT_CANDIDATES  4   // Responses, 3 bytes of RAM each
+#define PARENT_RESPONSES   4   // Searching nodes, 5 bytes of RAM each
+
+/***
+ * Report slots for sleeping nodes. sleepSlot(period) sleeps until the node's
+ * slot in the next period rather than for a whole period, so nodes that
+ * powered up together do not all wake and send at once. Periods count from
+ * power-up and are split in SLOT_COUNT slots; a node uses slot
+ * nodeId % SLOT_COUNT unless the controller assigns one with I_SLOT
+ * (kept in EEPROM).
+ */
+#define SLOT_COUNT         32
+
+/***
+ * Sleep timing. The watchdog that times sleep() runs off a 128kHz RC
+ * oscillator that is often 10% off. Nodes time one watchdog period against the
+ * system clock before the first sleep and again every SLEEP_CALIBRATE_INTERVAL,
+ * cut sleeps into periods of the measured length and carry what is left over
+ * into the next sleep. getUptime() adds the time slept to millis().
+ */
+#define SLEEP_CALIBRATE_INTERVAL 3600000UL // ms, each calibration keeps the CPU awake 64 ms
+
+/***
+ * Mailbox for sleeping nodes. Before it sleeps a node with a msgCallback that
+ * has sent something tells the gateway with I_SLEEPING, and the gateway keeps
+ * what the controller sends that node instead of sending it into the void.
+ * The node's next message gets it all relayed right behind it: after sending,
+ * the node stays awake for MAILBOX_POLL_WINDOW, and as long again after each
+ * message it receives. A new value (C_SET) for the same child and type
+ * replaces the one waiting; when the mailbox is full the oldest message in it
+ * is dropped. Who sleeps takes one bit per node id on the gateway, 32 bytes.
+ * Set MAILBOX_SIZE to 0 to send to sleeping nodes right away, and
+ * MAILBOX_POLL_WINDOW to 0 for nodes that do not tell the gateway they sleep.
+ */
+#define MAILBOX_SIZE        8  // Messages, 33 bytes of RAM each on the gateway
+#define MAILBOX_POLL_WINDOW 50 // ms
+
+/***
+ * Over the air firmware updates (requestFirmware()). A node fetches a new
+ * image from the controller FIRMWARE_BLOCK_SIZE bytes at a time, asking for
+ * FIRMWARE_WINDOW blocks per request so it does not wait a round trip through
+ * the gateway and the controller for every block. When no block arrived in
+ * order for FIRMWARE_TIMEOUT (plus twice the usual wait for a window to start,
+ * doubling after each timeout), the missing ones are requested again, up to
+ * FIRMWARE_RETRIES times in a row. A request the parent does not take is sent
+ * again after a random backoff, up to FIRMWARE_REFUSALS times in a row: with
+ * several nodes updating the gateway is busy sending windows most of the time.
+ * Updates are left out unless FIRMWARE_WINDOW is set here or with
+ * -DFIRMWARE_WINDOW=16; they take about 30 bytes of RAM.
+ */
+#ifndef FIRMWARE_WINDOW
+#define FIRMWARE_WINDOW    0   // Blocks, up to 255
+#endif
+#define FIRMWARE_TIMEOUT   500 // ms
+#define FIRMWARE_RETRIES   10
+#define FIRMWARE_REFUSALS  60  // About a minute at the longest backoff
+
+/***
+ * Bulk data streams (streamBegin(), streamWrite(), streamEnd()). The sender
+ * keeps STREAM_WINDOW segments of STREAM_SEGMENT_SIZE bytes, writes them to the
+ * radio back to back and waits up to STREAM_TIMEOUT for a selective ack before
+ * sending what is missing again, waiting twice as long each time and up to as
+ * long again at random; it gives up after STREAM_RETRIES tries in a row that
+ * brought no new ack. A receiver tracks the streams of STREAM_PEERS senders at
+ * a time, more senders are told to wait for one of them to finish.
+ * Streams take about 236 bytes of RAM with a window of 8, so they are left
+ * out unless STREAM_WINDOW is set here or with -DSTREAM_WINDOW=8. Both the
+ * sender and the receiver (the gateway for streams to the controller) need
+ * them.
+ */
+#ifndef STREAM_WINDOW
+#define STREAM_WINDOW      0   // Segments, up to 16, 23 bytes of RAM each
+#endif
+#define STREAM_TIMEOUT     250 // ms
+#define STREAM_RETRIES     8
+#define STREAM_PEERS       4   // 11 bytes of RAM each
+
+/***
+ * Message statistics. Each node counts frames sent, failed and retransmitted,
+ * frames received per pipe, relayed messages, messages dropped for a protocol
+ * version mismatch or as duplicates and parent changes, and keeps a histogram
+ * of how long sends took. Read them with getStats(), or from the controller
+ * with an I_STATS request. Comment out to save the RAM.
+ */
+#define NODE_STATS               // 40 bytes of RAM
+
 // MySensors online examples defaults
 #define DEFAULT_CE_PIN 9
 #define DEFAULT_CS_PIN 10
@@ -20,4 +208,16 @@
  */
 #define DEBUG
 
+/***
+ * Binary debug logging. Instead of formatting text and waiting for the serial
+ * port, a node queues a short record of message id and raw arguments (see
+ * MyLog.h) and process() passes it on no faster than the UART sends, so
+ * logging never blocks. Records that find the queue full are counted and
+ * dropped. Text a sketch logs with debugPrint(PSTR(...)) is queued as is
+ * between the records. Capture the serial port and decode it on a PC with
+ * sim/build/LogDecode. The gateway keeps logging text to the controller.
+ */
+//#define DEBUG_BINARY
+#define DEBUG_LOG_SIZE     128 // Bytes of RAM (power of 2, max 128)
+
 #endif
@@ -0,0 +1,42 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyDuplicateCache.h"
+#include <string.h>
+
+
+#if DUPLICATE_CACHE_SIZE > 0
+
+MyDuplicateCache::MyDuplicateCache() {
+	count = 0;
+}
+
+bool MyDuplicateCache::seen(uint8_t sender, uint8_t seq, bool ack) {
+	uint8_t i = 0;
+	while (i < count && (entries[i].sender != sender || entries[i].seq != seq || entries[i].ack != ack)) {
+		i++;
+	}
+	bool found = i < count;
+	if (!found) {
+		// Drop the least recent one if full
+		if (count < DUPLICATE_CACHE_SIZE) {
+			count++;
+		}
+		i = count - 1;
+	}
+	memmove(&entries[1], &entries[0], i * sizeof(Entry));
+	entries[0].sender = sender;
+	entries[0].seq = seq;
+	entries[0].ack = ack;
+	return found;
+}
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyDuplicateCache_h
+#define MyDuplicateCache_h
+
+#include "MyConfig.h"
+#include <stdint.h>
+
+#if DUPLICATE_CACHE_SIZE > 0
+/**
+ * The last DUPLICATE_CACHE_SIZE messages a node received, by sender and
+ * sequence number, most recent first. A message seen again is a copy sent
+ * once more because its ack got lost, or one that went round a routing loop.
+ * Acks carry the sequence number of the message they answer, they go by the
+ * node that sent that message and the ack flag.
+ */
+class MyDuplicateCache
+{
+  public:
+	MyDuplicateCache();
+
+	/**
+	 * True if the message is in the cache. Either way it becomes the most
+	 * recent one.
+	 */
+	bool seen(uint8_t sender, uint8_t seq, bool ack);
+
+  private:
+	struct Entry {
+		uint8_t sender;
+		uint8_t seq;
+		bool ack;
+	};
+	Entry entries[DUPLICATE_CACHE_SIZE];
+	uint8_t count;
+};
+
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyEepromCache.h"
+#include <avr/eeprom.h>
+#include <string.h>
+
+
+MyEepromCache::MyEepromCache() {
+#if EEPROM_CACHE_SIZE > 0
+	count = 0;
+#endif
+}
+
+#if EEPROM_CACHE_SIZE > 0
+
+uint8_t MyEepromCache::read(uint16_t address) {
+	for (uint8_t i = 0; i < count; i++) {
+		if (entries[i].address == address) {
+			return entries[i].value;
+		}
+	}
+	return eeprom_read_byte((uint8_t*)(size_t)address);
+}
+
+void MyEepromCache::write(uint16_t address, uint8_t value) {
+	for (uint8_t i = 0; i < count; i++) {
+		if (entries[i].address == address) {
+			entries[i].value = value;
+			return;
+		}
+	}
+	if (count == EEPROM_CACHE_SIZE) {
+		writeOldest();
+	}
+	entries[count].address = address;
+	entries[count].value = value;
+	count++;
+}
+
+bool MyEepromCache::flushOne() {
+	if (count > 0 && eeprom_is_ready()) {
+		writeOldest();
+	}
+	return count > 0;
+}
+
+void MyEepromCache::flush() {
+	while (count > 0) {
+		writeOldest();
+	}
+}
+
+void MyEepromCache::writeOldest() {
+	Entry e = entries[0];
+	count--;
+	memmove(&entries[0], &entries[1], count * sizeof(Entry));
+	// A value changed and changed back before the flush needs no write cycle
+	uint8_t *p = (uint8_t*)(size_t)e.address;
+	if (eeprom_read_byte(p) != e.value) {
+		eeprom_write_byte(p, e.value);
+	}
+}
+
+#else
+
+uint8_t MyEepromCache::read(uint16_t address) {
+	return eeprom_read_byte((uint8_t*)(size_t)address);
+}
+
+void MyEepromCache::write(uint16_t address, uint8_t value) {
+	eeprom_write_byte((uint8_t*)(size_t)address, value);
+}
+
+bool MyEepromCache::flushOne() {
+	return false;
+}
+
+void MyEepromCache::flush() {
+}
+
+#endif
@@ -0,0 +1,65 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyEepromCache_h
+#define MyEepromCache_h
+
+#include "MyConfig.h"
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Write-back cache in front of EEPROM. A write only lands in RAM; writing the
+ * same address again before it is flushed replaces the pending value, so a
+ * route that flaps costs one EEPROM cycle instead of one per change. flushOne()
+ * starts at most one byte write and only when no other write is in progress,
+ * so it never blocks. With EEPROM_CACHE_SIZE 0 writes go straight to EEPROM.
+ */
+class MyEepromCache
+{
+  public:
+	MyEepromCache();
+
+	/**
+	 * Value at the address, pending writes included.
+	 */
+	uint8_t read(uint16_t address);
+
+	/**
+	 * Queue a write. Blocks only when the cache is full and the oldest
+	 * pending write has to go out first.
+	 */
+	void write(uint16_t address, uint8_t value);
+
+	/**
+	 * Write the oldest pending byte if the EEPROM is idle. Returns true while
+	 * writes are pending.
+	 */
+	bool flushOne();
+
+	/**
+	 * Write all pending bytes, waiting for each write cycle.
+	 */
+	void flush();
+
+  private:
+#if EEPROM_CACHE_SIZE > 0
+	struct Entry {
+		uint16_t address;
+		uint8_t value;
+	};
+	Entry entries[EEPROM_CACHE_SIZE]; // Oldest first
+	uint8_t count;
+	void writeOldest();
+#endif
+};
+
+#endif
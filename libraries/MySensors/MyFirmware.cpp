@@ -0,0 +1,167 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyFirmware.h"
+#include <Arduino.h>
+#include <util/crc16.h>
+
+#if FIRMWARE_WINDOW > 0
+
+#define FIRMWARE_IDLE     0
+#define FIRMWARE_ASKING   1
+#define FIRMWARE_FETCHING 2
+
+
+MyFirmware::MyFirmware() {
+	state = FIRMWARE_IDLE;
+}
+
+void MyFirmware::ask() {
+	state = FIRMWARE_ASKING;
+	timeouts = 0;
+	failures = 0;
+	dueAt = millis();
+}
+
+bool MyFirmware::askNow() {
+	unsigned long now = millis();
+	if (state != FIRMWARE_ASKING || (long)(now - dueAt) < 0) {
+		return false;
+	}
+	if (timeouts == FIRMWARE_RETRIES) {
+		state = FIRMWARE_IDLE;
+		return false;
+	}
+	// Twice as patient after each timeout, the parent may be busy relaying
+	dueAt = now + ((unsigned long)FIRMWARE_TIMEOUT << (timeouts > 3 ? 3 : timeouts));
+	timeouts++;
+	return true;
+}
+
+void MyFirmware::start(const FirmwareConfig &_config) {
+	config = _config;
+	state = config.blocks > 0 ? FIRMWARE_FETCHING : FIRMWARE_IDLE;
+	next = 0;
+	requested = 0;
+	crc = 0xFFFF;
+	timeouts = 0;
+	failures = 0;
+	wait = 0;
+	dueAt = millis();
+}
+
+void MyFirmware::stop() {
+	state = FIRMWARE_IDLE;
+}
+
+bool MyFirmware::active() {
+	return state != FIRMWARE_IDLE;
+}
+
+bool MyFirmware::fetching() {
+	return state == FIRMWARE_FETCHING;
+}
+
+const FirmwareConfig& MyFirmware::getConfig() {
+	return config;
+}
+
+bool MyFirmware::request(FirmwareRequest &r) {
+	if (state != FIRMWARE_FETCHING) {
+		return false;
+	}
+	unsigned long now = millis();
+	if ((long)(now - dueAt) < 0) {
+		// Window still on its way, or waiting to send again
+		return false;
+	}
+	// Nothing came in order for a while, the request or the rest of the window was lost
+	if (requested != next && ++timeouts > FIRMWARE_RETRIES) {
+		state = FIRMWARE_IDLE;
+		return false;
+	}
+	uint16_t count = config.blocks - next;
+	if (count > FIRMWARE_WINDOW) {
+		count = FIRMWARE_WINDOW;
+	}
+	r.type = config.type;
+	r.version = config.version;
+	r.block = next;
+	r.count = count;
+	requested = next + count;
+	first = next;
+	requestedAt = now;
+	// Windows of other nodes may be queued ahead of this one, allow for twice
+	// the usual wait, and twice as long again after each timeout
+	dueAt = now + ((FIRMWARE_TIMEOUT + 2UL * wait) << (timeouts > 3 ? 3 : timeouts));
+	return true;
+}
+
+void MyFirmware::sent(bool ok) {
+	if (ok) {
+		failures = 0;
+		return;
+	}
+	// The parent is busy, most likely the gateway sending another node its
+	// window. Not a timeout, but give up on a parent that stays busy.
+	if (state == FIRMWARE_ASKING) {
+		timeouts--;
+	}
+	if (++failures > FIRMWARE_REFUSALS) {
+		state = FIRMWARE_IDLE;
+		return;
+	}
+	// Random within a window that doubles with each failure, 16-47 ms up to
+	// 512-1535 ms, so the nodes waiting do not all come back at once
+	uint8_t round = failures > 5 ? 5 : failures - 1;
+	requested = next;
+	dueAt = millis() + (16UL << round) + (micros() % (32UL << round));
+}
+
+bool MyFirmware::received(const FirmwareBlock &b) {
+	if (state != FIRMWARE_FETCHING || b.type != config.type || b.version != config.version) {
+		return false;
+	}
+	if (b.block != next) {
+		if (b.block > next && b.block == requested - 1) {
+			// End of a window with blocks missing, ask again from the first one
+			requested = next;
+			dueAt = millis();
+		}
+		return false;
+	}
+	for (uint8_t i = 0; i < FIRMWARE_BLOCK_SIZE; i++) {
+		crc = _crc16_update(crc, b.data[i]);
+	}
+	if (next == first && timeouts == 0) {
+		// Only a window requested once tells how long one takes to start
+		unsigned long took = millis() - requestedAt;
+		if (took > 0xFFFF) {
+			took = 0xFFFF;
+		}
+		wait = wait ? (7UL * wait + took) / 8 : took;
+	}
+	next++;
+	timeouts = 0;
+	// The next window is due right after the last block of this one
+	dueAt = millis() + (next == requested ? 0 : FIRMWARE_TIMEOUT);
+	return true;
+}
+
+bool MyFirmware::complete() {
+	return state == FIRMWARE_FETCHING && next == config.blocks;
+}
+
+bool MyFirmware::verified() {
+	return crc == config.crc;
+}
+
+#endif
@@ -0,0 +1,153 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyFirmware_h
+#define MyFirmware_h
+
+#include "MyConfig.h"
+#include <stdint.h>
+
+#define FIRMWARE_BLOCK_SIZE 16 // Bytes of firmware per ST_FIRMWARE_RESPONSE
+
+/*
+ * Payloads of the ST_FIRMWARE_* stream messages (P_CUSTOM, little endian).
+ *
+ *   node -> controller  ST_FIRMWARE_CONFIG_REQUEST   FirmwareConfig installed now
+ *   controller -> node  ST_FIRMWARE_CONFIG_RESPONSE  FirmwareConfig to run
+ *   node -> controller  ST_FIRMWARE_REQUEST          FirmwareRequest
+ *   controller -> node  ST_FIRMWARE_RESPONSE         FirmwareBlock, one per block requested
+ *
+ * The controller may also send a config response on its own to start an
+ * update of a node that is awake.
+ */
+struct FirmwareConfig {
+	uint16_t type;    // Chosen by the controller, e.g. one per sketch
+	uint16_t version;
+	uint16_t blocks;  // Image length in FIRMWARE_BLOCK_SIZE blocks
+	uint16_t crc;     // CRC-16 (_crc16_update from 0xFFFF) over all blocks
+} __attribute__((packed));
+
+struct FirmwareRequest {
+	uint16_t type;
+	uint16_t version;
+	uint16_t block;   // First block wanted
+	uint8_t count;    // Blocks wanted from there on
+} __attribute__((packed));
+
+struct FirmwareBlock {
+	uint16_t type;
+	uint16_t version;
+	uint16_t block;
+	uint8_t data[FIRMWARE_BLOCK_SIZE];
+} __attribute__((packed));
+
+#if FIRMWARE_WINDOW > 0
+/**
+ * Over the air update of this node's firmware: asking the controller which
+ * firmware to run, then fetching the image. Blocks are taken in order only,
+ * so the CRC is kept as they arrive and no block has to be buffered. Each
+ * request asks for a window of FIRMWARE_WINDOW blocks, which the controller
+ * sends back to back, so the round trip to the controller is paid once per
+ * window rather than per block. The next request waits for the last block of
+ * the window: the gateway is sending until then, and a request written to it
+ * meanwhile would only fail. Blocks missing at the end of a window, or when
+ * nothing arrived in order in time, are requested again from the first one
+ * missing on (go back N). In time is FIRMWARE_TIMEOUT plus twice the smoothed
+ * wait for a window to start, so a node is not impatient while the gateway
+ * serves other nodes' windows first.
+ */
+class MyFirmware
+{
+  public:
+	MyFirmware();
+
+	/**
+	 * Ask the controller for the firmware config until it answers.
+	 */
+	void ask();
+
+	/**
+	 * True if the config request is due (again). Gives up after
+	 * FIRMWARE_RETRIES unanswered requests.
+	 */
+	bool askNow();
+
+	/**
+	 * Start fetching the given image from its first block.
+	 */
+	void start(const FirmwareConfig &config);
+
+	/**
+	 * Stop asking or fetching.
+	 */
+	void stop();
+
+	/**
+	 * True while asking or fetching.
+	 */
+	bool active();
+
+	/**
+	 * True while an image is being fetched.
+	 */
+	bool fetching();
+
+	/**
+	 * The image being fetched.
+	 */
+	const FirmwareConfig& getConfig();
+
+	/**
+	 * Blocks to request now. False if nothing is due, or if the download was
+	 * given up after FIRMWARE_RETRIES timeouts in a row.
+	 */
+	bool request(FirmwareRequest &request);
+
+	/**
+	 * Outcome of sending the last config or block request. A failed one is
+	 * sent again after a random wait that grows with each failure in a row,
+	 * up to FIRMWARE_REFUSALS times.
+	 */
+	void sent(bool ok);
+
+	/**
+	 * A block arrived. True if it is the one expected next, which is then
+	 * added to the CRC and has to be stored.
+	 */
+	bool received(const FirmwareBlock &block);
+
+	/**
+	 * True once all blocks have been received.
+	 */
+	bool complete();
+
+	/**
+	 * True if the blocks received add up to the CRC of the image.
+	 */
+	bool verified();
+
+  private:
+	FirmwareConfig config;
+	uint8_t state;
+	uint16_t next;            // Block expected next
+	uint16_t requested;       // Blocks before this one have been requested
+	uint16_t crc;             // Of the blocks before next
+	uint8_t timeouts;         // Timeouts in a row
+	uint8_t failures;         // Requests in a row the parent did not take
+	uint16_t first;           // First block of the window requested last
+	unsigned long requestedAt;
+	uint16_t wait;            // Smoothed ms from a request to its first block
+	unsigned long dueAt;      // Ask or request again from this time on
+};
+
+#endif
+
+#endif
@@ -11,7 +11,22 @@
 
 #include "MyGateway.h"
 #include "utility/MsTimer2.h"
+#ifdef RF24_IRQ_PIN
+// MySensor.cpp already defines the pin change ISRs for the radio interrupt
+#define LIBCALL_PINCHANGEINT
+#endif
+// It undefines DEBUG, which MyGateway.h was read with
+#ifdef DEBUG
 #include "utility/PinChangeInt.h"
+#define DEBUG
+#else
+#include "utility/PinChangeInt.h"
+#endif
+#include <util/crc16.h>
+
+#define CMD_PAYLOAD 5 // Index of the payload field
+#define CMD_DISCARD 0xFF
+#define FRAME_IDLE 0xFF
 
 
 uint8_t pinRx;
@@ -30,6 +45,8 @@ MyGateway::MyGateway(uint8_t _cepin, uint8_t _cspin, uint8_t _inclusion_time, ui
 	pinRx = _rx;
 	pinTx = _tx;
 	pinEr = _er;
+	parseReset();
+	framePos = FRAME_IDLE;
 }
 
 
@@ -37,6 +54,9 @@ void MyGateway::begin(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e da
 	Serial.begin(BAUD_RATE);
 	repeaterMode = true;
 	isGateway = true;
+#ifdef DEBUG
+	logWrite = serialLog;
+#endif
 	autoFindParent = false;
 	setupRepeaterMode();
 
@@ -51,6 +71,7 @@ void MyGateway::begin(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e da
 	nc.parentNodeId = 0;
 	nc.distance = 0;
 	inclusionMode = 0;
+	binaryMode = false;
 	buttonTriggeredInclusion = false;
 	countRx = 0;
 	countTx = 0;
@@ -88,7 +109,9 @@ void MyGateway::begin(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e da
 	PCintPort::attachInterrupt(pinInclusion, startInclusionInterrupt, RISING);
 
 	// Send startup log message on serial
-	serial(PSTR("0;0;%d;0;%d;Gateway startup complete.\n"),  C_INTERNAL, I_GATEWAY_READY);
+	serialStart(GATEWAY_ADDRESS, 0, C_INTERNAL, 0, I_GATEWAY_READY);
+	serialPrint_P(PSTR("Gateway startup complete."));
+	serialEnd();
 }
 
 
@@ -102,7 +125,9 @@ void MyGateway::checkButtonTriggeredInclusion() {
    if (buttonTriggeredInclusion) {
     // Ok, someone pressed the inclusion button on the gateway
     // start inclusion mode for 1 munute.
-    serial(PSTR("0;0;%d;0;%d;Inclusion started by button.\n"),  C_INTERNAL, I_LOG_MESSAGE);
+    serialStart(GATEWAY_ADDRESS, 0, C_INTERNAL, 0, I_LOG_MESSAGE);
+    serialPrint_P(PSTR("Inclusion started by button."));
+    serialEnd();
     buttonTriggeredInclusion = false;
     setInclusionMode(true);
   }
@@ -115,144 +140,387 @@ void MyGateway::checkInclusionFinished() {
 	 }
 }
 
+// Value of a hex digit, 0xFF if c is not one
 uint8_t MyGateway::h2i(char c) {
-	uint8_t i = 0;
-	if (c <= '9')
-		i += c - '0';
-	else if (c >= 'a')
-		i += c - 'a' + 10;
-	else
-		i += c - 'A' + 10;
-	return i;
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return 0xFF;
 }
 
-void MyGateway::parseAndSend(char *commandBuffer) {
-  boolean ok = false;
-  char *str, *p, *value=NULL;
-  uint8_t bvalue[MAX_PAYLOAD];
-  uint8_t blen = 0;
-  int i = 0;
-  uint16_t destination = 0;
-  uint8_t sensor = 0;
-  uint8_t command = 0;
-  uint8_t type = 0;
-  uint8_t ack = 0;
-
-  // Extract command data coming on serial line
-  for (str = strtok_r(commandBuffer, ";", &p);       // split using semicolon
-  		str && i < 6;         // loop while str is not null an max 5 times
-  		str = strtok_r(NULL, ";", &p)               // get subsequent tokens
-				) {
-	switch (i) {
-	  case 0: // Radioid (destination)
-	 	destination = atoi(str);
-		break;
-	  case 1: // Childid
-		sensor = atoi(str);
-		break;
-	  case 2: // Message type
-		command = atoi(str);
-		break;
-	  case 3: // Should we request ack from destination?
-		ack = atoi(str);
-		break;
-	  case 4: // Data type
-		type = atoi(str);
-		break;
-	  case 5: // Variable value
-		if (command == C_STREAM) {
-			blen = 0;
-			uint8_t val;
-			while (*str) {
-				val = h2i(*str++) << 4;
-				val += h2i(*str++);
-				bvalue[blen] = val;
-				blen++;
-			}
-		} else {
-			value = str;
-			// Remove ending carriage return character (if it exists)
-			uint8_t lastCharacter = strlen(value)-1;
-			if (value[lastCharacter] == '\r')
-				value[lastCharacter] = 0;
-		}
-		break;
-	  }
-	  i++;
+/*
+ * Incremental parser for "destination;sensor;command;ack;type;payload" lines
+ * from the controller. The header fields are stored into cmdMsg as they end and
+ * the payload is written straight into its data, hex decoded for C_STREAM.
+ */
+
+void MyGateway::parse(char c) {
+  if (binaryMode && (framePos != FRAME_IDLE || (uint8_t)c == FRAME_START)) {
+    parseFrame(c);
+  } else if (c == '\n') {
+    boolean ok;
+    if (cmdField < CMD_PAYLOAD) {
+      // A line without payload separator ends in the type field
+      ok = cmdField == CMD_PAYLOAD-1 && parseField();
+    } else {
+      ok = cmdField != CMD_DISCARD;
+    }
+    if (ok && parsePayload()) {
+      // Controller has fallen back to text, probably restarted
+      binaryMode = false;
+      sendCommand();
+    }
+    parseReset();
+  } else if (c == '\r' || cmdField == CMD_DISCARD) {
+    // Carriage returns are ignored, and so is the rest of a bad line
+  } else if (cmdField < CMD_PAYLOAD) {
+    if (c == ';') {
+      cmdField = parseField() ? cmdField+1 : CMD_DISCARD;
+    } else if (c >= '0' && c <= '9' && cmdValue <= 255) {
+      cmdValue = cmdValue*10 + (c - '0');
+      cmdDigits = true;
+    } else {
+      cmdField = CMD_DISCARD;
+    }
+  } else if (cmdField == CMD_PAYLOAD) {
+    if (c == ';') {
+      // Anything behind the payload is ignored
+      cmdField++;
+    } else if (mGetCommand(cmdMsg) == C_STREAM) {
+      uint8_t nibble = h2i(c);
+      if (nibble > 0x0F || cmdLength == MAX_PAYLOAD*2) {
+        cmdField = CMD_DISCARD;
+      } else {
+        uint8_t *b = (uint8_t *)&cmdMsg.data[cmdLength>>1];
+        *b = (cmdLength & 1) ? *b | nibble : nibble << 4;
+        cmdLength++;
+      }
+    } else if (cmdLength < MAX_PAYLOAD) {
+      // Longer strings are truncated, as MyMessage::set() does
+      cmdMsg.data[cmdLength++] = c;
+    }
+  }
+}
+
+boolean MyGateway::parseField() {
+  if (!cmdDigits || cmdValue > 255) {
+    return false;
+  }
+  switch (cmdField) {
+    case 0: // Radioid (destination)
+      cmdMsg.destination = cmdValue;
+      break;
+    case 1: // Childid
+      cmdMsg.sensor = cmdValue;
+      break;
+    case 2: // Message type
+      if (cmdValue > C_STREAM) {
+        return false;
+      }
+      mSetCommand(cmdMsg, cmdValue);
+      break;
+    case 3: // Should we request ack from destination?
+      mSetRequestAck(cmdMsg, cmdValue?1:0);
+      break;
+    case 4: // Data type
+      cmdMsg.type = cmdValue;
+      break;
+  }
+  cmdValue = 0;
+  cmdDigits = false;
+  return true;
+}
+
+boolean MyGateway::parsePayload() {
+  if (mGetCommand(cmdMsg) == C_STREAM) {
+    if (cmdLength & 1) {
+      // Odd number of hex digits
+      return false;
+    }
+    mSetLength(cmdMsg, cmdLength>>1);
+    mSetPayloadType(cmdMsg, P_CUSTOM);
+  } else {
+    cmdMsg.data[cmdLength] = 0;
+    mSetLength(cmdMsg, cmdLength);
+    mSetPayloadType(cmdMsg, P_STRING);
+  }
+  return true;
+}
+
+void MyGateway::parseReset() {
+  cmdField = 0;
+  cmdLength = 0;
+  cmdValue = 0;
+  cmdDigits = false;
+}
+
+void MyGateway::parseFrame(uint8_t c) {
+  if (framePos == FRAME_IDLE) {
+    // FRAME_START
+    framePos = 0;
+    frameCrc = 0;
+    return;
   }
+  if (framePos == 0) {
+    if (c < HEADER_SIZE || c > MAX_MESSAGE_LENGTH) {
+      // Not a frame, wait for the next FRAME_START
+      framePos = FRAME_IDLE;
+      return;
+    }
+    frameLength = c;
+  } else if (framePos <= frameLength) {
+    ((uint8_t *)&cmdMsg)[framePos-1] = c;
+  } else {
+    framePos = FRAME_IDLE;
+    uint8_t length = mGetLength(cmdMsg);
+    if (c == frameCrc && length == frameLength-HEADER_SIZE && mGetCommand(cmdMsg) <= C_STREAM) {
+      cmdMsg.data[length] = 0;
+      sendCommand();
+    }
+    return;
+  }
+  frameCrc = _crc_ibutton_update(frameCrc, c);
+  framePos++;
+}
 
-  if (destination==GATEWAY_ADDRESS && command==C_INTERNAL) {
+void MyGateway::sendCommand() {
+  uint8_t command = mGetCommand(cmdMsg);
+  if (cmdMsg.destination==GATEWAY_ADDRESS && command==C_INTERNAL) {
     // Handle messages directed to gateway
-    if (type == I_VERSION) {
+    if (cmdMsg.type == I_VERSION) {
       // Request for version
-      serial(PSTR("0;0;%d;0;%d;%s\n"),C_INTERNAL, I_VERSION, LIBRARY_VERSION);
-    } else if (type == I_INCLUSION_MODE) {
+      serialStart(GATEWAY_ADDRESS, 0, C_INTERNAL, 0, I_VERSION);
+      serialPrint_P(PSTR(LIBRARY_VERSION));
+      serialEnd();
+    } else if (cmdMsg.type == I_INCLUSION_MODE) {
       // Request to change inclusion mode
-      setInclusionMode(atoi(value) == 1);
+      setInclusionMode(atoi(cmdMsg.data) == 1);
+    } else if (cmdMsg.type == I_BINARY_MODE) {
+      setBinaryMode(atoi(cmdMsg.data) == 1);
+#ifdef NODE_STATS
+    } else if (cmdMsg.type == I_STATS) {
+      // Statistics of the gateway itself
+      uint8_t page = cmdMsg.getByte();
+      cmdMsg.sender = GATEWAY_ADDRESS;
+      mSetRequestAck(cmdMsg,false);
+      mSetAck(cmdMsg,false);
+      serial(setStats(cmdMsg, page));
+#endif
     }
   } else {
+    cmdMsg.sender = GATEWAY_ADDRESS;
+    mSetAck(cmdMsg,false);
+#if MAILBOX_SIZE > 0
+    if (mailbox.isAsleep(cmdMsg.destination)) {
+      // Sent when the node wakes up and sends something
+      uint8_t dropped = mailbox.put(cmdMsg);
+      if (dropped != BROADCAST_ADDRESS) {
+        debug(LOG_MAILBOX_FULL, dropped);
+        errBlink(1);
+      }
+      return;
+    }
+#endif
     txBlink(1);
-    msg.sender = GATEWAY_ADDRESS;
-	msg.destination = destination;
-	msg.sensor = sensor;
-	msg.type = type;
-	mSetCommand(msg,command);
-	mSetRequestAck(msg,ack?1:0);
-	mSetAck(msg,false);
-	if (command == C_STREAM)
-		msg.set(bvalue, blen);
-	else
-		msg.set(value);
-    ok = sendRoute(msg);
-    if (!ok) {
+    if (!sendRoute(cmdMsg)) {
       errBlink(1);
     }
   }
 }
 
+void MyGateway::parseAndSend(char *commandBuffer) {
+  while (*commandBuffer) {
+    parse(*commandBuffer++);
+  }
+  parse('\n');
+}
+
 
 void MyGateway::setInclusionMode(boolean newMode) {
   if (newMode != inclusionMode)
     inclusionMode = newMode;
     // Send back mode change on serial line to ack command
-    serial(PSTR("0;0;%d;0;%d;%d\n"), C_INTERNAL, I_INCLUSION_MODE, inclusionMode?1:0);
+    serialStart(GATEWAY_ADDRESS, 0, C_INTERNAL, 0, I_INCLUSION_MODE);
+    serialPrint(inclusionMode?1:0);
+    serialEnd();
 
     if (inclusionMode) {
       inclusionStartTime = millis();
     }
 }
 
+void MyGateway::setBinaryMode(boolean newMode) {
+  // Frames contain zero bytes, a write callback only takes strings
+  if (useWriteCallback) {
+    newMode = false;
+  }
+  // Confirm in the current mode, the controller switches when it sees the reply
+  serialStart(GATEWAY_ADDRESS, 0, C_INTERNAL, 0, I_BINARY_MODE);
+  serialPrint(newMode?1:0);
+  serialEnd();
+  binaryMode = newMode;
+}
+
 void MyGateway::processRadioMessage() {
 	if (process()) {
 	  // A new message was received from one of the sensors
-	  MyMessage message = getLastMessage();
+	  const MyMessage &message = getLastMessage();
 	  if (mGetCommand(message) == C_PRESENTATION && inclusionMode) {
 		rxBlink(3);
 	  } else {
 		rxBlink(1);
 	  }
 	  // Pass along the message from sensors to serial line
-	  serial(message);
+	  if (mGetCommand(message) == C_BATCH) {
+		// Controller gets the values one by one
+		MyMessage value;
+		uint8_t pos = 0;
+		while (message.getBatchValue(pos, value)) {
+		  serial(value);
+		}
+	  } else {
+		serial(message);
+	  }
+#if MAILBOX_SIZE > 0
+	  uint8_t sender = message.sender;
+	  if (mGetCommand(message) == C_INTERNAL && message.type == I_SLEEPING) {
+		mailbox.setAsleep(sender, true);
+	  } else {
+		// The node is awake for a little while, pass on what came for it
+		mailbox.setAsleep(sender, false);
+		MyMessage mail;
+		while (mailbox.take(sender, mail)) {
+		  txBlink(1);
+		  if (!sendRoute(mail)) {
+			errBlink(1);
+		  }
+		}
+	  }
+#endif
 	}
 
 	checkButtonTriggeredInclusion();
 	checkInclusionFinished();
 }
 
-void MyGateway::serial(const char *fmt, ... ) {
-   va_list args;
-   va_start (args, fmt );
-   vsnprintf_P(serialBuffer, MAX_SEND_LENGTH, fmt, args);
-   va_end (args);
-   Serial.print(serialBuffer);
-   if (useWriteCallback) {
-	   // We have a registered write callback (probably Ethernet)
-	   dataCallback(serialBuffer);
-   }
+void MyGateway::serial(const MyMessage &msg) {
+  if (binaryMode) {
+    uint8_t length = HEADER_SIZE + min(mGetLength(msg), MAX_PAYLOAD);
+    memcpy(serialBuffer+2, &msg, length);
+    serialFrame(length);
+    return;
+  }
+  serialStart(msg.sender, msg.sensor, mGetCommand(msg), mGetAck(msg), msg.type);
+  // Payload is converted straight into the buffer, it always fits behind the header
+  msg.getString(serialBuffer+serialLength);
+  serialLength += strlen(serialBuffer+serialLength);
+  serialEnd();
 }
 
-void MyGateway::serial(MyMessage &msg) {
-  serial(PSTR("%d;%d;%d;%d;%d;%s\n"),msg.sender, msg.sensor, mGetCommand(msg), mGetAck(msg), msg.type, msg.getString(convBuf));
+/*
+ * Encoder for the "sender;sensor;command;ack;type;payload\n" lines sent to the
+ * controller. Fields are written in place, no format string is parsed. In binary
+ * mode the header goes into a frame and the payload text is its string payload.
+ */
+
+void MyGateway::serialStart(uint8_t sender, uint8_t sensor, uint8_t command, uint8_t ack, uint8_t type) {
+  if (binaryMode) {
+    MyMessage &m = *(MyMessage *)(serialBuffer+2);
+    m.last = sender;
+    m.sender = sender;
+    m.destination = GATEWAY_ADDRESS;
+    m.version_length = 0;
+    m.command_ack_payload = 0;
+    mSetVersion(m, PROTOCOL_VERSION);
+    mSetCommand(m, command);
+    mSetAck(m, ack);
+    mSetPayloadType(m, P_STRING);
+    m.type = type;
+    m.sensor = sensor;
+    serialLength = 2+HEADER_SIZE;
+    return;
+  }
+  serialLength = 0;
+  serialPrint(sender);
+  serialBuffer[serialLength++] = ';';
+  serialPrint(sensor);
+  serialBuffer[serialLength++] = ';';
+  serialPrint(command);
+  serialBuffer[serialLength++] = ';';
+  serialPrint(ack);
+  serialBuffer[serialLength++] = ';';
+  serialPrint(type);
+  serialBuffer[serialLength++] = ';';
+}
+
+void MyGateway::serialPrint(uint8_t value) {
+  // Repeated subtraction, the AVR has no divide instruction
+  char *p = serialBuffer+serialLength;
+  if (value >= 100) {
+    char digit = '0';
+    do { value -= 100; digit++; } while (value >= 100);
+    *p++ = digit;
+    digit = '0';
+    while (value >= 10) { value -= 10; digit++; }
+    *p++ = digit;
+  } else if (value >= 10) {
+    char digit = '0';
+    do { value -= 10; digit++; } while (value >= 10);
+    *p++ = digit;
+  }
+  *p++ = '0' + value;
+  serialLength = p - serialBuffer;
+}
+
+void MyGateway::serialPrint_P(const char *str) {
+  char c;
+  while (serialLength < MAX_SEND_LENGTH-2 && (c = pgm_read_byte(str++)) != 0) {
+    serialBuffer[serialLength++] = c;
+  }
+}
+
+void MyGateway::serialEnd() {
+  if (binaryMode) {
+    MyMessage &m = *(MyMessage *)(serialBuffer+2);
+    uint8_t length = min((uint8_t)(serialLength-(2+HEADER_SIZE)), MAX_PAYLOAD);
+    mSetLength(m, length);
+    serialFrame(HEADER_SIZE+length);
+    return;
+  }
+  serialBuffer[serialLength++] = '\n';
+  serialBuffer[serialLength] = 0;
+  Serial.write((const uint8_t *)serialBuffer, serialLength);
+  if (useWriteCallback) {
+    // We have a registered write callback (probably Ethernet)
+    dataCallback(serialBuffer);
+  }
+}
+
+#ifdef DEBUG
+void MyGateway::serialLog(MySensor *gw, const char *text) {
+  // Debug output of the library, one line at a time
+  MyGateway *g = (MyGateway *)gw;
+  g->serialStart(GATEWAY_ADDRESS, 0, C_INTERNAL, 0, I_LOG_MESSAGE);
+  while (*text && *text != '\n' && g->serialLength < MAX_SEND_LENGTH-2) {
+    g->serialBuffer[g->serialLength++] = *text++;
+  }
+  g->serialEnd();
+}
+#endif
+
+void MyGateway::serialFrame(uint8_t length) {
+  // The message is already at serialBuffer+2
+  uint8_t crc = _crc_ibutton_update(0, length);
+  for (uint8_t i = 2; i < 2+length; i++) {
+    crc = _crc_ibutton_update(crc, serialBuffer[i]);
+  }
+  serialBuffer[0] = FRAME_START;
+  serialBuffer[1] = length;
+  serialBuffer[2+length] = crc;
+  Serial.write((const uint8_t *)serialBuffer, 3+length);
 }
 
 
@@ -17,6 +17,18 @@
 #define MAX_RECEIVE_LENGTH 100 // Max buffersize needed for messages coming from controller
 #define MAX_SEND_LENGTH 120 // Max buffersize needed for messages destined for controller
 
+/*
+ * Binary frames, used in both directions once the controller has sent
+ * "0;0;3;0;15;1" (I_BINARY_MODE) and the gateway has confirmed with the same line:
+ *
+ *   FRAME_START, length, length bytes of MyMessage (header + payload), CRC-8
+ *
+ * The CRC is the Dallas/Maxim CRC-8 (_crc_ibutton_update) over length and message.
+ * A binary I_BINARY_MODE message with payload "0" switches back to text, and so
+ * does any valid text command, e.g. the I_VERSION request of a restarted controller.
+ */
+#define FRAME_START 0xA5 // First byte of a frame, never part of a text line
+
 class MyGateway : public MySensor
 {
 	public:
@@ -42,21 +54,57 @@ class MyGateway : public MySensor
 		void begin(rf24_pa_dbm_e paLevel=RF24_PA_LEVEL_GW, uint8_t channel=RF24_CHANNEL, rf24_datarate_e dataRate=RF24_DATARATE, void (*dataCallback)(char *)=NULL);
 
 		void processRadioMessage();
+
+		/**
+		* Feed one character received from the controller. Commands are parsed as the
+		* characters arrive and sent when the terminating newline is seen, so no line
+		* buffer is needed. Malformed lines are dropped. In binary mode frames are
+		* accepted as well.
+		*/
+		void parse(char c);
+
+		/* Parse and send one complete command line (without newline) */
 	    void parseAndSend(char *inputString);
 
 	private:
-	    char convBuf[MAX_PAYLOAD*2+1];
 	    char serialBuffer[MAX_SEND_LENGTH]; // Buffer for building string when sending data to vera
+	    uint8_t serialLength;
 	    unsigned long inclusionStartTime;
 	    boolean useWriteCallback;
 	    void (*dataCallback)(char *);
 	    uint8_t pinInclusion;
 	    uint8_t inclusionTime;
+	    MyMessage cmdMsg; // Command from controller being parsed
+	    uint8_t cmdField; // Field being parsed, CMD_DISCARD skips the rest of the line
+	    uint8_t cmdLength; // Payload characters (hex digits for streams) received
+	    uint16_t cmdValue; // Numeric field being parsed
+	    boolean cmdDigits; // Numeric field has at least one digit
+	    boolean binaryMode; // Controller speaks binary frames
+	    uint8_t framePos; // Bytes of the incoming frame received, FRAME_IDLE outside a frame
+	    uint8_t frameLength;
+	    uint8_t frameCrc;
+#if MAILBOX_SIZE > 0
+	    MyMailbox mailbox; // Controller messages for sleeping nodes
+#endif
 
 		uint8_t h2i(char c);
 
-	    void serial(const char *fmt, ... );
-	    void serial(MyMessage &msg);
+	    boolean parseField();
+	    boolean parsePayload();
+	    void parseReset();
+	    void parseFrame(uint8_t c);
+	    void sendCommand();
+	    void setBinaryMode(boolean newMode);
+
+	    void serial(const MyMessage &msg);
+	    void serialStart(uint8_t sender, uint8_t sensor, uint8_t command, uint8_t ack, uint8_t type);
+	    void serialPrint(uint8_t value);
+	    void serialPrint_P(const char *str);
+	    void serialEnd();
+	    void serialFrame(uint8_t length);
+#ifdef DEBUG
+	    static void serialLog(MySensor *gw, const char *text);
+#endif
 	    void checkButtonTriggeredInclusion();
 	    void setInclusionMode(boolean newMode);
 	    void checkInclusionFinished();
@@ -0,0 +1,84 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyLinkQuality.h"
+#include <Arduino.h>
+
+#define RETRY_DELAY_MIN 5     // 1500 us, room for an ack payload at 250 kbps
+#define RETRY_COUNT_DEAD 5    // Retries once the parent seems gone
+#define SEARCH_BACKOFF_MAX 6  // Waits double up to 64 times PARENT_SEARCH_BACKOFF
+
+
+MyLinkQuality::MyLinkQuality() {
+	searchAt = 0;
+	reset();
+}
+
+void MyLinkQuality::reset() {
+	quality = 255;
+	retransmits = 0;
+	failures = 0;
+	searches = 0;
+}
+
+void MyLinkQuality::sent(bool ok, uint8_t arc) {
+	quality += ((ok ? 255 : 0) - (int16_t)quality) / 8;
+	retransmits += ((int16_t)(arc << 4) - retransmits) / 8;
+	if (ok) {
+		failures = 0;
+		if (quality >= 2 * PARENT_SEARCH_QUALITY) {
+			searches = 0;
+		}
+	} else if (failures < 255) {
+		failures++;
+	}
+}
+
+uint8_t MyLinkQuality::delivery() {
+	return quality;
+}
+
+uint8_t MyLinkQuality::retryDelay() {
+	// Longer with more retransmissions, the medium is busy. The jitter keeps
+	// neighbours that collided from colliding again on every retry.
+	uint8_t ard = RETRY_DELAY_MIN + (retransmits >> 5) + (micros() & 0x3);
+	return ard > 15 ? 15 : ard;
+}
+
+uint8_t MyLinkQuality::retryCount() {
+	// Do not keep the air busy for a parent that no longer acks
+	return failures > 1 ? RETRY_COUNT_DEAD : 15;
+}
+
+uint8_t MyLinkQuality::backoff(uint8_t round) {
+	// Random within a window that doubles each round: 2-5, 4-11, 8-23 ms ...
+	if (round > 5) {
+		round = 5;
+	}
+	return (1 << round) + (micros() & ((2 << round) - 1));
+}
+
+bool MyLinkQuality::searchParent(bool orphan) {
+	if (!orphan && failures <= SEARCH_FAILURES && quality >= PARENT_SEARCH_QUALITY) {
+		return false;
+	}
+	unsigned long now = millis();
+	if ((long)(now - searchAt) < 0) {
+		return false;
+	}
+	searchAt = now + ((unsigned long)PARENT_SEARCH_BACKOFF << searches);
+	// Without a parent there is no link to spare, keep searching at the shortest wait
+	if (!orphan && searches < SEARCH_BACKOFF_MAX) {
+		searches++;
+	}
+	failures = 0;
+	return true;
+}
@@ -0,0 +1,77 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyLinkQuality_h
+#define MyLinkQuality_h
+
+#include "MyConfig.h"
+#include <stdint.h>
+
+/**
+ * Retry policy for the link to the parent. It keeps running averages (1/8
+ * weight per write) of delivered writes and of hardware retransmissions read
+ * from OBSERVE_TX, and derives the auto retry settings, the backoff between
+ * retry rounds of queued messages and when to look for a new parent from them.
+ * MySensor only uses the methods below, so another policy can be dropped in by
+ * changing this class.
+ */
+class MyLinkQuality
+{
+  public:
+	MyLinkQuality();
+
+	/**
+	 * Forget the history of the link, for a new parent.
+	 */
+	void reset();
+
+	/**
+	 * Outcome of a write to the parent and the retransmissions it took.
+	 */
+	void sent(bool ok, uint8_t retransmits);
+
+	/**
+	 * Share of writes delivered lately, 0 (none) to 255 (all).
+	 */
+	uint8_t delivery();
+
+	/**
+	 * Auto retry delay for the next write, in steps of 250 us (0-15).
+	 */
+	uint8_t retryDelay();
+
+	/**
+	 * Auto retries for the next write to the parent (0-15).
+	 */
+	uint8_t retryCount();
+
+	/**
+	 * Milliseconds to listen before retry round 'round' (1, 2, ...) of a
+	 * queued message.
+	 */
+	uint8_t backoff(uint8_t round);
+
+	/**
+	 * Call after a failed write to the parent, orphan if the node has none yet.
+	 * True if a new parent should be searched now, which also starts the wait
+	 * before the next search.
+	 */
+	bool searchParent(bool orphan);
+
+  private:
+	uint8_t quality;        // Average of delivered writes, 255 = all
+	uint8_t retransmits;    // Average retransmissions per write, in 1/16
+	uint8_t failures;       // Failed writes in a row
+	uint8_t searches;       // Searches since the link was last good
+	unsigned long searchAt; // No new search before this time
+};
+
+#endif
@@ -0,0 +1,52 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyLog_h
+#define MyLog_h
+
+/*
+ * Debug messages of the library by id. Text logging prints the format, binary
+ * logging (DEBUG_BINARY) sends a record instead:
+ *
+ *   LOG_START, id, length, arguments (length bytes)
+ *
+ * where %d is 2 bytes, little endian, and %s the string (at most
+ * LOG_STRING_MAX characters) and its 0. sim/LogDecode.cpp turns records back
+ * into text with this table, so add new messages at the end only.
+ */
+#define LOG_MESSAGES(X) \
+	X(LOG_DROPPED,          "%d log records dropped\n") \
+	X(LOG_STARTED,          "%s started, id %d\n") \
+	X(LOG_CHECK_WIRES,      "check wires\n") \
+	X(LOG_REQ_NODE_ID,      "req node id\n") \
+	X(LOG_SEND,             "send: %d-%d-%d-%d s=%d,c=%d,t=%d,pt=%d,l=%d,st=%s:%s\n") \
+	X(LOG_READ,             "read: %d-%d-%d s=%d,c=%d,t=%d,pt=%d,l=%d:%s\n") \
+	X(LOG_VERSION_MISMATCH, "version mismatch\n") \
+	X(LOG_NEW_PARENT,       "new parent=%d, d=%d\n") \
+	X(LOG_FULL,             "full\n") \
+	X(LOG_ID,               "id=%d\n") \
+	X(LOG_CLEAR_ROUTES,     "rd=clear\n") \
+	X(LOG_FIRMWARE,         "fw type=%d, v=%d, blocks=%d\n") \
+	X(LOG_FIRMWARE_DONE,    "fw ok\n") \
+	X(LOG_FIRMWARE_FAIL,    "fw fail\n") \
+	X(LOG_STREAM_FAIL,      "stream to=%d fail\n") \
+	X(LOG_DUPLICATE,        "dup: %d-%d q=%d\n") \
+	X(LOG_MAILBOX_FULL,     "mailbox full, dropped to=%d\n")
+
+#define LOG_ENUM(id, format) id,
+enum { LOG_MESSAGES(LOG_ENUM) LOG_COUNT };
+#undef LOG_ENUM
+
+#define LOG_START 0xB5       // First byte of a binary record, never part of text
+#define LOG_RECORD_SIZE 64   // Longest record
+#define LOG_STRING_MAX 24    // Longer %s arguments are cut
+
+#endif
@@ -161,7 +161,6 @@ void MyMQTT::begin(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataR
 void MyMQTT::processRadioMessage() {
 	if (process()) {
 		// A new message was received from one of the sensors
-		MyMessage message = getLastMessage();
 		rxBlink(1);
 
 		if (msg.isAck()) {
@@ -201,9 +200,16 @@ void MyMQTT::processRadioMessage() {
 						errBlink(1);
 					}
 				}
+			} else if (mGetCommand(msg) == C_BATCH) {
+				// Publish the values one by one
+				MyMessage value;
+				uint8_t pos = 0;
+				while (msg.getBatchValue(pos, value)) {
+					SendMQTT(value);
+				}
 			} else if (mGetCommand(msg)!= C_PRESENTATION) {
 				// Pass along the message from sensors to MQTT
-				SendMQTT(message);
+				SendMQTT(msg);
 			}
 		}
 	}
@@ -333,10 +339,8 @@ void MyMQTT::SendMQTT(MyMessage &msg) {
 #ifdef DEBUG
 	Serial.println((char*)&buffer[4]);
 #endif
-	msg.getString(convBuf);
-	for (uint8_t a=0; a<strlen(convBuf); a++) {	// Payload
-		buffer[buffsize++] = convBuf[a];
-	}
+	// Payload, converted straight into the packet
+	buffsize+=strlen(msg.getString(&buffer[buffsize]));
 	buffer[1]=buffsize-2;			// Set correct Remaining length on byte 2.
 	dataCallback(buffer, &buffsize);
 }
@@ -0,0 +1,68 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyMailbox.h"
+#include "MySensor.h"
+#include <string.h>
+
+
+#if MAILBOX_SIZE > 0
+
+MyMailbox::MyMailbox() {
+	count = 0;
+	memset(asleep, 0, sizeof(asleep));
+}
+
+void MyMailbox::setAsleep(uint8_t node, bool sleeping) {
+	if (sleeping) {
+		asleep[node >> 3] |= 1 << (node & 7);
+	} else {
+		asleep[node >> 3] &= ~(1 << (node & 7));
+	}
+}
+
+bool MyMailbox::isAsleep(uint8_t node) {
+	return asleep[node >> 3] & (1 << (node & 7));
+}
+
+uint8_t MyMailbox::put(const MyMessage &message) {
+	if (mGetCommand(message) == C_SET) {
+		// Only the latest value matters
+		for (uint8_t i = 0; i < count; i++) {
+			MyMessage &m = messages[i];
+			if (m.destination == message.destination && m.sensor == message.sensor &&
+					mGetCommand(m) == C_SET && m.type == message.type) {
+				m = message;
+				return BROADCAST_ADDRESS;
+			}
+		}
+	}
+	uint8_t dropped = BROADCAST_ADDRESS;
+	if (count == MAILBOX_SIZE) {
+		dropped = messages[0].destination;
+		memmove(&messages[0], &messages[1], --count * sizeof(MyMessage));
+	}
+	messages[count++] = message;
+	return dropped;
+}
+
+bool MyMailbox::take(uint8_t node, MyMessage &message) {
+	for (uint8_t i = 0; i < count; i++) {
+		if (messages[i].destination == node) {
+			message = messages[i];
+			memmove(&messages[i], &messages[i + 1], (--count - i) * sizeof(MyMessage));
+			return true;
+		}
+	}
+	return false;
+}
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyMailbox_h
+#define MyMailbox_h
+
+#include "MyConfig.h"
+#include "MyMessage.h"
+#include <stdint.h>
+
+#if MAILBOX_SIZE > 0
+/**
+ * Messages from the controller kept by the gateway for sleeping nodes, oldest
+ * first, and which nodes are asleep. A node is asleep from its I_SLEEPING
+ * until the next message it sends.
+ */
+class MyMailbox
+{
+  public:
+	MyMailbox();
+
+	void setAsleep(uint8_t node, bool asleep);
+	bool isAsleep(uint8_t node);
+
+	/**
+	 * Keeps the message for its destination. Returns the destination of the
+	 * message dropped to make room, BROADCAST_ADDRESS if none was.
+	 */
+	uint8_t put(const MyMessage &message);
+
+	/**
+	 * Takes the oldest message for node out of the mailbox. False if there is
+	 * none.
+	 */
+	bool take(uint8_t node, MyMessage &message);
+
+  private:
+	MyMessage messages[MAILBOX_SIZE];
+	uint8_t count;
+	uint8_t asleep[32]; // One bit per node id
+};
+
+#endif
+
+#endif
@@ -224,3 +224,46 @@ MyMessage& MyMessage::set(int value) {
 	iValue = value;
 	return *this;
 }
+
+#define BATCH_VALUE_HEADER 3 // sensor, type, payload type (3 bit) and length (5 bit)
+
+bool MyMessage::addBatchValue(const MyMessage &value) {
+	uint8_t length = miGetLength();
+	uint8_t valueLength = mGetLength(value);
+	if (length + BATCH_VALUE_HEADER + valueLength > MAX_PAYLOAD) {
+		return false;
+	}
+	uint8_t *p = (uint8_t *)data + length;
+	*p++ = value.sensor;
+	*p++ = value.type;
+	*p++ = (mGetPayloadType(value) << 5) | valueLength;
+	memcpy(p, value.data, valueLength);
+	miSetLength(length + BATCH_VALUE_HEADER + valueLength);
+	return true;
+}
+
+bool MyMessage::getBatchValue(uint8_t &pos, MyMessage &value) const {
+	uint8_t length = miGetLength();
+	if (pos + BATCH_VALUE_HEADER > length) {
+		return false;
+	}
+	const uint8_t *p = (const uint8_t *)data + pos;
+	uint8_t valueLength = p[2] & 0x1F;
+	if (pos + BATCH_VALUE_HEADER + valueLength > length) {
+		return false;
+	}
+	value.last = last;
+	value.sender = sender;
+	value.destination = destination;
+	value.version_length = version_length;
+	value.command_ack_payload = command_ack_payload;
+	mSetCommand(value, C_SET);
+	mSetPayloadType(value, p[2] >> 5);
+	mSetLength(value, valueLength);
+	value.sensor = p[0];
+	value.type = p[1];
+	memcpy(value.data, p + BATCH_VALUE_HEADER, valueLength);
+	value.data[valueLength] = 0;
+	pos += BATCH_VALUE_HEADER + valueLength;
+	return true;
+}
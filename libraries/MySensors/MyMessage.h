@@ -18,9 +18,9 @@
 #include <stdint.h>
 #endif
 
-#define PROTOCOL_VERSION 2
+#define PROTOCOL_VERSION 3
 #define MAX_MESSAGE_LENGTH 32
-#define HEADER_SIZE 7
+#define HEADER_SIZE 8
 #define MAX_PAYLOAD (MAX_MESSAGE_LENGTH - HEADER_SIZE)
 
 // Message types
@@ -29,7 +29,8 @@ typedef enum {
 	C_SET = 1,
 	C_REQ = 2,
 	C_INTERNAL = 3,
-	C_STREAM = 4 // For Firmware and other larger chunks of data that need to be divided into pieces.
+	C_STREAM = 4, // For Firmware and other larger chunks of data that need to be divided into pieces.
+	C_BATCH = 5 // Several set values packed into one message, see addBatchValue().
 } mysensor_command;
 
 // Type of sensor data (for set/req/ack messages)
@@ -47,7 +48,7 @@ typedef enum {
 	I_BATTERY_LEVEL, I_TIME, I_VERSION, I_ID_REQUEST, I_ID_RESPONSE,
 	I_INCLUSION_MODE, I_CONFIG, I_FIND_PARENT, I_FIND_PARENT_RESPONSE,
 	I_LOG_MESSAGE, I_CHILDREN, I_SKETCH_NAME, I_SKETCH_VERSION,
-	I_REBOOT, I_GATEWAY_READY
+	I_REBOOT, I_GATEWAY_READY, I_BINARY_MODE, I_STATS, I_SLOT, I_SLEEPING
 } mysensor_internal;
 
 // Type of sensor  (for presentation message)
@@ -168,6 +169,13 @@ public:
 	MyMessage& set(unsigned int value);
 	MyMessage& set(int value);
 
+	// Batches (C_BATCH). Each value takes 3 bytes for sensor, type, payload
+	// type and length plus its payload. Start with an empty payload.
+	bool addBatchValue(const MyMessage &value);
+	// Unpack the value at pos (0 for the first one) as a C_SET message from
+	// the same sender and advance pos. Returns false after the last value.
+	bool getBatchValue(uint8_t &pos, MyMessage &value) const;
+
 #else
 
 typedef union {
@@ -187,16 +195,17 @@ struct
 	                             // 3 bit - Payload data type
 	uint8_t type;            	 // 8 bit - Type varies depending on command
 	uint8_t sensor;          	 // 8 bit - Id of sensor that this message concerns.
+	uint8_t seq;             	 // 8 bit - Sequence number, counted by the sender for each message it sends
 
 	// Each message can transfer a payload. We add one extra byte for string
 	// terminator \0 to be "printable" this is not transferred OTA
 	// This union is used to simplify the construction of the binary data types transferred.
 	union {
 		uint8_t bValue;
-		unsigned long ulValue;
-		long lValue;
-		unsigned int uiValue;
-		int iValue;
+		uint32_t ulValue;
+		int32_t lValue;
+		uint16_t uiValue;
+		int16_t iValue;
 		struct { // Float messages
 			float fValue;
 			uint8_t fPrecision;   // Number of decimals when serializing
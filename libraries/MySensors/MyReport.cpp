@@ -0,0 +1,128 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyReport.h"
+#include <math.h>
+
+
+MyReport::MyReport(MySensor &_gw, MyMessage &_msg) : gw(_gw), msg(_msg) {
+	band = 0;
+	level = NAN;
+	hysteresis = 0;
+	minInterval = 0;
+	maxInterval = 0;
+	ack = false;
+	reported = false;
+	pending = false;
+	failed = false;
+	above = false;
+	sent = 0;
+	sentAt = 0;
+}
+
+MyReport& MyReport::setDeadband(float _band) {
+	band = _band;
+	return *this;
+}
+
+MyReport& MyReport::setThreshold(float _level, float _hysteresis) {
+	level = _level;
+	hysteresis = _hysteresis;
+	return *this;
+}
+
+MyReport& MyReport::setInterval(unsigned long min, unsigned long max) {
+	minInterval = min;
+	maxInterval = max;
+	return *this;
+}
+
+MyReport& MyReport::setAck(bool _ack) {
+	ack = _ack;
+	return *this;
+}
+
+bool MyReport::update(float value, uint8_t decimals) {
+	if (isnan(value)) {
+		return false;
+	}
+	if (!isnan(level)) {
+		// Between the two levels the state stays as it was
+		if (value >= level) {
+			above = true;
+		} else if (value <= level - hysteresis) {
+			above = false;
+		}
+		return update(above);
+	}
+	if (!check(value)) {
+		return false;
+	}
+	msg.set(value, decimals);
+	return send(value);
+}
+
+bool MyReport::update(long value) {
+	if (!check(value)) {
+		return false;
+	}
+	msg.set(value);
+	return send(value);
+}
+
+bool MyReport::update(int value) {
+	if (!check(value)) {
+		return false;
+	}
+	msg.set(value);
+	return send(value);
+}
+
+bool MyReport::update(bool value) {
+	if (!check(value)) {
+		return false;
+	}
+	msg.set((uint8_t)value);
+	return send(value);
+}
+
+// True if value is to be sent now
+bool MyReport::check(float value) {
+	bool changed = !reported || (band > 0 ? fabs(value - sent) >= band : value != sent);
+	// A change that went back inside the dead-band before it was sent is
+	// no longer one
+	pending = changed || failed;
+	unsigned long since = gw.getUptime() - sentAt;
+	return (pending && (!reported || since >= minInterval)) || (maxInterval > 0 && since >= maxInterval);
+}
+
+bool MyReport::send(float value) {
+	bool ok = gw.send(msg, ack);
+	sentAt = gw.getUptime();
+	sent = value;
+	reported = true;
+	// Sent again with the next reading after the minimum interval
+	failed = !ok;
+	pending = failed;
+	return ok;
+}
+
+unsigned long MyReport::due() {
+	if (!reported) {
+		return 0;
+	}
+	unsigned long at = maxInterval > 0 ? maxInterval : 0xFFFFFFFFUL;
+	if (pending && minInterval < at) {
+		at = minInterval;
+	}
+	unsigned long since = gw.getUptime() - sentAt;
+	return since >= at ? 0 : at - since;
+}
@@ -0,0 +1,101 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyReport_h
+#define MyReport_h
+
+#include "MySensor.h"
+
+/**
+ * Decides when a reading of one child is worth a message. Feed every reading
+ * to update(); it is sent when it moved at least the dead-band away from the
+ * value the controller has, but no sooner than the minimum interval after the
+ * last report, and the value is sent again after the maximum interval without
+ * one, so the controller knows the node is alive. A change held back by the
+ * minimum interval goes with the first reading after it, if it still differs.
+ *
+ *   MyMessage msgTemp(CHILD_ID_TEMP, V_TEMP);
+ *   MyReport temp(gw, msgTemp);
+ *   temp.setDeadband(0.5).setInterval(60000, 3600000);
+ *   ...
+ *   temp.update(dht.getTemperature(), 1);
+ *
+ * With a threshold the child reports a state (0 or 1) instead of the value,
+ * with hysteresis so a reading hovering at the level does not flap. Values
+ * are compared as float, long values beyond 2^24 lose their last bits.
+ */
+class MyReport
+{
+  public:
+	/**
+	 * @param gw Sends the reports
+	 * @param msg Message of the child, the payload is set on each report
+	 */
+	MyReport(MySensor &gw, MyMessage &msg);
+
+	/**
+	 * Report changes of at least band from the value last sent. 0 (default)
+	 * reports any change.
+	 */
+	MyReport& setDeadband(float band);
+
+	/**
+	 * Report 1 once the value rises to level and 0 once it falls to
+	 * level - hysteresis, as a byte.
+	 */
+	MyReport& setThreshold(float level, float hysteresis);
+
+	/**
+	 * @param min Least time between two reports, ms (default 0)
+	 * @param max Time after which the value is sent again although it did not change, ms, 0 (default) for never
+	 */
+	MyReport& setInterval(unsigned long min, unsigned long max);
+
+	/* Request an ack from the gateway for each report */
+	MyReport& setAck(bool ack);
+
+	/**
+	 * A new reading. NaN, as sensor libraries return for a failed read, is
+	 * ignored. Returns true if the reading was sent.
+	 */
+	bool update(float value, uint8_t decimals);
+	bool update(long value);
+	bool update(int value);
+	bool update(bool value);
+
+	/**
+	 * Milliseconds until a report is due without any change of the reading:
+	 * the heartbeat or a change held back by the minimum interval. Sleeping
+	 * nodes can sleep that long at most.
+	 */
+	unsigned long due();
+
+  private:
+	MySensor &gw;
+	MyMessage &msg;
+	float band;
+	float level;      // NAN without threshold
+	float hysteresis;
+	unsigned long minInterval;
+	unsigned long maxInterval;
+	bool ack;
+	bool reported;    // Something was sent already
+	bool pending;     // A change or a failed report waits to be sent
+	bool failed;      // The last report did not reach the parent
+	bool above;       // State of the threshold
+	float sent;       // Value or state last sent
+	unsigned long sentAt;
+
+	bool check(float value);
+	bool send(float value);
+};
+
+#endif
@@ -0,0 +1,143 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyRoutingTable.h"
+#include <string.h>
+
+#define NO_ROUTE 0xFF
+
+
+MyRoutingTable::MyRoutingTable() {
+#if ROUTING_TABLE_SIZE > 0
+	routes = NULL;
+	count = 0;
+	overflow = false;
+#else
+	table = NULL;
+#endif
+}
+
+#if ROUTING_TABLE_SIZE > 0
+
+void MyRoutingTable::begin(MyEepromCache *cache, uint16_t eepromAddress) {
+	eeprom = cache;
+	address = eepromAddress;
+	routes = new Route[ROUTING_TABLE_SIZE];
+	count = 0;
+	overflow = false;
+	// Ascending node ids, so every route is appended in order
+	uint8_t node = 0;
+	do {
+		uint8_t next = eeprom->read(address+node);
+		if (next != NO_ROUTE) {
+			if (count < ROUTING_TABLE_SIZE) {
+				routes[count].node = node;
+				routes[count].next = next;
+				count++;
+			} else {
+				overflow = true;
+			}
+		}
+	} while (++node != 0);
+}
+
+uint8_t MyRoutingTable::find(uint8_t node) {
+	// Index of the first route for a node id >= node
+	uint8_t lo = 0;
+	uint8_t hi = count;
+	while (lo < hi) {
+		uint8_t mid = (lo + hi) >> 1;
+		if (routes[mid].node < node) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+uint8_t MyRoutingTable::get(uint8_t node) {
+	uint8_t i = find(node);
+	if (i < count && routes[i].node == node) {
+		return routes[i].next;
+	}
+	return overflow ? eeprom->read(address+node) : NO_ROUTE;
+}
+
+void MyRoutingTable::set(uint8_t node, uint8_t route) {
+	uint8_t i = find(node);
+	bool found = i < count && routes[i].node == node;
+	uint8_t current = found ? routes[i].next : (overflow ? eeprom->read(address+node) : NO_ROUTE);
+	if (current == route) {
+		return;
+	}
+	eeprom->write(address+node, route);
+	if (found) {
+		if (route == NO_ROUTE) {
+			count--;
+			memmove(&routes[i], &routes[i+1], (count - i) * sizeof(Route));
+		} else {
+			routes[i].next = route;
+		}
+	} else if (route != NO_ROUTE) {
+		if (count < ROUTING_TABLE_SIZE) {
+			memmove(&routes[i+1], &routes[i], (count - i) * sizeof(Route));
+			routes[i].node = node;
+			routes[i].next = route;
+			count++;
+		} else {
+			overflow = true;
+		}
+	}
+}
+
+void MyRoutingTable::clear() {
+	uint8_t node = 0;
+	do {
+		if (eeprom->read(address+node) != NO_ROUTE) {
+			eeprom->write(address+node, NO_ROUTE);
+		}
+	} while (++node != 0);
+	count = 0;
+	overflow = false;
+}
+
+#else
+
+void MyRoutingTable::begin(MyEepromCache *cache, uint16_t eepromAddress) {
+	eeprom = cache;
+	address = eepromAddress;
+	table = new uint8_t[256];
+	uint8_t node = 0;
+	do {
+		table[node] = eeprom->read(address+node);
+	} while (++node != 0);
+}
+
+uint8_t MyRoutingTable::get(uint8_t node) {
+	return table[node];
+}
+
+void MyRoutingTable::set(uint8_t node, uint8_t route) {
+	if (table[node] != route) {
+		table[node] = route;
+		eeprom->write(address+node, route);
+	}
+}
+
+void MyRoutingTable::clear() {
+	uint8_t node = 0;
+	do {
+		set(node, NO_ROUTE);
+	} while (++node != 0);
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyRoutingTable_h
+#define MyRoutingTable_h
+
+#include "MyConfig.h"
+#include "MyEepromCache.h"
+#include <stdint.h>
+
+/**
+ * Next hop towards each child node of a repeater or gateway. EEPROM holds one
+ * byte per node id (0xFF = no route) at the given address, written through
+ * the node's EEPROM cache. RAM either mirrors
+ * all 256 of them (ROUTING_TABLE_SIZE 0) or keeps up to ROUTING_TABLE_SIZE
+ * known routes sorted by node id. Once more routes are known than fit, lookups
+ * that miss in RAM read EEPROM, so no route is ever lost.
+ */
+class MyRoutingTable
+{
+  public:
+	MyRoutingTable();
+
+	/**
+	 * Allocate the RAM copy and load the routes stored in EEPROM.
+	 */
+	void begin(MyEepromCache *cache, uint16_t eepromAddress);
+
+	/**
+	 * Next hop towards the node, 0xFF if unknown.
+	 */
+	uint8_t get(uint8_t node);
+
+	/**
+	 * Store the next hop towards the node, 0xFF removes it.
+	 */
+	void set(uint8_t node, uint8_t route);
+
+	/**
+	 * Forget all routes.
+	 */
+	void clear();
+
+  private:
+	MyEepromCache *eeprom;
+	uint16_t address;
+#if ROUTING_TABLE_SIZE > 0
+	struct Route {
+		uint8_t node;
+		uint8_t next;
+	};
+	Route *routes;
+	uint8_t count;
+	bool overflow; // EEPROM holds routes that did not fit in RAM
+	uint8_t find(uint8_t node);
+#else
+	uint8_t *table;
+#endif
+};
+
+#endif
@@ -13,6 +13,71 @@
 #include "utility/LowPower.h"
 #include "utility/RF24.h"
 #include "utility/RF24_config.h"
+#ifdef RF24_IRQ_PIN
+// Defines the pin change ISRs, MyGateway.cpp only declares them. It also
+// undefines DEBUG, which the rest of this file has to agree on with
+// MySensor.h, so put it back.
+#ifdef DEBUG
+#include "utility/PinChangeInt.h"
+#define DEBUG
+#else
+#include "utility/PinChangeInt.h"
+#endif
+#endif
+
+// Transmit queue states
+#define TX_QUEUE_IDLE 0
+#define TX_QUEUE_SENDING 1 // Queue head is in the radio, waiting for TX_DS or MAX_RT
+#define TX_QUEUE_BACKOFF 2 // Last round failed, listening until txRetryAt
+
+// Order of relayed messages in the transmit queue
+#define TX_PRIORITY_CONTROL   0 // Internal messages and acks
+#define TX_PRIORITY_COMMAND   1 // Set and request from the gateway, to actuators
+#define TX_PRIORITY_TELEMETRY 2 // Everything else from the nodes
+#define TX_PRIORITY_BULK      3 // Streams and firmware
+
+// The sequence numbers are split in blocks and the one in use is kept in
+// EEPROM, an EEPROM write every SEQ_BLOCK_SIZE messages
+#define SEQ_BLOCK_SIZE 32
+#define SEQ_BLOCKS (256 / SEQ_BLOCK_SIZE)
+
+#if RX_QUEUE_SIZE & (RX_QUEUE_SIZE - 1)
+#error RX_QUEUE_SIZE must be a power of 2
+#endif
+#if defined(RF24_IRQ_PIN) && RX_QUEUE_SIZE == 0
+#error RF24_IRQ_PIN needs RX_QUEUE_SIZE > 0
+#endif
+#if defined(DEBUG_BINARY) && ((DEBUG_LOG_SIZE & (DEBUG_LOG_SIZE - 1)) || DEBUG_LOG_SIZE > 128 || DEBUG_LOG_SIZE < LOG_RECORD_SIZE)
+#error DEBUG_LOG_SIZE must be a power of 2 from LOG_RECORD_SIZE to 128
+#endif
+
+#ifdef DEBUG
+// Formats of the debug messages in MyLog.h, indexed by id
+#define LOG_FORMAT(id, format) static const char id##_FORMAT[] PROGMEM = format;
+LOG_MESSAGES(LOG_FORMAT)
+#undef LOG_FORMAT
+#define LOG_FORMAT(id, format) id##_FORMAT,
+static const char * const logFormats[] PROGMEM = { LOG_MESSAGES(LOG_FORMAT) };
+#undef LOG_FORMAT
+#endif
+
+#ifdef DEBUG_BINARY
+// UART time per byte: start bit, 8 data bits, stop bit
+#define LOG_BYTE_US (10000000UL / BAUD_RATE)
+#define SERIAL_TX_SIZE 64 // Transmit buffer of HardwareSerial
+#endif
+
+// Keeps the compiler from moving queue accesses across an index update
+#define barrier() __asm__ __volatile__("" ::: "memory")
+
+// Nominal watchdog periods of SLEEP_15MS to SLEEP_8S, 128kHz / 2048 to 1048576
+static const uint16_t wdtPeriodMs[] PROGMEM = { 16, 32, 64, 125, 250, 500, 1000, 2000, 4000, 8000 };
+#define WDT_CALIBRATE_PERIOD SLEEP_60MS
+#define WDT_CALIBRATE_MS 64
+
+#ifdef RF24_IRQ_PIN
+static MySensor *irqRadio; // Instance the radio interrupt belongs to
+#endif
 
 
 // Inline function and macros
@@ -28,6 +93,42 @@ inline MyMessage& build (MyMessage &msg, uint8_t sender, uint8_t destination, ui
 }
 
 MySensor::MySensor(uint8_t _cepin, uint8_t _cspin) : RF24(_cepin, _cspin) {
+#if FIRMWARE_WINDOW > 0
+	firmwareCallback = NULL;
+#endif
+	msgCallback = NULL;
+	ackCallback = NULL;
+#ifdef DEBUG
+	logWrite = NULL;
+#endif
+#if ACK_TABLE_SIZE > 0
+	ackCount = 0;
+#endif
+#if MAILBOX_POLL_WINDOW > 0
+	heard = false;
+#endif
+#if STREAM_WINDOW > 0
+	// No stream begun
+	streamFailed = true;
+#endif
+	wdtCalibration = 0;
+	calibratedAt = 0;
+	sleepError = 0;
+	sleptMs = 0;
+	sleptUs = 0;
+#ifdef RF24_IRQ_PIN
+	csPin = _cspin;
+#endif
+#ifdef NODE_STATS
+	clearStats();
+#endif
+#ifdef DEBUG_BINARY
+	logHead = 0;
+	logTail = 0;
+	logRoom = SERIAL_TX_SIZE;
+	logSentAt = 0;
+	logDropped = 0;
+#endif
 }
 
 void MySensor::begin(void (*_msgCallback)(const MyMessage &), uint8_t _nodeId, boolean _repeaterMode, uint8_t _parentNodeId, rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataRate) {
@@ -54,7 +155,7 @@ void MySensor::begin(void (*_msgCallback)(const MyMessage &), uint8_t _nodeId, b
 		if (_parentNodeId != nc.parentNodeId) {
 			nc.parentNodeId = _parentNodeId;
 			// Save static parent id in eeprom
-			eeprom_write_byte((uint8_t*)EEPROM_PARENT_NODE_ID_ADDRESS, _parentNodeId);
+			eepromCache.write(EEPROM_PARENT_NODE_ID_ADDRESS, _parentNodeId);
 		}
 		autoFindParent = false;
 	} else {
@@ -65,7 +166,7 @@ void MySensor::begin(void (*_msgCallback)(const MyMessage &), uint8_t _nodeId, b
 	    // Set static id
 	    nc.nodeId = _nodeId;
 	    // Save static id in eeprom
-	    eeprom_write_byte((uint8_t*)EEPROM_NODE_ID_ADDRESS, _nodeId);
+	    eepromCache.write(EEPROM_NODE_ID_ADDRESS, _nodeId);
 	}
 
 	// If no parent was found in eeprom. Try to find one.
@@ -78,7 +179,7 @@ void MySensor::begin(void (*_msgCallback)(const MyMessage &), uint8_t _nodeId, b
 		requestNodeId();
 	}
 
-	debug(PSTR("%s started, id %d\n"), repeaterMode?"repeater":"sensor", nc.nodeId);
+	debug(LOG_STARTED, repeaterMode?"repeater":"sensor", nc.nodeId);
 
 	// If we got an id, set this node to use it
 	if (nc.nodeId != AUTO) { 
@@ -89,13 +190,35 @@ void MySensor::begin(void (*_msgCallback)(const MyMessage &), uint8_t _nodeId, b
 }
 
 void MySensor::setupRadio(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataRate) {
-	failedTransmissions = 0;
+	linkQuality.reset();
+	// Receivers may still have the last messages sent before a reboot
+	// cached. Go on from the block of sequence numbers after the one in use
+	// then, so the first messages after a quick reboot are not taken for them.
+	seq = ((eepromCache.read(EEPROM_SEQ_ADDRESS) + 1) & (SEQ_BLOCKS - 1)) * SEQ_BLOCK_SIZE;
+	saveSeqBlock();
+	searchingParent = false;
+	candidateCount = 0;
+	for (uint8_t i = 0; i < PARENT_RESPONSES; i++) {
+		responses[i].node = BROADCAST_ADDRESS;
+	}
+#if TX_QUEUE_SIZE > 0
+	txHead = 0;
+	txCount = 0;
+	txState = TX_QUEUE_IDLE;
+#endif
+#if RX_QUEUE_SIZE > 0
+	rxHead = 0;
+	rxTail = 0;
+#endif
+#ifdef RF24_IRQ_PIN
+	rxPending = false;
+#endif
 
 	// Start up the radio library
 	RF24::begin();
 
 	if (!RF24::isPVariant()) {
-		debug(PSTR("check wires\n"));
+		debug(LOG_CHECK_WIRES);
 		while(1);
 	}
 	RF24::setAutoAck(1);
@@ -110,11 +233,24 @@ void MySensor::setupRadio(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_
 
 	// All nodes listen to broadcast pipe (for FIND_PARENT_RESPONSE messages)
 	RF24::openReadingPipe(BROADCAST_PIPE, TO_ADDR(BROADCAST_ADDRESS));
+
+#ifdef RF24_IRQ_PIN
+	// Only RX_DR pulls the IRQ line, the transmit queue keeps polling TX_DS/MAX_RT
+	RF24::maskIRQ(true, true, false);
+	PCINT_HANDLER_DATA(irqRadio);
+	irqRadio = this;
+	pinMode(RF24_IRQ_PIN, INPUT);
+	PCintPort::attachInterrupt(RF24_IRQ_PIN, rxInterrupt, FALLING);
+#ifdef SPI_HAS_TRANSACTION
+	// Other SPI devices' transactions hold off the interrupt. A pin change
+	// interrupt has no INTx number, so this blocks all interrupts meanwhile.
+	SPI.usingInterrupt(255);
+#endif
+#endif
 }
 
 void MySensor::setupRepeaterMode(){
-	childNodeTable = new uint8_t[256];
-	eeprom_read_block((void*)childNodeTable, (void*)EEPROM_ROUTES_ADDRESS, 256);
+	childNodeTable.begin(&eepromCache, EEPROM_ROUTES_ADDRESS);
 }
 
 uint8_t MySensor::getNodeId() {
@@ -126,7 +262,7 @@ ControllerConfig MySensor::getConfig() {
 }
 
 void MySensor::requestNodeId() {
-	debug(PSTR("req node id\n"));
+	debug(LOG_REQ_NODE_ID);
 	RF24::openReadingPipe(CURRENT_NODE_PIPE, TO_ADDR(nc.nodeId));
 	sendRoute(build(msg, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_ID_REQUEST, false).set(""));
 	wait(2000);
@@ -147,7 +283,12 @@ void MySensor::setupNode() {
 }
 
 void MySensor::findParentNode() {
-	failedTransmissions = 0;
+	// A ping that arrives while waiting for responses must not start another search
+	if (searchingParent) {
+		return;
+	}
+	searchingParent = true;
+	candidateCount = 0;
 
 	// Set distance to max
 	nc.distance = 255;
@@ -156,8 +297,76 @@ void MySensor::findParentNode() {
 	build(msg, nc.nodeId, BROADCAST_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_FIND_PARENT, false).set("");
 	sendWrite(BROADCAST_ADDRESS, msg, true);
 
-	// Wait for ping response.
+	// Collect ping responses, repeaters answer within a second
 	wait(2000);
+	searchingParent = false;
+
+	// Pick the best one. Without any response the old parent stays.
+	uint8_t best = 0;
+	for (uint8_t i = 1; i < candidateCount; i++) {
+		if (parentScore(candidates[i]) < parentScore(candidates[best])) {
+			best = i;
+		}
+	}
+	if (candidateCount > 0) {
+		setParent(candidates[best].node, candidates[best].distance + 1);
+	}
+}
+
+uint8_t MySensor::parentScore(const ParentCandidate &c) {
+	// Lower is better. A hop costs more than a weak signal, so a weak link
+	// only loses against a strong one at the same distance.
+	uint8_t score = c.distance * 4;
+	if (!c.strong) {
+		score += 3;
+	}
+	if (c.node == nc.parentNodeId && linkQuality.delivery() < 2 * PARENT_SEARCH_QUALITY) {
+		// Writes to it have been failing, that is why we are searching
+		score += 3;
+	}
+	return score;
+}
+
+void MySensor::addParentCandidate(uint8_t node, uint8_t distance, bool strong) {
+	ParentCandidate c = { node, distance, strong };
+	if (candidateCount < PARENT_CANDIDATES) {
+		candidates[candidateCount++] = c;
+		return;
+	}
+	// Table full, replace the worst if this one is better
+	uint8_t worst = 0;
+	for (uint8_t i = 1; i < candidateCount; i++) {
+		if (parentScore(candidates[i]) > parentScore(candidates[worst])) {
+			worst = i;
+		}
+	}
+	if (parentScore(c) < parentScore(candidates[worst])) {
+		candidates[worst] = c;
+	}
+}
+
+void MySensor::setParent(uint8_t parent, uint8_t distance) {
+	if (parent != nc.parentNodeId) {
+		countStat(parentChanges);
+		linkQuality.reset();
+	}
+	nc.distance = distance;
+	nc.parentNodeId = parent;
+	eepromCache.write(EEPROM_PARENT_NODE_ID_ADDRESS, nc.parentNodeId);
+	eepromCache.write(EEPROM_DISTANCE_ADDRESS, nc.distance);
+	debug(LOG_NEW_PARENT, nc.parentNodeId, nc.distance);
+}
+
+void MySensor::sendParentResponses() {
+	for (uint8_t i = 0; i < PARENT_RESPONSES; i++) {
+		PendingResponse &r = responses[i];
+		if (r.node != BROADCAST_ADDRESS && (long)(millis() - r.at) >= 0) {
+			uint8_t node = r.node;
+			r.node = BROADCAST_ADDRESS;
+			// Built in ack, msg may still hold what the sketch is reading
+			sendWrite(node, build(ack, nc.nodeId, node, NODE_SENSOR_ID, C_INTERNAL, I_FIND_PARENT_RESPONSE, false).set(nc.distance), true);
+		}
+	}
 }
 
 boolean MySensor::sendRoute(MyMessage &message) {
@@ -191,16 +400,10 @@ boolean MySensor::sendRoute(MyMessage &message) {
 		// Should be routed back to gateway.
 		bool ok = sendWrite(nc.parentNodeId, message);
 
-		if (!ok) {
+		if (!ok && autoFindParent && linkQuality.searchParent(nc.parentNodeId == AUTO)) {
 			// Failure when sending to parent node. The parent node might be down and we
 			// need to find another route to gateway.
-			if (autoFindParent && failedTransmissions > SEARCH_FAILURES) {
-				findParentNode();
-			} else {
-				failedTransmissions++;
-			}
-		} else {
-			failedTransmissions = 0;
+			findParentNode();
 		}
 		return ok;
 	}
@@ -208,22 +411,177 @@ boolean MySensor::sendRoute(MyMessage &message) {
 }
 
 boolean MySensor::sendWrite(uint8_t next, MyMessage &message, bool broadcast) {
+#if TX_QUEUE_SIZE > 0
+	// A queued message may be on the air, let it finish first
+	while (txState == TX_QUEUE_SENDING) {
+		finishTx();
+	}
+#endif
 	uint8_t length = mGetLength(message);
 	message.last = nc.nodeId;
 	mSetVersion(message, PROTOCOL_VERSION);
+	// Acks keep the sequence number of the message they answer
+	bool own = message.sender == nc.nodeId && !mGetAck(message);
+	if (own) {
+		message.seq = nextSeq();
+	}
+#ifdef NODE_STATS
+	unsigned long start = micros();
+#endif
 	// Make sure radio has powered up
 	RF24::powerUp();
 	RF24::stopListening();
 	RF24::openWritingPipe(TO_ADDR(next));
+	bool toParent = !broadcast && !isGateway && next == nc.parentNodeId;
+	RF24::setRetries(linkQuality.retryDelay(), toParent ? linkQuality.retryCount() : 15);
 	bool ok = RF24::write(&message, min(MAX_MESSAGE_LENGTH, HEADER_SIZE + length), broadcast);
 	RF24::startListening();
+	uint8_t retransmits = RF24::getARC();
+	if (toParent) {
+		linkQuality.sent(ok, retransmits);
+	}
+#ifdef NODE_STATS
+	stats.txRetries += retransmits;
+	countSend(ok, start);
+#endif
+#if MAILBOX_POLL_WINDOW > 0
+	if (ok && own && message.destination == GATEWAY_ADDRESS && msgCallback != NULL && !isGateway) {
+		// The gateway sends what it kept for this node once this arrives
+		heard = true;
+		mailAt = millis();
+	}
+#endif
 
-	debug(PSTR("send: %d-%d-%d-%d s=%d,c=%d,t=%d,pt=%d,l=%d,st=%s:%s\n"),
+	debug(LOG_SEND,
 			message.sender,message.last, next, message.destination, message.sensor, mGetCommand(message), message.type, mGetPayloadType(message), mGetLength(message), ok?"ok":"fail", message.getString(convBuf));
 
+#if ACK_TABLE_SIZE > 0
+	// Even if the first hop failed, it is sent again later. The gateway
+	// leaves that to the controller.
+	if (own && mGetRequestAck(message) && !isGateway && nc.nodeId != AUTO && message.destination != BROADCAST_ADDRESS) {
+		trackAck(message);
+	}
+#endif
 	return ok;
 }
 
+#if TX_QUEUE_SIZE > 0
+static uint8_t txPriority(const MyMessage &message) {
+	uint8_t command = mGetCommand(message);
+	if (command == C_STREAM) {
+		return TX_PRIORITY_BULK;
+	} else if (command == C_INTERNAL || mGetAck(message)) {
+		return TX_PRIORITY_CONTROL;
+	} else if (message.sender == GATEWAY_ADDRESS && (command == C_SET || command == C_REQ)) {
+		return TX_PRIORITY_COMMAND;
+	}
+	return TX_PRIORITY_TELEMETRY;
+}
+#endif
+
+boolean MySensor::queueWrite(uint8_t next, MyMessage &message, bool broadcast) {
+#if TX_QUEUE_SIZE > 0
+	// Queue full, wait for room the way a blocking write would have. Keep
+	// emptying the radio meanwhile, so what arrives during the retries is
+	// acked and queued instead of lost.
+	while (txCount == TX_QUEUE_SIZE) {
+		processTx();
+#if RX_QUEUE_SIZE > 0
+		drainRx();
+#endif
+	}
+	// Behind everything of the same or a higher priority, and behind the head
+	// once it is on the air or between its retry rounds
+	uint8_t priority = txPriority(message);
+	uint8_t i = txCount;
+	while (i > (txState == TX_QUEUE_IDLE ? 0 : 1) && txQueue[(txHead + i - 1) % TX_QUEUE_SIZE].priority > priority) {
+		txQueue[(txHead + i) % TX_QUEUE_SIZE] = txQueue[(txHead + i - 1) % TX_QUEUE_SIZE];
+		i--;
+	}
+	QueuedMessage &q = txQueue[(txHead + i) % TX_QUEUE_SIZE];
+	q.next = next;
+	q.broadcast = broadcast;
+	q.rounds = 0;
+	q.priority = priority;
+	q.msg = message;
+	q.msg.last = nc.nodeId;
+	mSetVersion(q.msg, PROTOCOL_VERSION);
+	txCount++;
+	processTx();
+	return true;
+#else
+	return sendWrite(next, message, broadcast);
+#endif
+}
+
+void MySensor::processTx() {
+#if TX_QUEUE_SIZE > 0
+	if (txState == TX_QUEUE_SENDING) {
+		finishTx();
+	}
+	if (txCount == 0 || txState == TX_QUEUE_SENDING ||
+			(txState == TX_QUEUE_BACKOFF && (long)(millis() - txRetryAt) < 0)) {
+		return;
+	}
+	// Start the next round for the head of the queue and return right away
+	QueuedMessage &q = txQueue[txHead];
+#ifdef NODE_STATS
+	if (q.rounds == 0) {
+		txStartedAt = micros();
+	}
+#endif
+	RF24::powerUp();
+	RF24::stopListening();
+	RF24::openWritingPipe(TO_ADDR(q.next));
+	RF24::setRetries(linkQuality.retryDelay(), TX_QUEUE_RETRIES);
+	RF24::startFastWrite(&q.msg, min(MAX_MESSAGE_LENGTH, HEADER_SIZE + mGetLength(q.msg)), q.broadcast);
+	txState = TX_QUEUE_SENDING;
+#endif
+}
+
+#if TX_QUEUE_SIZE > 0
+void MySensor::finishTx() {
+	rf24_tx_status_e status = RF24::txStandByPoll();
+	if (status == RF24_TX_BUSY) {
+		return;
+	}
+	RF24::startListening();
+	uint8_t retransmits = RF24::getARC();
+#ifdef NODE_STATS
+	stats.txRetries += retransmits;
+#endif
+
+	QueuedMessage &q = txQueue[txHead];
+	bool ok = status == RF24_TX_OK;
+	if (!q.broadcast && !isGateway && q.next == nc.parentNodeId) {
+		linkQuality.sent(ok, retransmits);
+	}
+	if (!ok && ++q.rounds < TX_QUEUE_ROUNDS) {
+		// Listen before the next round, for a random time that grows with
+		// each round so two senders that collided do not collide again.
+		txRetryAt = millis() + linkQuality.backoff(q.rounds);
+		txState = TX_QUEUE_BACKOFF;
+		return;
+	}
+	debug(LOG_SEND,
+			q.msg.sender,q.msg.last, q.next, q.msg.destination, q.msg.sensor, mGetCommand(q.msg), q.msg.type, mGetPayloadType(q.msg), mGetLength(q.msg), ok?"ok":"fail", q.msg.getString(convBuf));
+#ifdef NODE_STATS
+	countSend(ok, txStartedAt);
+#endif
+	txHead = (txHead + 1) % TX_QUEUE_SIZE;
+	txCount--;
+	txState = TX_QUEUE_IDLE;
+}
+#endif
+
+void MySensor::flushTx() {
+#if TX_QUEUE_SIZE > 0
+	while (txCount > 0) {
+		processTx();
+	}
+#endif
+}
+
 bool MySensor::send(MyMessage &message, bool enableAck) {
 	message.sender = nc.nodeId;
 	mSetCommand(message,C_SET);
@@ -231,6 +589,29 @@ bool MySensor::send(MyMessage &message, bool enableAck) {
 	return sendRoute(message);
 }
 
+bool MySensor::sendBatch(MyMessage *messages[], uint8_t count, bool enableAck) {
+	bool ok = true;
+	uint8_t i = 0;
+	while (i < count) {
+		uint8_t first = i;
+		uint8_t destination = messages[i]->destination;
+		build(msg, nc.nodeId, destination, NODE_SENSOR_ID, C_BATCH, 0, enableAck);
+		mSetLength(msg, 0);
+		mSetPayloadType(msg, P_CUSTOM);
+		while (i < count && messages[i]->destination == destination && msg.addBatchValue(*messages[i])) {
+			i++;
+		}
+		if (i - first > 1) {
+			ok &= sendRoute(msg);
+		} else {
+			// Nothing to share the radio message with, or too long for a batch
+			ok &= send(*messages[first], enableAck);
+			i = first + 1;
+		}
+	}
+	return ok;
+}
+
 void MySensor::sendBatteryLevel(uint8_t value, bool enableAck) {
 	sendRoute(build(msg, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_BATTERY_LEVEL, enableAck).set(value));
 }
@@ -252,12 +633,309 @@ void MySensor::request(uint8_t childSensorId, uint8_t variableType, uint8_t dest
 	sendRoute(build(msg, nc.nodeId, destination, childSensorId, C_REQ, variableType, false).set(""));
 }
 
+#if FIRMWARE_WINDOW > 0
+void MySensor::requestFirmware(void (* _blockCallback)(uint16_t, const uint8_t *)) {
+	firmwareCallback = _blockCallback;
+	firmware.ask();
+	processFirmware();
+}
+
+void MySensor::processFirmware() {
+	// Built in ack, msg may still hold what the sketch is reading
+	FirmwareRequest request;
+	if (firmware.askNow()) {
+		// Tell the controller what is installed
+		FirmwareConfig installed;
+		eeprom_read_block((void*)&installed, (void*)EEPROM_FIRMWARE_TYPE_ADDRESS, sizeof(FirmwareConfig));
+		firmware.sent(sendRoute(build(ack, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_STREAM, ST_FIRMWARE_CONFIG_REQUEST, false).set(&installed, sizeof(installed))));
+	} else if (firmware.request(request)) {
+		firmware.sent(sendRoute(build(ack, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_STREAM, ST_FIRMWARE_REQUEST, false).set(&request, sizeof(request))));
+	}
+	if (!firmware.active()) {
+		// Given up
+		debug(LOG_FIRMWARE_FAIL);
+	}
+}
+
+void MySensor::firmwareReceived(const FirmwareBlock &block) {
+	if (!firmware.received(block)) {
+		return;
+	}
+	firmwareCallback(block.block, block.data);
+	if (!firmware.complete()) {
+		return;
+	}
+	firmware.stop();
+	if (!firmware.verified()) {
+		debug(LOG_FIRMWARE_FAIL);
+		return;
+	}
+	// Tell the bootloader what to install and hand over to it
+	const uint8_t *config = (const uint8_t *)&firmware.getConfig();
+	for (uint8_t i = 0; i < sizeof(FirmwareConfig); i++) {
+		eepromCache.write(EEPROM_FIRMWARE_TYPE_ADDRESS + i, config[i]);
+	}
+	eepromCache.flush();
+	debug(LOG_FIRMWARE_DONE);
+	Serial.flush();
+	wdt_enable(WDTO_15MS);
+	for (;;);
+}
+#endif
+
+#if STREAM_WINDOW > 0
+void MySensor::streamBegin(uint8_t childSensorId, uint8_t streamType, uint8_t destination) {
+	stream.begin(destination, childSensorId, streamType);
+	streamTries = 0;
+	streamFailed = false;
+}
+
+bool MySensor::streamWrite(const void *data, uint16_t length) {
+	const uint8_t *p = (const uint8_t *)data;
+	while (!streamFailed) {
+		uint16_t n = stream.write(p, length);
+		p += n;
+		length -= n;
+		if (length == 0) {
+			return true;
+		}
+		// Window full, make room
+		streamWindow();
+	}
+	return false;
+}
+
+bool MySensor::streamEnd() {
+	while (!streamFailed && !stream.end()) {
+		streamWindow();
+	}
+	while (!streamFailed && !stream.empty()) {
+		streamWindow();
+	}
+	return !streamFailed;
+}
+
+void MySensor::streamWindow() {
+	uint8_t next = isGateway ? stream.destination : nc.parentNodeId;
+	if (repeaterMode && stream.destination != GATEWAY_ADDRESS) {
+		// Only repeaters have a routing table, like in sendRoute()
+		uint8_t route = getChildRoute(stream.destination);
+		if (route > GATEWAY_ADDRESS && route < BROADCAST_ADDRESS) {
+			next = route;
+		}
+	}
+#if TX_QUEUE_SIZE > 0
+	// A queued message may be on the air, let it finish first
+	while (txState == TX_QUEUE_SENDING) {
+		finishTx();
+	}
+#endif
+	// Write every segment not acked yet back to back. The radio sends from its
+	// TX FIFO without going back to listening in between; the last segment
+	// asks for the selective ack.
+	MyMessage out;
+	StreamSegment segment;
+	uint8_t index = 0, length;
+	bool more = stream.pending(index, segment, length);
+	RF24::powerUp();
+	RF24::stopListening();
+	RF24::openWritingPipe(TO_ADDR(next));
+	bool toParent = !isGateway && next == nc.parentNodeId;
+	RF24::setRetries(linkQuality.retryDelay(), toParent ? linkQuality.retryCount() : 15);
+	unsigned long start = millis();
+	bool ok = true;
+	while (more && ok) {
+		build(out, nc.nodeId, stream.destination, stream.sensor, C_STREAM, stream.type, false).set(&segment, length);
+		more = stream.pending(index, segment, length);
+		mSetRequestAck(out, !more);
+		out.last = nc.nodeId;
+		out.seq = nextSeq();
+		mSetVersion(out, PROTOCOL_VERSION);
+		// False while an earlier segment has run out of retries, the radio
+		// retries it again as soon as that is cleared
+		while (!RF24::writeFast(&out, HEADER_SIZE + mGetLength(out))) {
+			if (millis() - start > STREAM_TIMEOUT) {
+				ok = false;
+				break;
+			}
+		}
+	}
+	if (ok) {
+		ok = RF24::txStandBy(STREAM_TIMEOUT);
+	} else {
+		RF24::flush_tx();
+	}
+	RF24::startListening();
+	if (toParent) {
+		linkQuality.sent(ok, RF24::getARC());
+	}
+
+	// Wait for the ack, handling what else comes in, twice as long after each
+	// window that went unanswered and up to as long again at random, so that
+	// senders whose windows collided do not come back at the same time. A
+	// window that did not get off this node waits just the same. One that acks
+	// anything new resets streamTries.
+	unsigned long timeout = (unsigned long)STREAM_TIMEOUT << (streamTries > 3 ? 3 : streamTries);
+	timeout += micros() % timeout;
+	streamTries++;
+	streamAcked = false;
+	streamBusy = false;
+	start = millis();
+	while (!streamAcked && millis() - start < timeout) {
+		process();
+	}
+	if (streamBusy) {
+		// The receiver has no room for another stream. Not a try, wait a while
+		// for one of the others to end.
+		streamTries--;
+		start = millis();
+		timeout = STREAM_TIMEOUT + (micros() & 0xFF);
+		while (millis() - start < timeout) {
+			process();
+		}
+	} else if (streamTries > STREAM_RETRIES) {
+		debug(LOG_STREAM_FAIL, stream.destination);
+		streamFailed = true;
+	}
+}
+#endif
+
+uint8_t MySensor::nextSeq() {
+	if (++seq % SEQ_BLOCK_SIZE == 0) {
+		saveSeqBlock();
+	}
+	return seq;
+}
+
+void MySensor::saveSeqBlock() {
+	// Right away, a reboot may follow any time
+	eepromCache.write(EEPROM_SEQ_ADDRESS, seq / SEQ_BLOCK_SIZE);
+	eepromCache.flush();
+}
+
+void MySensor::setAckCallback(void (* _ackCallback)(const MyMessage &, bool)) {
+	ackCallback = _ackCallback;
+}
+
+#if ACK_TABLE_SIZE > 0
+void MySensor::trackAck(MyMessage &message) {
+	uint8_t i = 0;
+	while (i < ackCount && !(acks[i].msg.destination == message.destination && acks[i].msg.sensor == message.sensor &&
+			mGetCommand(acks[i].msg) == mGetCommand(message) && acks[i].msg.type == message.type)) {
+		i++;
+	}
+	if (i < ackCount) {
+		if (&acks[i].msg == &message) {
+			// Sent again by processAcks()
+			return;
+		}
+		// The new value replaces the one still waiting
+		removeAck(i, false);
+	}
+	while (ackCount == ACK_TABLE_SIZE) {
+		removeAck(0, false);
+	}
+	PendingAck &p = acks[ackCount++];
+	p.msg = message;
+	p.first = message.seq;
+	p.tries = 0;
+	p.dueAt = millis() + ACK_TIMEOUT;
+}
+
+void MySensor::ackReceived(const MyMessage &message) {
+	for (uint8_t i = 0; i < ackCount; i++) {
+		const MyMessage &m = acks[i].msg;
+		// The ack of any try will do, their sequence numbers run from first on
+		if (m.destination == message.sender && m.sensor == message.sensor && mGetCommand(m) == mGetCommand(message) &&
+				m.type == message.type && (uint8_t)(message.seq - acks[i].first) <= (uint8_t)(m.seq - acks[i].first)) {
+			removeAck(i, true);
+			return;
+		}
+	}
+}
+
+void MySensor::processAcks() {
+	unsigned long now = millis();
+	for (uint8_t i = 0; i < ackCount; i++) {
+		PendingAck &p = acks[i];
+		if ((long)(now - p.dueAt) < 0) {
+			continue;
+		}
+		if (p.tries == ACK_RETRIES) {
+			removeAck(i, false);
+		} else {
+			// Twice as long after each try, the parent may be busy or have changed
+			p.tries++;
+			p.dueAt = now + ((unsigned long)ACK_TIMEOUT << p.tries);
+			sendRoute(p.msg);
+		}
+		// One at a time, the table may have changed
+		return;
+	}
+}
+
+void MySensor::removeAck(uint8_t i, bool acked) {
+	// The callback may send again, so take it out of the table first
+	MyMessage done = acks[i].msg;
+	ackCount--;
+	memmove(&acks[i], &acks[i+1], (ackCount - i) * sizeof(PendingAck));
+	if (ackCallback != NULL) {
+		ackCallback(done, acked);
+	}
+}
+#endif
+
 void MySensor::requestTime(void (* _timeCallback)(unsigned long)) {
 	timeCallback = _timeCallback;
 	sendRoute(build(msg, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_TIME, false).set(""));
 }
 
 boolean MySensor::process() {
+	// Keep queued relay messages moving
+	processTx();
+	// Answer parent searches whose random delay is over
+	sendParentResponses();
+#if FIRMWARE_WINDOW > 0
+	// Ask for firmware, or for the next window of it
+	if (firmware.active()) {
+		processFirmware();
+	}
+#endif
+#if ACK_TABLE_SIZE > 0
+	// Send again what has not been acked in time
+	processAcks();
+#endif
+	// Write back one cached EEPROM byte if the EEPROM is idle
+	eepromCache.flushOne();
+#ifdef DEBUG_BINARY
+	// Pass queued log records on to the serial port
+	logDrain();
+#endif
+
+#if RX_QUEUE_SIZE > 0
+	boolean received = false;
+	drainRx();
+	// At most a queue full per call, so relays waiting in processTx() get
+	// their turn while traffic keeps coming
+	for (uint8_t n = 0; n < RX_QUEUE_SIZE && rxHead != rxTail; n++) {
+		ReceivedMessage &r = rxQueue[rxHead % RX_QUEUE_SIZE];
+		uint8_t pipe = r.pipe;
+		bool strong = r.strong;
+		msg = r.msg;
+		barrier();
+		rxHead++;
+		if (processMessage(pipe, strong)) {
+			received = true;
+			if (msgCallback == NULL) {
+				// Caller picks this one up with getLastMessage()
+				break;
+			}
+		}
+		// Handling may have taken a while (relaying, acks). Free the radio FIFO again.
+		drainRx();
+	}
+	return received;
+#else
 	uint8_t pipe;
 	boolean available = RF24::available(&pipe);
 
@@ -266,17 +944,97 @@ boolean MySensor::process() {
 
 	uint8_t len = RF24::getDynamicPayloadSize();
 	RF24::read(&msg, len);
+	return processMessage(pipe, receivedStrong(msg));
+#endif
+}
+
+// RPD latches for the last frame the radio received, so it has to be read
+// as the message comes out of the radio, not once it is handled
+bool MySensor::receivedStrong(const MyMessage &message) {
+	return mGetCommand(message) == C_INTERNAL && message.type == I_FIND_PARENT_RESPONSE && RF24::testRPD();
+}
+
+#if RX_QUEUE_SIZE > 0
+void MySensor::drainRx() {
+#ifdef RF24_IRQ_PIN
+	// The interrupt does the reading. Only step in when it could not, and
+	// keep it out while the SPI bus is in use here.
+	if (!rxPending) {
+		return;
+	}
+	noInterrupts();
+	rxPending = false;
+	fillRx();
+	interrupts();
+#else
+	fillRx();
+#endif
+}
+
+void MySensor::fillRx() {
+	uint8_t pipe;
+	while ((uint8_t)(rxTail - rxHead) < RX_QUEUE_SIZE) {
+		if (!RF24::available(&pipe) || pipe > 6) {
+			return;
+		}
+		ReceivedMessage &r = rxQueue[rxTail % RX_QUEUE_SIZE];
+		uint8_t len = RF24::getDynamicPayloadSize();
+		RF24::read(&r.msg, len);
+		r.pipe = pipe;
+		r.strong = receivedStrong(r.msg);
+		barrier();
+		rxTail++;
+	}
+#ifdef RF24_IRQ_PIN
+	// Queue full, the rest stays in the radio until process() has made room
+	rxPending = true;
+#endif
+}
+#endif
+
+#ifdef RF24_IRQ_PIN
+void MySensor::rxInterrupt() {
+	MySensor *r = irqRadio;
+	if (digitalRead(r->csPin) == LOW) {
+		// Interrupted an SPI transfer of the main program, leave it to process().
+		// Transfers to other SPI devices only show here with SPI transactions.
+		r->rxPending = true;
+		return;
+	}
+	r->fillRx();
+}
+#endif
 
+boolean MySensor::processMessage(uint8_t pipe, bool strong) {
 	// Add string termination, good if we later would want to print it.
 	msg.data[mGetLength(msg)] = '\0';
-	debug(PSTR("read: %d-%d-%d s=%d,c=%d,t=%d,pt=%d,l=%d:%s\n"),
+	debug(LOG_READ,
 				msg.sender, msg.last, msg.destination,  msg.sensor, mGetCommand(msg), msg.type, mGetPayloadType(msg), mGetLength(msg), msg.getString(convBuf));
+#ifdef NODE_STATS
+	if (pipe <= BROADCAST_PIPE) {
+		stats.rx[pipe]++;
+	}
+#endif
 
 	if(!(mGetVersion(msg) == PROTOCOL_VERSION)) {
-		debug(PSTR("version mismatch\n"));
+		debug(LOG_VERSION_MISMATCH);
+		countStat(dropped);
 		return false;
 	}
 
+#if DUPLICATE_CACHE_SIZE > 0
+	// A copy sent again after its ack got lost, or one that came back round a
+	// routing loop. Broadcasts and nodes without an id share the sequence
+	// numbers of several senders, those always pass.
+	bool isAck = mGetAck(msg);
+	if (pipe != BROADCAST_PIPE && msg.sender != AUTO &&
+			(msg.sender == nc.nodeId || duplicateCache.seen(isAck ? msg.destination : msg.sender, msg.seq, isAck))) {
+		debug(LOG_DUPLICATE, msg.sender, msg.last, msg.seq);
+		countStat(duplicates);
+		return false;
+	}
+#endif
+
 	uint8_t command = mGetCommand(msg);
 	uint8_t type = msg.type;
 	uint8_t sender = msg.sender;
@@ -285,14 +1043,20 @@ boolean MySensor::process() {
 
 	if (destination == nc.nodeId) {
 		// This message is addressed to this node
+#if MAILBOX_POLL_WINDOW > 0
+		if (heard) {
+			// More mail may follow
+			mailAt = millis();
+		}
+#endif
 
 		if (repeaterMode && last != nc.parentNodeId) {
 			// Message is from one of the child nodes. Add it to routing table.
 			addChildRoute(sender, last);
 		}
 
-		// Check if sender requests an ack back.
-		if (mGetRequestAck(msg)) {
+		// Check if sender requests an ack back. Streams answer with a selective ack.
+		if (mGetRequestAck(msg) && !(command == C_STREAM && type >= ST_SOUND)) {
 			// Copy message
 			ack = msg;
 			mSetRequestAck(ack,false); // Reply without ack flag (otherwise we would end up in an eternal loop)
@@ -302,19 +1066,25 @@ boolean MySensor::process() {
 			sendRoute(ack);
 		}
 
+#if ACK_TABLE_SIZE > 0
+		if (mGetAck(msg) && command != C_STREAM) {
+			ackReceived(msg);
+		}
+#endif
+
 		if (command == C_INTERNAL) {
 			if (type == I_FIND_PARENT_RESPONSE) {
 				if (autoFindParent) {
-					// We've received a reply to a FIND_PARENT message. Check if the distance is
-					// shorter than we already have.
+					// We've received a reply to a FIND_PARENT message. RPD tells if it
+					// came in above -64dBm.
 					uint8_t distance = msg.getByte();
-					if (distance<nc.distance-1) {
-						// Found a neighbor closer to GW than previously found
-						nc.distance = distance + 1;
-						nc.parentNodeId = msg.sender;
-						eeprom_write_byte((uint8_t*)EEPROM_PARENT_NODE_ID_ADDRESS, nc.parentNodeId);
-						eeprom_write_byte((uint8_t*)EEPROM_DISTANCE_ADDRESS, nc.distance);
-						debug(PSTR("new parent=%d, d=%d\n"), nc.parentNodeId, nc.distance);
+					if (distance >= 254) {
+						// Responder has no route to the gateway itself
+					} else if (searchingParent) {
+						addParentCandidate(msg.sender, distance, strong);
+					} else if (distance<nc.distance-1) {
+						// Late response, found a neighbor closer to GW than previously found
+						setParent(msg.sender, distance + 1);
 					}
 				}
 				return false;
@@ -330,13 +1100,13 @@ boolean MySensor::process() {
 						nc.nodeId = msg.getByte();
 						if (nc.nodeId == AUTO) {
 							// sensor net gateway will return max id if all sensor id are taken
-							debug(PSTR("full\n"));
+							debug(LOG_FULL);
 							while (1); // Wait here. Nothing else we can do...
 						}
 						setupNode();
 						// Write id to EEPROM
-						eeprom_write_byte((uint8_t*)EEPROM_NODE_ID_ADDRESS, nc.nodeId);
-						debug(PSTR("id=%d\n"), nc.nodeId);
+						eepromCache.write(EEPROM_NODE_ID_ADDRESS, nc.nodeId);
+						debug(LOG_ID, nc.nodeId);
 					}
 				} else if (type == I_CONFIG) {
 					// Pick up configuration from controller (currently only metric/imperial)
@@ -344,19 +1114,16 @@ boolean MySensor::process() {
 					isMetric = msg.getString()[0] == 'M' ;
 					if (cc.isMetric != isMetric) {
 						cc.isMetric = isMetric;
-						eeprom_write_byte((uint8_t*)EEPROM_CONTROLLER_CONFIG_ADDRESS, isMetric);
+						eepromCache.write(EEPROM_CONTROLLER_CONFIG_ADDRESS, isMetric);
 					}
 				} else if (type == I_CHILDREN) {
 					if (repeaterMode && msg.getString()[0] == 'C') {
 						// Clears child relay data for this node
-						debug(PSTR("rd=clear\n"));
-						uint8_t i = 255;
-						do {
-							removeChildRoute(i);
-						} while (i--);
+						debug(LOG_CLEAR_ROUTES);
+						childNodeTable.clear();
 						// Clear parent node id & distance to gw
-						eeprom_write_byte((uint8_t*)EEPROM_PARENT_NODE_ID_ADDRESS, 0xFF);
-						eeprom_write_byte((uint8_t*)EEPROM_DISTANCE_ADDRESS, 0xFF);
+						eepromCache.write(EEPROM_PARENT_NODE_ID_ADDRESS, 0xFF);
+						eepromCache.write(EEPROM_DISTANCE_ADDRESS, 0xFF);
 						// Find parent node
 						findParentNode();
 						sendRoute(build(msg, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_CHILDREN,false).set(""));
@@ -366,9 +1133,73 @@ boolean MySensor::process() {
 						// Deliver time to callback
 						timeCallback(msg.getULong());
 					}
+				} else if (type == I_SLOT) {
+					// Kept across reboots, like the rest of the controller's config
+					uint8_t slot = msg.getByte() % SLOT_COUNT;
+					if (cc.slot != slot) {
+						cc.slot = slot;
+						eepromCache.write(EEPROM_CONTROLLER_CONFIG_ADDRESS + offsetof(ControllerConfig, slot), slot);
+					}
+#ifdef NODE_STATS
+				} else if (type == I_STATS) {
+					// Payload is the page to send back
+					uint8_t page = msg.getByte();
+					sendRoute(setStats(build(msg, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_STATS, false), page));
+#endif
+				}
+				return false;
+			}
+#if STREAM_WINDOW > 0
+		} else if (command == C_STREAM && type >= ST_SOUND) {
+			if (mGetAck(msg)) {
+				// Selective ack for the stream this node writes, or just its id
+				// if the receiver is busy with others
+				const StreamAck *streamAck = (const StreamAck *)msg.getCustom();
+				if (sender == stream.destination && streamAck->stream == stream.stream) {
+					streamAcked = true;
+					streamBusy = mGetLength(msg) == 1;
+					if (!streamBusy && stream.acked(*streamAck)) {
+						streamTries = 0;
+					}
+				}
+				return false;
+			}
+			if (mGetLength(msg) < STREAM_HEADER_SIZE) {
+				return false;
+			}
+			StreamAck streamAck;
+			uint8_t result = stream.received(sender, *(const StreamSegment *)msg.getCustom(), mGetLength(msg), streamAck);
+			if (mGetRequestAck(msg)) {
+				build(ack, nc.nodeId, sender, msg.sensor, C_STREAM, type, false).set(&streamAck, result == STREAM_REFUSED ? 1 : sizeof(streamAck));
+				mSetAck(ack, true);
+				ack.seq = msg.seq;
+				sendRoute(ack);
+			}
+			if (result != STREAM_NEW) {
+				// Sent again as the ack was lost, or no room for another stream
+				return false;
+			}
+#endif
+#if FIRMWARE_WINDOW > 0
+		} else if (command == C_STREAM && sender == GATEWAY_ADDRESS && firmwareCallback != NULL) {
+			uint8_t length = mGetLength(msg);
+			if (type == ST_FIRMWARE_CONFIG_RESPONSE && length == sizeof(FirmwareConfig)) {
+				FirmwareConfig installed;
+				eeprom_read_block((void*)&installed, (void*)EEPROM_FIRMWARE_TYPE_ADDRESS, sizeof(FirmwareConfig));
+				const FirmwareConfig *config = (const FirmwareConfig *)msg.getCustom();
+				if (memcmp(config, &installed, sizeof(FirmwareConfig)) == 0) {
+					// Up to date
+					firmware.stop();
+				} else if (!firmware.fetching() || memcmp(config, &firmware.getConfig(), sizeof(FirmwareConfig)) != 0) {
+					debug(LOG_FIRMWARE, config->type, config->version, config->blocks);
+					firmware.start(*config);
 				}
 				return false;
+			} else if (type == ST_FIRMWARE_RESPONSE && length == sizeof(FirmwareBlock)) {
+				firmwareReceived(*(const FirmwareBlock *)msg.getCustom());
+				return false;
 			}
+#endif
 		}
 		// Call incoming message callback if available
 		if (msgCallback != NULL) {
@@ -383,14 +1214,29 @@ boolean MySensor::process() {
 			if (nc.distance == 255) {
 				findParentNode();
 			} else if (sender != nc.parentNodeId) {
-				// Relaying nodes should always answer ping messages
-				// Wait a random delay of 0-2 seconds to minimize collision
-				// between ping ack messages from other relaying nodes
-				delay(millis() & 0x3ff);
-				sendWrite(sender, build(msg, nc.nodeId, sender, NODE_SENSOR_ID, C_INTERNAL, I_FIND_PARENT_RESPONSE, false).set(nc.distance), true);
+				// Relaying nodes should always answer ping messages. Answer after a
+				// random delay of 0-1 seconds to minimize collision between ping
+				// ack messages from other relaying nodes; process() sends it.
+				uint8_t free = PARENT_RESPONSES;
+				for (uint8_t i = 0; i < PARENT_RESPONSES; i++) {
+					if (responses[i].node == sender) {
+						// Already answering this node
+						return false;
+					} else if (responses[i].node == BROADCAST_ADDRESS) {
+						free = i;
+					}
+				}
+				if (free < PARENT_RESPONSES) {
+					responses[free].node = sender;
+					responses[free].at = millis() + (micros() & 0x3ff);
+				} else {
+					// Too many searches at once, answer right away
+					sendWrite(sender, build(msg, nc.nodeId, sender, NODE_SENSOR_ID, C_INTERNAL, I_FIND_PARENT_RESPONSE, false).set(nc.distance), true);
+				}
 			}
 		} else if (pipe == CURRENT_NODE_PIPE) {
 			// We should try to relay this message to another node
+			countStat(relayed);
 
 			uint8_t route = getChildRoute(msg.destination);
 			if (route>0 && route<255) {
@@ -405,11 +1251,11 @@ boolean MySensor::process() {
 				//  We're node C, Message comes from A and has destination D
 				//
 				// lookup route in table and send message there
-				sendWrite(route, msg);
+				queueWrite(route, msg);
 			} else if (sender == GATEWAY_ADDRESS && destination == BROADCAST_ADDRESS) {
 				// A net gateway reply to a message previously sent by us from a 255 node
 				// We should broadcast this back to the node
-				sendWrite(destination, msg, true);
+				queueWrite(destination, msg, true);
 			} else  {
 				// A message comes from a child node and we have no
 				// route for it.
@@ -423,7 +1269,7 @@ boolean MySensor::process() {
 				// Message should be passed to node A (this nodes relay)
 
 				// This message should be routed back towards sensor net gateway
-				sendWrite(nc.parentNodeId, msg);
+				queueWrite(nc.parentNodeId, msg);
 				// Add this child to our "routing table" if it not already exist
 				addChildRoute(sender, last);
 			}
@@ -436,31 +1282,62 @@ MyMessage& MySensor::getLastMessage() {
 	return msg;
 }
 
+#ifdef NODE_STATS
+const NodeStats& MySensor::getStats() {
+	return stats;
+}
+
+void MySensor::clearStats() {
+	memset(&stats, 0, sizeof(NodeStats));
+}
+
+void MySensor::countSend(bool ok, unsigned long start) {
+	if (ok) {
+		stats.txOk++;
+	} else {
+		stats.txFail++;
+	}
+	unsigned long ms = (micros() - start) / 1000;
+	uint8_t bucket = 0;
+	while (ms && bucket < STATS_SEND_BUCKETS-1) {
+		ms >>= 1;
+		bucket++;
+	}
+	stats.sendTime[bucket]++;
+}
+
+MyMessage& MySensor::setStats(MyMessage &message, uint8_t page) {
+	uint8_t length;
+	if (page == 1) {
+		length = sizeof(stats.sendTime);
+		memcpy(&message.data[1], stats.sendTime, length);
+	} else {
+		page = 0;
+		length = offsetof(NodeStats, sendTime);
+		memcpy(&message.data[1], &stats, length);
+	}
+	message.data[0] = page;
+	mSetLength(message, 1 + length);
+	mSetPayloadType(message, P_CUSTOM);
+	return message;
+}
+#endif
+
 void MySensor::saveState(uint8_t pos, uint8_t value) {
 	if (loadState(pos) != value) {
-		eeprom_write_byte((uint8_t*)(EEPROM_LOCAL_CONFIG_ADDRESS+pos), value);
+		eepromCache.write(EEPROM_LOCAL_CONFIG_ADDRESS+pos, value);
 	}
 }
 uint8_t MySensor::loadState(uint8_t pos) {
-	return eeprom_read_byte((uint8_t*)(EEPROM_LOCAL_CONFIG_ADDRESS+pos));
+	return eepromCache.read(EEPROM_LOCAL_CONFIG_ADDRESS+pos);
 }
 
 void MySensor::addChildRoute(uint8_t childId, uint8_t route) {
-	if (childNodeTable[childId] != route) {
-		childNodeTable[childId] = route;
-		eeprom_write_byte((uint8_t*)EEPROM_ROUTES_ADDRESS+childId, route);
-	}
-}
-
-void MySensor::removeChildRoute(uint8_t childId) {
-	if (childNodeTable[childId] != 0xff) {
-		childNodeTable[childId] = 0xff;
-		eeprom_write_byte((uint8_t*)EEPROM_ROUTES_ADDRESS+childId, 0xff);
-	}
+	childNodeTable.set(childId, route);
 }
 
 uint8_t MySensor::getChildRoute(uint8_t childId) {
-	return childNodeTable[childId];
+	return childNodeTable.get(childId);
 }
 
 int8_t pinIntTrigger = 0;
@@ -473,27 +1350,153 @@ void wakeUp2()	 //place to send the second interrupts
 	pinIntTrigger = 2;
 }
 
+void MySensor::calibrateSleep() {
+	unsigned long us = LowPower.wdtMicros(WDT_CALIBRATE_PERIOD);
+	// Datasheet range is about +-35%, anything else is a failed measurement
+	if (us < WDT_CALIBRATE_MS * 650UL || us > WDT_CALIBRATE_MS * 1350UL) {
+		us = WDT_CALIBRATE_MS * 1000UL;
+	}
+	wdtCalibration = us;
+	calibratedAt = getUptime();
+}
+
+unsigned long MySensor::wdtLength(uint8_t period) {
+	return pgm_read_word(&wdtPeriodMs[period]) * wdtCalibration / WDT_CALIBRATE_MS;
+}
+
 void MySensor::internalSleep(unsigned long ms) {
-	while (!pinIntTrigger && ms >= 8000) { LowPower.powerDown(SLEEP_8S, ADC_OFF, BOD_OFF); ms -= 8000; }
-	if (!pinIntTrigger && ms >= 4000)    { LowPower.powerDown(SLEEP_4S, ADC_OFF, BOD_OFF); ms -= 4000; }
-	if (!pinIntTrigger && ms >= 2000)    { LowPower.powerDown(SLEEP_2S, ADC_OFF, BOD_OFF); ms -= 2000; }
-	if (!pinIntTrigger && ms >= 1000)    { LowPower.powerDown(SLEEP_1S, ADC_OFF, BOD_OFF); ms -= 1000; }
-	if (!pinIntTrigger && ms >= 500)     { LowPower.powerDown(SLEEP_500MS, ADC_OFF, BOD_OFF); ms -= 500; }
-	if (!pinIntTrigger && ms >= 250)     { LowPower.powerDown(SLEEP_250MS, ADC_OFF, BOD_OFF); ms -= 250; }
-	if (!pinIntTrigger && ms >= 125)     { LowPower.powerDown(SLEEP_120MS, ADC_OFF, BOD_OFF); ms -= 120; }
-	if (!pinIntTrigger && ms >= 64)      { LowPower.powerDown(SLEEP_60MS, ADC_OFF, BOD_OFF); ms -= 60; }
-	if (!pinIntTrigger && ms >= 32)      { LowPower.powerDown(SLEEP_30MS, ADC_OFF, BOD_OFF); ms -= 30; }
-	if (!pinIntTrigger && ms >= 16)      { LowPower.powerDown(SLEEP_15Ms, ADC_OFF, BOD_OFF); ms -= 15; }
+	if (wdtCalibration == 0 || getUptime() - calibratedAt >= SLEEP_CALIBRATE_INTERVAL) {
+		calibrateSleep();
+	}
+	// Time to sleep in ms and us, with what earlier sleeps left over
+	long us = sleepError % 1000;
+	ms += sleepError / 1000;
+	if (us < 0) {
+		us += 1000;
+		ms--;
+	}
+	if ((long)ms < 0) {
+		ms = us = 0;
+	}
+	int8_t period = SLEEP_8S;
+	while (period >= SLEEP_15Ms && !pinIntTrigger) {
+		unsigned long length = wdtLength(period);
+		unsigned long lengthMs = length / 1000;
+		long lengthUs = length % 1000;
+		if (ms > lengthMs || (ms == lengthMs && us >= lengthUs)) {
+			LowPower.powerDown((period_t)period, ADC_OFF, BOD_OFF);
+			// A pin change cut it short somewhere, count half
+			unsigned long slept = pinIntTrigger ? length / 2 : length;
+			ms -= lengthMs;
+			us -= lengthUs;
+			if (us < 0) {
+				us += 1000;
+				ms--;
+			}
+			sleptUs += slept % 1000;
+			sleptMs += slept / 1000 + sleptUs / 1000;
+			sleptUs %= 1000;
+		} else {
+			period--;
+		}
+	}
+	if (pinIntTrigger) {
+		// Woken early on purpose, nothing to make up for
+		sleepError = 0;
+		return;
+	}
+	// Less than the shortest period is left. Sleep it if that gets closer.
+	long left = ms * 1000 + us;
+	unsigned long shortest = wdtLength(SLEEP_15Ms);
+	if (left > (long)(shortest / 2)) {
+		LowPower.powerDown(SLEEP_15Ms, ADC_OFF, BOD_OFF);
+		left -= shortest;
+		sleptUs += shortest % 1000;
+		sleptMs += shortest / 1000 + sleptUs / 1000;
+		sleptUs %= 1000;
+	}
+	sleepError = left;
 }
 
-void MySensor::sleep(unsigned long ms) {
-	// Let serial prints finish (debug, log etc)
+unsigned long MySensor::getUptime() {
+	return millis() + sleptMs;
+}
+
+#if MAILBOX_POLL_WINDOW > 0
+bool MySensor::waitingMail() {
+	return heard && millis() - mailAt < MAILBOX_POLL_WINDOW;
+}
+
+void MySensor::sendSleeping() {
+	if (heard) {
+		sendRoute(build(msg, nc.nodeId, GATEWAY_ADDRESS, NODE_SENSOR_ID, C_INTERNAL, I_SLEEPING, false).set(""));
+		// Sending it counted as being heard
+		heard = false;
+	}
+}
+#endif
+
+// Stay awake while fetching firmware, waiting for acks or for mail from the
+// gateway, for up to ms or as long as it takes. Then get ready to power down.
+// Returns what is left of ms.
+unsigned long MySensor::prepareSleep(unsigned long ms, bool forever) {
+	unsigned long start = millis();
+	while ((false
+#if FIRMWARE_WINDOW > 0
+			|| firmware.active()
+#endif
+#if ACK_TABLE_SIZE > 0
+			|| ackCount > 0
+#endif
+#if MAILBOX_POLL_WINDOW > 0
+			|| waitingMail()
+#endif
+			) && (forever || millis() - start < ms)) {
+		process();
+	}
+	unsigned long awake = millis() - start;
+#if MAILBOX_POLL_WINDOW > 0
+	sendSleeping();
+#endif
+	// Send queued messages and let serial prints finish (debug, log etc)
+	flushTx();
+	eepromCache.flush();
+#ifdef DEBUG_BINARY
+	logFlush();
+#endif
 	Serial.flush();
 	RF24::powerDown();
+	return awake < ms ? ms - awake : 0;
+}
+
+void MySensor::sleep(unsigned long ms) {
+	ms = prepareSleep(ms, false);
 	pinIntTrigger = 0;
 	internalSleep(ms);
 }
 
+// Time to sleep until this node's slot in the next period, never 0
+unsigned long MySensor::slotWait(unsigned long period) {
+	unsigned long now = getUptime();
+	uint8_t n = cc.slot != AUTO ? cc.slot : nc.nodeId % SLOT_COUNT;
+	unsigned long at = now - now % period + period / SLOT_COUNT * n;
+	// Waking a little early still belongs to this slot
+	if ((long)(at - now) <= (long)(period / SLOT_COUNT / 2)) {
+		at += period;
+	}
+	// getUptime() already has any error of the last sleep in it
+	sleepError = 0;
+	return at - now;
+}
+
+void MySensor::sleepSlot(unsigned long period) {
+	sleep(slotWait(period));
+}
+
+bool MySensor::sleepSlot(uint8_t interrupt, uint8_t mode, unsigned long period) {
+	return sleep(interrupt, mode, slotWait(period));
+}
+
 void MySensor::wait(unsigned long ms) {
 	// Let serial prints finish (debug, log etc)
 	Serial.flush();
@@ -502,48 +1505,48 @@ void MySensor::wait(unsigned long ms) {
 		// reset watchdog
 		wdt_reset();
 		process();
+#ifdef RF24_IRQ_PIN
+		// Nothing to do until the radio or the millis() timer interrupts.
+		// TX_DS and MAX_RT are masked, so stay awake while a relay is in the air.
+		if (rxHead == rxTail && !rxPending
+#if TX_QUEUE_SIZE > 0
+				&& txState != TX_QUEUE_SENDING
+#endif
+				) {
+			LowPower.idle(SLEEP_FOREVER, ADC_OFF, TIMER2_ON, TIMER1_ON, TIMER0_ON, SPI_ON, USART0_ON, TWI_ON);
+		}
+#endif
 	}
 }
 
 bool MySensor::sleep(uint8_t interrupt, uint8_t mode, unsigned long ms) {
-	// Let serial prints finish (debug, log etc)
-	bool pinTriggeredWakeup = true;
-	Serial.flush();
-	RF24::powerDown();
+	unsigned long left = prepareSleep(ms, ms == 0);
+	// Cleared before the handler can set it, internalSleep() only reads it
+	pinIntTrigger = 0;
 	attachInterrupt(interrupt, wakeUp, mode);
 	if (ms>0) {
-		pinIntTrigger = 0;
-		sleep(ms);
-		if (0 == pinIntTrigger) {
-			pinTriggeredWakeup = false;
-		}
-	} else {
-		Serial.flush();
+		internalSleep(left);
+	} else if (!pinIntTrigger) {
 		LowPower.powerDown(SLEEP_FOREVER, ADC_OFF, BOD_OFF);
 	}
 	detachInterrupt(interrupt);
-	return pinTriggeredWakeup;
+	return pinIntTrigger != 0;
 }
 
 int8_t MySensor::sleep(uint8_t interrupt1, uint8_t mode1, uint8_t interrupt2, uint8_t mode2, unsigned long ms) {
-	int8_t retVal = 1;
-	Serial.flush(); // Let serial prints finish (debug, log etc)
-	RF24::powerDown();
+	unsigned long left = prepareSleep(ms, ms == 0);
+	pinIntTrigger = 0;
 	attachInterrupt(interrupt1, wakeUp, mode1);
 	attachInterrupt(interrupt2, wakeUp2, mode2);
 	if (ms>0) {
-		pinIntTrigger = 0;
-		sleep(ms);
-		if (0 == pinIntTrigger) {
-			retVal = -1;
-		}
-	} else {
-		Serial.flush();
+		internalSleep(left);
+	} else if (!pinIntTrigger) {
 		LowPower.powerDown(SLEEP_FOREVER, ADC_OFF, BOD_OFF);
 	}
 	detachInterrupt(interrupt1);
 	detachInterrupt(interrupt2);
 
+	int8_t retVal = -1;
 	if (1 == pinIntTrigger) {
 		retVal = (int8_t)interrupt1;
 	} else if (2 == pinIntTrigger) {
@@ -553,16 +1556,77 @@ int8_t MySensor::sleep(uint8_t interrupt1, uint8_t mode1, uint8_t interrupt2, ui
 }
 
 #ifdef DEBUG
+void MySensor::debugPrint(int id, ... ) {
+	const char *fmt = (const char *)pgm_read_word(&logFormats[id]);
+	va_list args;
+	va_start (args, id);
+#ifdef DEBUG_BINARY
+	if (!isGateway) {
+		uint8_t record[LOG_RECORD_SIZE];
+		uint8_t length = 3;
+		char c;
+		while ((c = pgm_read_byte(fmt++)) != 0) {
+			if (c != '%') {
+				continue;
+			}
+			c = pgm_read_byte(fmt++);
+			if (c == 'd') {
+				int value = va_arg(args, int);
+				record[length++] = value;
+				record[length++] = value >> 8;
+			} else if (c == 's') {
+				const char *s = va_arg(args, const char *);
+				for (uint8_t i = 0; *s && i < LOG_STRING_MAX; i++) {
+					record[length++] = *s++;
+				}
+				record[length++] = 0;
+			}
+		}
+		va_end (args);
+		record[0] = LOG_START;
+		record[1] = id;
+		record[2] = length - 3;
+		logQueue(record, length);
+		logDrain();
+		return;
+	}
+#endif
+	debugText(fmt, args);
+	va_end (args);
+}
+
+// Text from the sketch, fmt in flash (PSTR). Binary logging queues it as is
+// between the records, sim/LogDecode passes it through.
 void MySensor::debugPrint(const char *fmt, ... ) {
+	va_list args;
+	va_start (args, fmt);
+#ifdef DEBUG_BINARY
+	if (!isGateway) {
+		char text[LOG_RECORD_SIZE];
+		vsnprintf_P(text, sizeof(text), fmt, args);
+		va_end (args);
+		logQueue((const uint8_t *)text, strlen(text));
+		logDrain();
+		return;
+	}
+#endif
+	debugText(fmt, args);
+	va_end (args);
+}
+
+void MySensor::debugText(const char *fmt, va_list args) {
 	char fmtBuffer[300];
+	if (logWrite != NULL) {
+		// The gateway sends it as an I_LOG_MESSAGE, framed in binary mode
+		vsnprintf_P(fmtBuffer, 60, fmt, args);
+		logWrite(this, fmtBuffer);
+		return;
+	}
 	if (isGateway) {
 		// prepend debug message to be handled correctly by gw (C_INTERNAL, I_LOG_MESSAGE)
 		snprintf_P(fmtBuffer, 299, PSTR("0;0;%d;0;%d;"), C_INTERNAL, I_LOG_MESSAGE);
 		Serial.print(fmtBuffer);
 	}
-	va_list args;
-	va_start (args, fmt );
-	va_end (args);
 	if (isGateway) {
 		// Truncate message if this is gateway node
 		vsnprintf_P(fmtBuffer, 60, fmt, args);
@@ -571,7 +1635,6 @@ void MySensor::debugPrint(const char *fmt, ... ) {
 	} else {
 		vsnprintf_P(fmtBuffer, 299, fmt, args);
 	}
-	va_end (args);
 	Serial.print(fmtBuffer);
 	Serial.flush();
 
@@ -579,10 +1642,53 @@ void MySensor::debugPrint(const char *fmt, ... ) {
 }
 #endif
 
+#ifdef DEBUG_BINARY
+void MySensor::logQueue(const uint8_t *record, uint8_t length) {
+	if (logDropped > 0 && (uint8_t)(DEBUG_LOG_SIZE - (uint8_t)(logTail - logHead)) >= 5 + length) {
+		// Tell the decoder about records lost before this one
+		uint8_t dropped[5] = { LOG_START, LOG_DROPPED, 2, (uint8_t)logDropped, (uint8_t)(logDropped >> 8) };
+		logDropped = 0;
+		logQueue(dropped, sizeof(dropped));
+	}
+	if ((uint8_t)(DEBUG_LOG_SIZE - (uint8_t)(logTail - logHead)) < length) {
+		logDropped++;
+		return;
+	}
+	for (uint8_t i = 0; i < length; i++) {
+		logBuffer[logTail++ % DEBUG_LOG_SIZE] = record[i];
+	}
+}
+
+void MySensor::logDrain() {
+	// Credit the bytes the UART has sent since the last call, so the serial
+	// transmit buffer never fills up and Serial.write() never waits
+	unsigned long sent = (micros() - logSentAt) / LOG_BYTE_US;
+	if (sent >= (uint8_t)(SERIAL_TX_SIZE - logRoom)) {
+		logRoom = SERIAL_TX_SIZE;
+		logSentAt = micros();
+	} else {
+		logRoom += sent;
+		logSentAt += sent * LOG_BYTE_US;
+	}
+	while (logRoom > 0 && logHead != logTail) {
+		Serial.write(logBuffer[logHead++ % DEBUG_LOG_SIZE]);
+		logRoom--;
+	}
+}
+
+void MySensor::logFlush() {
+	while (logHead != logTail) {
+		Serial.write(logBuffer[logHead++ % DEBUG_LOG_SIZE]);
+	}
+	logRoom = SERIAL_TX_SIZE;
+	logSentAt = micros();
+}
+#endif
+
 #ifdef DEBUG
 int MySensor::freeRam (void) {
   extern int __heap_start, *__brkval;
   int v;
-  return (int) &v - (__brkval == 0 ? (int) &__heap_start : (int) __brkval);
+  return (int) ((char *) &v - (__brkval == 0 ? (char *) &__heap_start : (char *) __brkval));
 }
 #endif
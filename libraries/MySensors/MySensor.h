@@ -15,6 +15,14 @@
 #include "Version.h"   // Auto generated by bot
 #include "MyConfig.h"
 #include "MyMessage.h"
+#include "MyEepromCache.h"
+#include "MyRoutingTable.h"
+#include "MyLinkQuality.h"
+#include "MyFirmware.h"
+#include "MyStream.h"
+#include "MyDuplicateCache.h"
+#include "MyMailbox.h"
+#include "MyLog.h"
 #include <stddef.h>
 #include <avr/eeprom.h>
 #include <avr/pgmspace.h>
@@ -33,6 +41,13 @@
 #define debug(x,...) debugPrint(x, ##__VA_ARGS__)
 #else
 #define debug(x,...)
+#undef DEBUG_BINARY
+#endif
+
+#ifdef NODE_STATS
+#define countStat(x) (stats.x++)
+#else
+#define countStat(x)
 #endif
 
 #define BAUD_RATE 115200
@@ -50,6 +65,7 @@
 #define EEPROM_DISTANCE_ADDRESS (EEPROM_PARENT_NODE_ID_ADDRESS+1)
 #define EEPROM_ROUTES_ADDRESS (EEPROM_DISTANCE_ADDRESS+1) // Where to start storing routing information in EEPROM. Will allocate 256 bytes.
 #define EEPROM_CONTROLLER_CONFIG_ADDRESS (EEPROM_ROUTES_ADDRESS+256) // Location of controller sent configuration (we allow one payload of config data from controller)
+#define EEPROM_SEQ_ADDRESS (EEPROM_CONTROLLER_CONFIG_ADDRESS+23) // Block of sequence numbers in use, last byte of the controller config area
 #define EEPROM_FIRMWARE_TYPE_ADDRESS (EEPROM_CONTROLLER_CONFIG_ADDRESS+24)
 #define EEPROM_FIRMWARE_VERSION_ADDRESS (EEPROM_FIRMWARE_TYPE_ADDRESS+2)
 #define EEPROM_FIRMWARE_BLOCKS_ADDRESS (EEPROM_FIRMWARE_VERSION_ADDRESS+2)
@@ -65,9 +81,6 @@
 #define CURRENT_NODE_PIPE ((uint8_t)1)
 #define BROADCAST_PIPE ((uint8_t)2)
 
-// Search for a new parent node after this many transmission failures
-#define SEARCH_FAILURES  5
-
 struct NodeConfig
 {
 	uint8_t nodeId; // Current node id
@@ -77,7 +90,66 @@ struct NodeConfig
 
 struct ControllerConfig {
 	uint8_t isMetric;
+	uint8_t slot; // Report slot (I_SLOT), AUTO for nodeId % SLOT_COUNT
+};
+
+#ifdef NODE_STATS
+#define STATS_SEND_BUCKETS 8
+
+// Counters wrap at 65535. I_STATS replies carry page 0 (counters, txOk to
+// parentChanges) or page 1 (sendTime) as P_CUSTOM: page byte, then the fields.
+struct NodeStats {
+	uint16_t txOk;          // Frames acked by the next hop (or broadcast)
+	uint16_t txFail;        // Frames given up after all retries
+	uint16_t txRetries;     // Hardware retransmissions (OBSERVE_TX)
+	uint16_t rx[3];         // Frames received on WRITE_PIPE, CURRENT_NODE_PIPE, BROADCAST_PIPE
+	uint16_t relayed;       // Messages forwarded for other nodes
+	uint16_t dropped;       // Messages with another protocol version
+	uint16_t duplicates;    // Messages received again and dropped
+	uint16_t parentChanges; // New parent found
+	// Time from start of a send to its outcome: bucket 0 under 1 ms, bucket
+	// i from 2^(i-1) up to 2^i ms, the last one 64 ms and more
+	uint16_t sendTime[STATS_SEND_BUCKETS];
+};
+#endif
+
+struct ParentCandidate {
+	uint8_t node;     // Repeater or gateway that answered a parent search
+	uint8_t distance; // Its hops to the gateway
+	bool strong;      // RPD set on its response
+};
+
+struct PendingResponse {
+	uint8_t node;     // Node searching a parent, BROADCAST_ADDRESS if unused
+	unsigned long at; // When to answer it
+};
+
+#if TX_QUEUE_SIZE > 0
+struct QueuedMessage {
+	uint8_t next;     // Node to write to
+	bool broadcast;   // Written without ack request
+	uint8_t rounds;   // Retry rounds used so far
+	uint8_t priority; // TX_PRIORITY_*, lower goes first
+	MyMessage msg;
+};
+#endif
+
+#if ACK_TABLE_SIZE > 0
+struct PendingAck {
+	MyMessage msg;       // As sent last
+	uint8_t first;       // Sequence number of the first try
+	uint8_t tries;       // Tries after the first
+	unsigned long dueAt; // Send again or give up then
 };
+#endif
+
+#if RX_QUEUE_SIZE > 0
+struct ReceivedMessage {
+	uint8_t pipe;    // Pipe it arrived on
+	bool strong;     // RPD set when it was read, parent responses only
+	MyMessage msg;
+};
+#endif
 
 #ifdef __cplusplus
 class MySensor : public RF24
@@ -137,10 +209,36 @@ class MySensor : public RF24
 	*
 	* @param msg Message to send
 	* @param ack Set this to true if you want destination node to send ack back to this node. Default is not to request any ack.
+	* With ACK_TABLE_SIZE set the message is sent again until the ack arrives, see setAckCallback().
 	* @return true Returns true if message reached the first stop on its way to destination.
 	*/
 	bool send(MyMessage &msg, bool ack=false);
 
+	/**
+	 * Messages sent with an ack requested are kept and sent again until their
+	 * ack arrives (ACK_TABLE_SIZE, ACK_TIMEOUT, ACK_RETRIES in MyConfig.h). A
+	 * newer message for the same child sensor and type replaces one still
+	 * waiting, and with the table full the oldest one is given up. With
+	 * ACK_TABLE_SIZE 0, the default, the callback is not called and acks go
+	 * to the incoming message callback as before.
+	 *
+	 * @param ackCallback Called with each message once it is acked (acked true) or given up (false).
+	 */
+	void setAckCallback(void (* ackCallback)(const MyMessage &msg, bool acked));
+
+	/**
+	* Sends several set messages packed into as few radio messages as possible.
+	* Consecutive messages to the same destination share one C_BATCH message as
+	* long as they fit, a value that travels alone is sent as a normal message.
+	* The gateway passes the values on to the controller one by one.
+	*
+	* @param msgs Messages to send
+	* @param count Number of messages
+	* @param ack Set this to true if you want destination node to send ack back to this node. Default is not to request any ack.
+	* @return true Returns true if all radio messages reached the first stop on their way to destination.
+	*/
+	bool sendBatch(MyMessage *msgs[], uint8_t count, bool ack=false);
+
 	/**
 	 * Send this nodes battery level to gateway.
 	 * @param level Level between 0-100(%)
@@ -166,6 +264,51 @@ class MySensor : public RF24
 	 */
 	void requestTime(void (* timeCallback)(unsigned long));
 
+#if FIRMWARE_WINDOW > 0
+	/**
+	 * Take part in over the air firmware updates. Asks the controller for the
+	 * firmware this node should run; the controller may also tell it any time
+	 * the node is awake. When that differs from what EEPROM says is installed,
+	 * the node fetches the new image while it process()es (sleep() stays
+	 * awake until it is done) and hands every block to the callback in order,
+	 * to store it e.g. in external flash. With all blocks in and the CRC
+	 * right, the new firmware config is written to EEPROM and the node
+	 * reboots for the bootloader to install the image.
+	 *
+	 * @param blockCallback Called with the number and the FIRMWARE_BLOCK_SIZE bytes of each block.
+	 */
+	void requestFirmware(void (* blockCallback)(uint16_t block, const uint8_t *data));
+#endif
+
+#if STREAM_WINDOW > 0
+	/**
+	 * Start a bulk data stream, for more than fits into one message (e.g. a
+	 * sound or image capture, or a log). Write the data with streamWrite() in
+	 * pieces of any size and finish with streamEnd(). The receiver gets it as
+	 * C_STREAM messages of the given type carrying a StreamSegment each, the
+	 * gateway passes them on to the controller. Starting a new stream drops
+	 * what is left of the last one.
+	 *
+	 * @param childSensorId The child sensor the data belongs to.
+	 * @param streamType ST_SOUND, ST_IMAGE or a later stream type.
+	 * @param destination Node to receive the stream, the gateway by default.
+	 */
+	void streamBegin(uint8_t childSensorId, uint8_t streamType, uint8_t destination=GATEWAY_ADDRESS);
+
+	/**
+	 * Add data to the stream. Returns once it is in the window, which means
+	 * waiting for acks while the window is full. False if the receiver
+	 * stopped acking, the stream is given up then.
+	 */
+	bool streamWrite(const void *data, uint16_t length);
+
+	/**
+	 * End the stream and wait until the receiver has acked all of it. True if
+	 * it did.
+	 */
+	bool streamEnd();
+#endif
+
 
 	/**
 	 * Processes incoming messages to this node. If this is a relaying node it will
@@ -185,6 +328,8 @@ class MySensor : public RF24
 	 *
 	 * You have 256 bytes to play with. Note that there is a limitation on the number
 	 * of writes the EEPROM can handle (~100 000 cycles).
+	 * The value is written back in the background by process(), and at the
+	 * latest before sleeping (see EEPROM_CACHE_SIZE).
 	 *
 	 * @param pos The position to store value in (0-255)
 	 * @param Value to store in position
@@ -204,12 +349,49 @@ class MySensor : public RF24
 	*/
 	MyMessage& getLastMessage(void);
 
+#ifdef NODE_STATS
+	/**
+	* Message statistics since startup or the last clearStats()
+	*/
+	const NodeStats& getStats();
+
+	/**
+	* Reset all statistics to zero
+	*/
+	void clearStats();
+#endif
+
 	/**
 	 * Sleep (PowerDownMode) the Arduino and radio. Wake up on timer.
 	 * @param ms Number of milliseconds to sleep.
 	 */
 	void sleep(unsigned long ms);
 
+	/**
+	 * Milliseconds since power-up, time asleep included (millis() stops in
+	 * power down). Sleeps that only a pin change can end are not counted.
+	 */
+	unsigned long getUptime();
+
+	/**
+	 * Sleep (PowerDownMode) the Arduino and radio until this node's report slot
+	 * in the next period (see SLOT_COUNT), by getUptime(). Call it once per
+	 * loop instead of sleep(period): time spent awake is taken off the sleep,
+	 * so the node keeps reporting in the same slot.
+	 * @param period Milliseconds between reports, the same on every call.
+	 */
+	void sleepSlot(unsigned long period);
+
+	/**
+	 * As sleepSlot(period), and wake up early when the pin of interrupt
+	 * changes. The next call still sleeps until the slot.
+	 * @param interrupt Interrupt that should trigger the wakeup
+	 * @param mode RISING, FALLING, CHANGE
+	 * @param period Milliseconds between reports, the same on every call.
+	 * @return true if the wake up was triggered by pin change and false means timer woke it up.
+	 */
+	bool sleepSlot(uint8_t interrupt, uint8_t mode, unsigned long period);
+
 	/**
 	 * Wait for a specified amount of time to pass.  Keeps process()ing.
 	 * This does not power-down the radio nor the Arduino.
@@ -247,6 +429,7 @@ class MySensor : public RF24
 
 
 #ifdef DEBUG
+	void debugPrint(int id, ... );
 	void debugPrint(const char *fmt, ... );
 	int freeRam();
 #endif
@@ -257,6 +440,9 @@ class MySensor : public RF24
 	bool repeaterMode;
 	bool autoFindParent;
 	bool isGateway;
+#ifdef DEBUG
+	void (*logWrite)(MySensor *gw, const char *text); // Passes a gateway's log text on, NULL prints it
+#endif
 	MyMessage msg;  // Buffer for incoming messages.
 	MyMessage ack;  // Buffer for ack messages.
 
@@ -264,24 +450,130 @@ class MySensor : public RF24
 	void setupRadio(rf24_pa_dbm_e paLevel, uint8_t channel, rf24_datarate_e dataRate);
 	boolean sendRoute(MyMessage &message);
 	boolean sendWrite(uint8_t dest, MyMessage &message, bool broadcast=false);
+	boolean queueWrite(uint8_t dest, MyMessage &message, bool broadcast=false);
+	void processTx();
+	void flushTx();
+	boolean processMessage(uint8_t pipe, bool strong);
+	bool receivedStrong(const MyMessage &message);
+#ifdef NODE_STATS
+	NodeStats stats;
+	void countSend(bool ok, unsigned long start);
+	MyMessage& setStats(MyMessage &message, uint8_t page);
+#endif
 
   private:
 #ifdef DEBUG
 	char convBuf[MAX_PAYLOAD*2+1];
+	void debugText(const char *fmt, va_list args);
+#endif
+#ifdef DEBUG_BINARY
+	uint8_t logBuffer[DEBUG_LOG_SIZE]; // Records waiting for the serial port
+	uint8_t logHead;
+	uint8_t logTail;
+	uint8_t logRoom; // Free bytes in the serial transmit buffer
+	unsigned long logSentAt; // UART time accounted for up to here
+	uint16_t logDropped;
+	void logQueue(const uint8_t *record, uint8_t length);
+	void logDrain();
+	void logFlush();
+#endif
+	MyLinkQuality linkQuality; // Retry policy for the link to the parent
+	bool searchingParent; // Inside findParentNode()
+	unsigned long wdtCalibration; // Measured length of the calibration watchdog period, us
+	unsigned long calibratedAt; // getUptime() then
+	long sleepError; // us the last sleep was short (negative: long) of what was asked
+	unsigned long sleptMs; // Time spent in power down
+	uint16_t sleptUs;
+#if FIRMWARE_WINDOW > 0
+	MyFirmware firmware; // Firmware download in progress
+#endif
+#if STREAM_WINDOW > 0
+	MyStream stream; // Stream being written, and the streams of other nodes being received
+	uint8_t streamTries; // Windows sent in a row that brought no ack
+	bool streamFailed;
+	bool streamAcked; // The last window sent has been answered
+	bool streamBusy; // by a receiver busy with other streams
+#endif
+	ParentCandidate candidates[PARENT_CANDIDATES]; // Responses to the current search
+	uint8_t candidateCount;
+	PendingResponse responses[PARENT_RESPONSES]; // Parent searches this repeater will answer
+#if TX_QUEUE_SIZE > 0
+	QueuedMessage txQueue[TX_QUEUE_SIZE]; // Ring buffer of messages waiting to be relayed
+	uint8_t txHead;
+	uint8_t txCount;
+	uint8_t txState;
+	unsigned long txRetryAt;
+#ifdef NODE_STATS
+	unsigned long txStartedAt; // First round of the message in the air
 #endif
-	uint8_t failedTransmissions;
-	uint8_t *childNodeTable; // In memory buffer for routing information to other nodes. also stored in EEPROM
+	void finishTx();
+#endif
+#if RX_QUEUE_SIZE > 0
+	// Ring buffer of messages read from the radio but not yet handled. Only
+	// fillRx() advances rxTail and only process() advances rxHead, so the
+	// radio interrupt can fill it while process() empties it.
+	ReceivedMessage rxQueue[RX_QUEUE_SIZE];
+	volatile uint8_t rxHead;
+	volatile uint8_t rxTail;
+	void drainRx();
+	void fillRx();
+#endif
+#ifdef RF24_IRQ_PIN
+	uint8_t csPin;
+	volatile bool rxPending; // Interrupt could not read the radio, process() has to
+	static void rxInterrupt();
+#endif
+	uint8_t seq; // Sequence number of the last message sent
+#if ACK_TABLE_SIZE > 0
+	PendingAck acks[ACK_TABLE_SIZE]; // Messages waiting for their ack, oldest first
+	uint8_t ackCount;
+	void trackAck(MyMessage &message);
+	void ackReceived(const MyMessage &message);
+	void processAcks();
+	void removeAck(uint8_t i, bool acked);
+#endif
+	void (*ackCallback)(const MyMessage &, bool); // How messages sent with ack ended
+#if MAILBOX_POLL_WINDOW > 0
+	bool heard; // The gateway heard from this node since its last I_SLEEPING
+	unsigned long mailAt; // Last message sent to the gateway or received, more mail may follow
+	bool waitingMail();
+	void sendSleeping();
+#endif
+	unsigned long slotWait(unsigned long period);
+#if DUPLICATE_CACHE_SIZE > 0
+	MyDuplicateCache duplicateCache; // Messages received lately
+#endif
+	MyEepromCache eepromCache; // Pending EEPROM writes
+	MyRoutingTable childNodeTable; // Routing information to other nodes, also stored in EEPROM
     void (*timeCallback)(unsigned long); // Callback for requested time messages
     void (*msgCallback)(const MyMessage &); // Callback for incoming messages from other nodes and gateway.
+#if FIRMWARE_WINDOW > 0
+    void (*firmwareCallback)(uint16_t, const uint8_t *); // Stores firmware blocks, NULL if not updating over the air
+#endif
 
     void requestNodeId();
 	void setupNode();
 	void findParentNode();
+	uint8_t parentScore(const ParentCandidate &candidate);
+	void addParentCandidate(uint8_t node, uint8_t distance, bool strong);
+	void setParent(uint8_t parent, uint8_t distance);
+	void sendParentResponses();
 	uint8_t crc8Message(MyMessage &message);
+	uint8_t nextSeq();
+	void saveSeqBlock();
 	uint8_t getChildRoute(uint8_t childId);
 	void addChildRoute(uint8_t childId, uint8_t route);
-	void removeChildRoute(uint8_t childId);
+#if FIRMWARE_WINDOW > 0
+	void processFirmware();
+	void firmwareReceived(const FirmwareBlock &block);
+#endif
+#if STREAM_WINDOW > 0
+	void streamWindow();
+#endif
+	unsigned long prepareSleep(unsigned long ms, bool forever);
 	void internalSleep(unsigned long ms);
+	void calibrateSleep();
+	unsigned long wdtLength(uint8_t period);
 };
 #endif
 
@@ -0,0 +1,195 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#include "MyStream.h"
+#include "MySensor.h"
+#include <Arduino.h>
+#include <string.h>
+
+#if STREAM_WINDOW > 0
+
+MyStream::MyStream() {
+	stream = 0;
+	count = 0;
+	open = false;
+	for (uint8_t i = 0; i < STREAM_PEERS; i++) {
+		peers[i].node = BROADCAST_ADDRESS;
+	}
+}
+
+void MyStream::begin(uint8_t _destination, uint8_t _sensor, uint8_t _type) {
+	destination = _destination;
+	sensor = _sensor;
+	type = _type;
+	// After a reboot start from a random id, the receiver may still know the
+	// last one used before
+	stream = stream ? stream + 1 : (uint8_t)micros() | 1;
+	base = 0;
+	head = 0;
+	count = 0;
+	ackedBits = 0;
+	open = false;
+}
+
+uint16_t MyStream::write(const uint8_t *data, uint16_t length) {
+	uint16_t done = 0;
+	while (done < length) {
+		if (!open) {
+			if (count == STREAM_WINDOW) {
+				break;
+			}
+			window[(head + count) % STREAM_WINDOW].length = 0;
+			count++;
+			open = true;
+		}
+		Segment &s = window[(head + count - 1) % STREAM_WINDOW];
+		uint16_t n = STREAM_SEGMENT_SIZE - s.length;
+		if (n > length - done) {
+			n = length - done;
+		}
+		memcpy(s.data + s.length, data + done, n);
+		s.length += n;
+		done += n;
+		if (s.length == STREAM_SEGMENT_SIZE) {
+			open = false;
+		}
+	}
+	return done;
+}
+
+bool MyStream::end() {
+	if (count == STREAM_WINDOW) {
+		return false;
+	}
+	window[(head + count) % STREAM_WINDOW].length = 0;
+	count++;
+	open = false;
+	return true;
+}
+
+bool MyStream::full() {
+	return count == STREAM_WINDOW && !open;
+}
+
+bool MyStream::empty() {
+	return count == 0;
+}
+
+bool MyStream::pending(uint8_t &index, StreamSegment &segment, uint8_t &length) {
+	// What goes on the air is final
+	open = false;
+	if (base == 0 && index > 0 && !(ackedBits & 1)) {
+		// Segment 0 goes alone, the rest follow once the receiver has room
+		return false;
+	}
+	for (; index < count; index++) {
+		if (!(ackedBits & (1 << index))) {
+			const Segment &s = window[(head + index) % STREAM_WINDOW];
+			segment.stream = stream;
+			segment.seq = base + index;
+			memcpy(segment.data, s.data, s.length);
+			length = STREAM_HEADER_SIZE + s.length;
+			index++;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool MyStream::acked(const StreamAck &ack) {
+	if (ack.stream != stream) {
+		return false;
+	}
+	uint16_t before = ackedBits;
+	for (uint8_t i = 0; i < count; i++) {
+		uint16_t offset = base + i - ack.next;
+		// Before next (wrapped around to large), or listed in received
+		if (offset >= 0x8000 || (offset > 0 && offset <= 16 && (ack.received & (1 << (offset - 1))))) {
+			ackedBits |= 1 << i;
+		}
+	}
+	bool progress = ackedBits != before;
+	while (count > 0 && (ackedBits & 1)) {
+		ackedBits >>= 1;
+		head = (head + 1) % STREAM_WINDOW;
+		base++;
+		count--;
+	}
+	return progress;
+}
+
+uint8_t MyStream::received(uint8_t sender, const StreamSegment &segment, uint8_t length, StreamAck &ack) {
+	unsigned long now = millis();
+	Peer *p = NULL, *free = NULL;
+	for (uint8_t i = 0; i < STREAM_PEERS; i++) {
+		Peer &q = peers[i];
+		if (q.node == sender) {
+			p = &q;
+		} else if (q.node == BROADCAST_ADDRESS || (q.ending && q.received == 0) ||
+				now - q.at > ((unsigned long)STREAM_TIMEOUT << 4) * STREAM_RETRIES) {
+			// Unused, ended or given up by its sender
+			free = &q;
+		}
+	}
+	if (p == NULL && segment.seq != 0) {
+		// Only segment 0 starts a stream, this one ended here and has been
+		// forgotten since. Its ack got lost, ack it again.
+		ack.stream = segment.stream;
+		ack.next = segment.seq + 1;
+		ack.received = 0;
+		return STREAM_DUPLICATE;
+	}
+	if (p == NULL) {
+		if (free == NULL) {
+			ack.stream = segment.stream;
+			return STREAM_REFUSED;
+		}
+		p = free;
+		p->node = sender;
+		p->stream = segment.stream + 1;
+	}
+	if (p->stream != segment.stream) {
+		// A new stream from this sender
+		p->stream = segment.stream;
+		p->next = 0;
+		p->received = 0;
+		p->ending = false;
+	}
+	p->at = now;
+	uint16_t offset = segment.seq - p->next;
+	bool fresh = false;
+	if (offset == 0) {
+		fresh = true;
+		// Move next past this one and every one already received after it
+		p->next++;
+		for (;;) {
+			bool have = p->received & 1;
+			p->received >>= 1;
+			if (!have) {
+				break;
+			}
+			p->next++;
+		}
+	} else if (offset <= 16) {
+		uint16_t bit = 1 << (offset - 1);
+		fresh = !(p->received & bit);
+		p->received |= bit;
+	}
+	if (length == STREAM_HEADER_SIZE) {
+		p->ending = true;
+	}
+	ack.stream = p->stream;
+	ack.next = p->next;
+	ack.received = p->received;
+	return fresh ? STREAM_NEW : STREAM_DUPLICATE;
+}
+
+#endif
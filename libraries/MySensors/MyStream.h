@@ -0,0 +1,145 @@
+/*
+ The MySensors library adds a new layer on top of the RF24 library.
+ It handles radio network routing, relaying and ids.
+
+ Created by Henrik Ekblad <henrik.ekblad@gmail.com>
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+ */
+
+#ifndef MyStream_h
+#define MyStream_h
+
+#include "MyConfig.h"
+#include "MyMessage.h"
+#include <stdint.h>
+
+#define STREAM_HEADER_SIZE 3 // Stream id and sequence number in front of the data
+#define STREAM_SEGMENT_SIZE (MAX_PAYLOAD - STREAM_HEADER_SIZE)
+
+// What MyStream::received() made of a segment
+#define STREAM_NEW       0 // Pass it on and ack
+#define STREAM_DUPLICATE 1 // Ack only
+#define STREAM_REFUSED   2 // Busy with STREAM_PEERS other streams, ack the stream id only
+
+/*
+ * Payloads of bulk data streams (C_STREAM with a type from ST_SOUND on, P_CUSTOM,
+ * little endian).
+ *
+ *   sender -> receiver  StreamSegment, up to STREAM_SEGMENT_SIZE bytes of data.
+ *                       One without data ends the stream.
+ *   receiver -> sender  StreamAck, same type with the ack flag set, for each
+ *                       segment that requests an ack. Only its stream id if
+ *                       the receiver has no room for another stream yet.
+ *
+ * Segments are numbered from 0 within a stream. Segment 0 is sent alone, the
+ * others once it has been acked, so a receiver that gets any other segment of
+ * a stream it does not know takes it for one that ended and was forgotten
+ * since, and acks it. The receiver passes each segment on once, in the order
+ * they arrive; the gateway as it does any message, to the controller, which
+ * puts them together by sequence number.
+ */
+struct StreamSegment {
+	uint8_t stream;   // Tells this stream from the sender's previous one
+	uint16_t seq;
+	uint8_t data[STREAM_SEGMENT_SIZE];
+} __attribute__((packed));
+
+struct StreamAck {
+	uint8_t stream;
+	uint16_t next;     // Every segment before this one has been received
+	uint16_t received; // Bit i: segment next + 1 + i has been received
+} __attribute__((packed));
+
+#if STREAM_WINDOW > 0
+/**
+ * Both ends of bulk data streams. As sender it holds the segments of the one
+ * stream this node is writing until the receiver acks them: a window of
+ * STREAM_WINDOW segments is sent back to back, the last one asking for a
+ * selective ack, and whatever the ack does not list is sent again. As
+ * receiver it remembers which segments of up to STREAM_PEERS streams came in,
+ * to ack them and to drop duplicates. A stream is forgotten once it ended, or
+ * has been quiet for longer than a sender keeps trying; until then further
+ * senders are told to wait.
+ */
+class MyStream
+{
+  public:
+	MyStream();
+
+	/**
+	 * Start a new stream, dropping what is left of the previous one.
+	 */
+	void begin(uint8_t destination, uint8_t sensor, uint8_t type);
+
+	/**
+	 * Copy data into the window. Returns how many bytes fit.
+	 */
+	uint16_t write(const uint8_t *data, uint16_t length);
+
+	/**
+	 * Add the segment that ends the stream. False if the window is full.
+	 */
+	bool end();
+
+	/**
+	 * True if the window has no room for another segment.
+	 */
+	bool full();
+
+	/**
+	 * True if every segment has been acked.
+	 */
+	bool empty();
+
+	/**
+	 * Segments of the window to send (again), the ones not acked yet. No more
+	 * data is added to a segment once it has been sent. Returns the number of
+	 * the segment and fills in segment and length, false after the last one.
+	 */
+	bool pending(uint8_t &index, StreamSegment &segment, uint8_t &length);
+
+	/**
+	 * An ack for this stream arrived. Slides the window past what it acks.
+	 * True if it acked anything new.
+	 */
+	bool acked(const StreamAck &ack);
+
+	/**
+	 * A segment of length bytes (header included) from sender arrived. Fills
+	 * in the ack to send back, only its stream id for STREAM_REFUSED.
+	 */
+	uint8_t received(uint8_t sender, const StreamSegment &segment, uint8_t length, StreamAck &ack);
+
+	uint8_t destination;
+	uint8_t sensor;
+	uint8_t type;
+	uint8_t stream;           // Id of the stream being written
+
+  private:
+	struct Segment {
+		uint8_t length;
+		uint8_t data[STREAM_SEGMENT_SIZE];
+	};
+	struct Peer {
+		uint8_t node;
+		uint8_t stream;
+		uint16_t next;
+		uint16_t received;
+		bool ending;          // The segment that ends the stream is in
+		unsigned long at;     // Last segment received
+	};
+	Segment window[STREAM_WINDOW];
+	uint16_t base;            // Sequence number of the oldest segment not acked
+	uint8_t head;             // Its index in window
+	uint8_t count;            // Segments in window
+	uint16_t ackedBits;       // Bit i: segment base + i has been acked
+	bool open;                // The last segment has not been sent and takes more data
+	Peer peers[STREAM_PEERS];
+};
+
+#endif
+
+#endif
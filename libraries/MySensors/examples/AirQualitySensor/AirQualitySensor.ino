@@ -99,7 +99,7 @@ void loop()
       lastMQ = ceil(valMQ);
   }
   
-  gw.sleep(SLEEP_TIME); //sleep for: sleepTime 
+  gw.sleepSlot(SLEEP_TIME); //sleep for: sleepTime 
 }
 
 /****************** MQResistanceCalculation ****************************************
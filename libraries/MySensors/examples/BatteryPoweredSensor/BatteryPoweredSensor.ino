@@ -47,5 +47,5 @@ void loop()
      gw.sendBatteryLevel(batteryPcnt);
      oldBatteryPcnt = batteryPcnt;
    }
-   gw.sleep(SLEEP_TIME);
+   gw.sleepSlot(SLEEP_TIME);
 }
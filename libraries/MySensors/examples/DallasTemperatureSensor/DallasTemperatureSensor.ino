@@ -60,7 +60,7 @@ void loop()
       lastTemperature[i]=temperature;
     }
   }
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
 
 
@@ -38,7 +38,7 @@ void loop()
       lastDist = dist;
   }
 
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
 
 
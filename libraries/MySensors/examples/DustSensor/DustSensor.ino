@@ -76,5 +76,5 @@ void loop()
       lastDUST = ceil(dustDensity);
   }
  
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
@@ -78,9 +78,6 @@ MyGateway gw(RADIO_CE_PIN, RADIO_SPI_SS_PIN, INCLUSION_MODE_TIME);
 //MyGateway gw(RADIO_CE_PIN, RADIO_SPI_SS_PIN, INCLUSION_MODE_TIME, INCLUSION_MODE_PIN, RADIO_RX_LED_PIN, RADIO_TX_LED_PIN, RADIO_ERROR_LED_PIN);
 
 
-char inputString[MAX_RECEIVE_LENGTH] = "";    // A string to hold incoming commands from serial/ethernet interface
-int inputPos = 0;
-
 void setup()  
 { 
   Ethernet.begin(mac, myIp);
@@ -113,29 +110,11 @@ void loop()
          // read the bytes incoming from the client
          char inChar = client.read();
 
-         if (inputPos<MAX_RECEIVE_LENGTH-1) { 
-           // if newline then command is complete
-           if (inChar == '\n') {  
-              // a command was issued by the client
-              // we will now try to send it to the actuator
-              inputString[inputPos] = 0;
-
-              // echo the string to the serial port
-              Serial.print(inputString);
-
-              gw.parseAndSend(inputString);
-
-              // clear the string:
-              inputPos = 0;
-           } else {  
-             // add it to the inputString:
-             inputString[inputPos] = inChar;
-             inputPos++;
-           }
-        } else {
-           // Incoming message too long. Throw away 
-           inputPos = 0;
-        }
+         // echo the command to the serial port
+         Serial.print(inChar);
+
+         // a command is sent to the actuator when its newline arrives
+         gw.parse(inChar);
       }
    }  
    gw.processRadioMessage();    
@@ -58,7 +58,7 @@ void loop()
       Serial.println(humidity);
   }
 
-  gw.sleep(SLEEP_TIME); //sleep a bit
+  gw.sleepSlot(SLEEP_TIME); //sleep a bit
 }
 
 
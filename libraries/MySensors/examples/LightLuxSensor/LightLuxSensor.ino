@@ -52,5 +52,5 @@ void loop()
       lastlux = lux;
   }
   
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
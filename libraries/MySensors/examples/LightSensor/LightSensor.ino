@@ -29,7 +29,7 @@ void loop()
       gw.send(msg.set(lightLevel));
       lastLightLevel = lightLevel;
   }
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
 
 
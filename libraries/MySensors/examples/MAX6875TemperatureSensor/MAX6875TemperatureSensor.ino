@@ -58,5 +58,5 @@ void loop()
     lastTemperature = temperature;
   }
 
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
@@ -89,7 +89,7 @@ void loop() {
    5 = "Unknown (More Time needed) 
   */
 
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
 
 int sample(float pressure) {
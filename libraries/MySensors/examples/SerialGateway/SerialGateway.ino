@@ -32,10 +32,6 @@
 
 MyGateway gw(DEFAULT_CE_PIN, DEFAULT_CS_PIN, INCLUSION_MODE_TIME, INCLUSION_MODE_PIN,  6, 5, 4);
 
-char inputString[MAX_RECEIVE_LENGTH] = "";    // A string to hold incoming commands from serial/ethernet interface
-int inputPos = 0;
-boolean commandComplete = false;  // whether the string is complete
-
 void setup()  
 { 
   gw.begin();
@@ -44,13 +40,6 @@ void setup()
 void loop()  
 { 
   gw.processRadioMessage();   
-  if (commandComplete) {
-    // A command wass issued from serial interface
-    // We will now try to send it to the actuator
-    gw.parseAndSend(inputString);
-    commandComplete = false;  
-    inputPos = 0;
-  }
 }
 
 
@@ -62,24 +51,8 @@ void loop()
  */
 void serialEvent() {
   while (Serial.available()) {
-    // get the new byte:
-    char inChar = (char)Serial.read(); 
-    // if the incoming character is a newline, set a flag
-    // so the main loop can do something about it:
-    if (inputPos<MAX_RECEIVE_LENGTH-1 && !commandComplete) { 
-      if (inChar == '\n') {
-        inputString[inputPos] = 0;
-        commandComplete = true;
-      } else {
-        // add it to the inputString:
-        inputString[inputPos] = inChar;
-        inputPos++;
-      }
-    } else {
-       // Incoming message too long. Throw away 
-        inputPos = 0;
-    }
+    // The gateway parses commands as they arrive and sends
+    // each one to the actuator when its newline comes in
+    gw.parse((char)Serial.read());
   }
 }
-
-
@@ -83,5 +83,5 @@ void loop()
       lastUV = uvIndex;
   }
   
-  gw.sleep(SLEEP_TIME);
+  gw.sleepSlot(SLEEP_TIME);
 }
@@ -0,0 +1,91 @@
+/*
+ Decoder for the binary debug log (DEBUG_BINARY in MyConfig.h).
+
+ Reads a capture of a node's serial port and prints it as text: records are
+ expanded with the formats from MyLog.h, any other bytes (prints of the
+ sketch) are passed through. A record that does not match its format is
+ printed as raw bytes and decoding resumes after its LOG_START byte.
+
+ Usage: LogDecode [capture]   (reads stdin without a file)
+*/
+
+#include <MyLog.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+#define LOG_FORMAT(id, format) format,
+static const char *formats[] = { LOG_MESSAGES(LOG_FORMAT) };
+#undef LOG_FORMAT
+
+// Text of the record starting at data[0], or false if it is not a valid record
+static bool decode(const uint8_t *data, size_t size, size_t &used, std::string &text) {
+	if (size < 3 || data[1] >= LOG_COUNT || (size_t)data[2] + 3 > size) {
+		return false;
+	}
+	const uint8_t *arg = data + 3;
+	const uint8_t *end = arg + data[2];
+	char buffer[16];
+	text.clear();
+	for (const char *f = formats[data[1]]; *f; f++) {
+		if (*f != '%') {
+			text += *f;
+			continue;
+		}
+		f++;
+		if (*f == 'd') {
+			if (end - arg < 2) {
+				return false;
+			}
+			snprintf(buffer, sizeof buffer, "%d", (int16_t)(arg[0] | arg[1] << 8));
+			text += buffer;
+			arg += 2;
+		} else if (*f == 's') {
+			const uint8_t *zero = (const uint8_t *)memchr(arg, 0, end - arg);
+			if (zero == NULL) {
+				return false;
+			}
+			text.append((const char *)arg, zero - arg);
+			arg = zero + 1;
+		} else {
+			text += '%';
+			text += *f;
+		}
+	}
+	if (arg != end) {
+		return false;
+	}
+	used = 3 + data[2];
+	return true;
+}
+
+int main(int argc, char **argv) {
+	FILE *in = argc > 1 ? fopen(argv[1], "rb") : stdin;
+	if (in == NULL) {
+		perror(argv[1]);
+		return 1;
+	}
+	std::vector<uint8_t> data;
+	uint8_t chunk[4096];
+	size_t n;
+	while ((n = fread(chunk, 1, sizeof chunk, in)) > 0) {
+		data.insert(data.end(), chunk, chunk + n);
+	}
+
+	std::string text;
+	size_t i = 0;
+	while (i < data.size()) {
+		size_t used;
+		if (data[i] != LOG_START) {
+			putchar(data[i++]);
+		} else if (decode(&data[i], data.size() - i, used, text)) {
+			fputs(text.c_str(), stdout);
+			i += used;
+		} else {
+			printf("<%02X>", data[i++]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*
+ Host-native simulator for MySensors networks.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "Sim.h"
+#include <Arduino.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <algorithm>
+
+Sim Simulator;
+
+extern int *__brkval; // SimArduino.cpp
+
+// Out of line, or GCC takes the free() of an inlined delete for a mismatch
+void *SimSketch::operator new(size_t size) {
+	void *p = calloc(1, size);
+	if (!p) {
+		throw std::bad_alloc();
+	}
+	return p;
+}
+
+void SimSketch::operator delete(void *p) {
+	free(p);
+}
+
+Sim::Sim() : running(NULL), reached(0), trace(false), rng(1), wdtError(0) {
+}
+
+Sim::~Sim() {
+	for (size_t i = 0; i < nodes.size(); i++) {
+		free(nodes[i]->stack);
+		delete nodes[i];
+	}
+}
+
+uint16_t Sim::addNode(SimSketch *sketch, uint8_t cePin, uint8_t csnPin, uint8_t irqPin) {
+	SimNode *n = new SimNode();
+	n->index = nodes.size();
+	n->sketch = sketch;
+	n->radio.attach(n->index);
+	n->cePin = cePin;
+	n->csnPin = csnPin;
+	n->irqPin = irqPin;
+	n->clock = reached;
+	n->slept = 0;
+	n->idled = 0;
+	n->wdtScale = wdtError > 0 ? 1 + wdtError * ((double)random32() / 0x80000000u - 1) : 1;
+	n->yieldAt = 0;
+	n->halted = false;
+	memset(n->eeprom, 0xFF, sizeof(n->eeprom));
+	n->eepromReadyAt = 0;
+	n->eepromWrites = 0;
+	n->baud = 0;
+	n->serialDoneAt = 0;
+	n->serialInputAt = 0;
+	memset(n->pins, 0, sizeof(n->pins));
+	n->isr[0] = n->isr[1] = NULL;
+	memset(n->pinIsr, 0, sizeof(n->pinIsr));
+	memset(n->pinIsrMode, 0, sizeof(n->pinIsrMode));
+	n->interruptsOn = true;
+	n->inIsr = false;
+	n->irqPending = false;
+	n->woke = false;
+	for (size_t i = 0; i < locals.size(); i++) {
+		n->locals.insert(n->locals.end(), locals[i].size, 0);
+	}
+	if (irqPin < sizeof(n->pins)) {
+		n->pins[irqPin] = HIGH;
+	}
+	n->stack = (char *)malloc(SIM_STACK_SIZE);
+
+	nodes.push_back(n);
+	start(n);
+	Ether.add(&n->radio);
+	ready.push((Pending){n->clock, n->index});
+	return n->index;
+}
+
+void Sim::reboot(uint16_t index, SimSketch *sketch) {
+	SimNode *n = nodes[index];
+	delete n->sketch;
+	n->sketch = sketch;
+	n->radio.reset();
+	// millis() and micros() start from 0 again, as after a reset
+	n->slept = n->clock;
+	n->serialLine.clear();
+	n->serialInput.clear();
+	n->baud = 0;
+	memset(n->pins, 0, sizeof(n->pins));
+	n->isr[0] = n->isr[1] = NULL;
+	memset(n->pinIsr, 0, sizeof(n->pinIsr));
+	memset(n->pinIsrMode, 0, sizeof(n->pinIsrMode));
+	n->interruptsOn = true;
+	n->inIsr = false;
+	n->irqPending = false;
+	n->woke = false;
+	std::fill(n->locals.begin(), n->locals.end(), 0);
+	if (n->irqPin < sizeof(n->pins)) {
+		n->pins[n->irqPin] = HIGH;
+	}
+	// Whatever it was doing is dropped with its stack. A node that is not
+	// halted is still queued to run.
+	start(n);
+	if (n->halted) {
+		n->halted = false;
+		ready.push((Pending){n->clock, n->index});
+	}
+}
+
+void Sim::start(SimNode *n) {
+	getcontext(&n->context);
+	n->context.uc_stack.ss_sp = n->stack;
+	n->context.uc_stack.ss_size = SIM_STACK_SIZE;
+	n->context.uc_link = &mainContext;
+	makecontext(&n->context, (void (*)(void))entry, 1, (int)n->index);
+}
+
+void Sim::entry(int index) {
+	SimNode *n = Simulator.nodes[index];
+	n->sketch->setup();
+	for (;;) {
+		n->sketch->loop();
+		Simulator.advance(SIM_LOOP_US);
+	}
+}
+
+void Sim::run(uint64_t until) {
+	while (!ready.empty()) {
+		Pending p = ready.top();
+		if (p.clock >= until) {
+			break;
+		}
+		ready.pop();
+		SimNode *n = nodes[p.index];
+		if (n->halted) {
+			continue;
+		}
+		uint64_t horizon = until;
+		if (!ready.empty() && ready.top().clock + SIM_QUANTUM_US < horizon) {
+			horizon = ready.top().clock + SIM_QUANTUM_US;
+		}
+		n->yieldAt = horizon;
+		running = n;
+		__brkval = (int *)(n->stack + SIM_STACK_RESERVE);
+		swapLocals(n, true);
+		swapcontext(&mainContext, &n->context);
+		swapLocals(n, false);
+		running = NULL;
+		if (!n->halted) {
+			ready.push((Pending){n->clock, n->index});
+		}
+	}
+	reached = until;
+}
+
+uint64_t Sim::now() const {
+	return running ? running->clock : reached;
+}
+
+void Sim::nodeLocal(void *var, size_t size) {
+	for (size_t i = 0; i < locals.size(); i++) {
+		if (locals[i].var == var) {
+			return;
+		}
+	}
+	Local l = { (uint8_t *)var, size };
+	locals.push_back(l);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		std::vector<uint8_t> &v = nodes[i]->locals;
+		if (nodes[i] == running) {
+			v.insert(v.end(), l.var, l.var + size);
+		} else {
+			v.insert(v.end(), size, 0);
+		}
+	}
+}
+
+void Sim::swapLocals(SimNode *n, bool in) {
+	uint8_t *saved = n->locals.data();
+	for (size_t i = 0; i < locals.size(); i++) {
+		if (in) {
+			memcpy(locals[i].var, saved, locals[i].size);
+		} else {
+			memcpy(saved, locals[i].var, locals[i].size);
+		}
+		saved += locals[i].size;
+	}
+}
+
+void Sim::yield() {
+	SimNode *n = running;
+	swapcontext(&n->context, &mainContext);
+}
+
+void Sim::advance(uint64_t us) {
+	SimNode *n = running;
+	if (n == NULL) {
+		return;
+	}
+	// An AVR without watchdog hangs once its stack runs into the heap. Do the
+	// same before runaway recursion runs off the coroutine stack.
+	char here;
+	if (&here < n->stack + SIM_STACK_RESERVE) {
+		fprintf(stderr, "node %d: stack overflow at %.6f s, halted\n", n->index, n->clock / 1e6);
+		halt();
+	}
+	uint64_t target = us == SIM_FOREVER ? SIM_FOREVER : n->clock + us;
+	while (n->clock < target) {
+		uint64_t step = target - n->clock;
+		// A radio with traffic in flight must not skip past other nodes' frames
+		if (n->radio.busy() && step > SIM_QUANTUM_US) {
+			step = SIM_QUANTUM_US;
+		}
+		n->clock += step;
+		n->radio.update(n->clock);
+		checkInterrupts();
+		if (n->clock >= n->yieldAt) {
+			yield();
+		}
+	}
+}
+
+void Sim::idle(uint64_t us) {
+	SimNode *n = running;
+	if (n == NULL) {
+		return;
+	}
+	// Sleep in small steps so an interrupt ends it close to when it happened
+	uint64_t start = n->clock;
+	n->woke = false;
+	while (!n->woke && n->clock - start < us) {
+		uint64_t left = us - (n->clock - start);
+		advance(left < SIM_QUANTUM_US ? left : SIM_QUANTUM_US);
+	}
+	n->idled += n->clock - start;
+}
+
+void Sim::checkInterrupts() {
+	SimNode *n = running;
+	if (n == NULL || n->irqPin >= sizeof(n->pins)) {
+		return;
+	}
+	uint8_t level = n->radio.irq() ? LOW : HIGH;
+	if (level != n->pins[n->irqPin]) {
+		n->pins[n->irqPin] = level;
+		int mode = n->pinIsrMode[n->irqPin];
+		if (n->pinIsr[n->irqPin] != NULL &&
+				(mode == CHANGE || (mode == FALLING && level == LOW) || (mode == RISING && level == HIGH))) {
+			n->irqPending = true;
+		}
+	}
+	// Like the AVR, the pending flag waits until interrupts are enabled and no
+	// other handler is running
+	if (n->irqPending && n->interruptsOn && !n->inIsr && n->pinIsr[n->irqPin] != NULL) {
+		n->irqPending = false;
+		n->inIsr = true;
+		n->woke = true;
+		n->pinIsr[n->irqPin]();
+		n->inIsr = false;
+	}
+}
+
+void Sim::halt() {
+	SimNode *n = running;
+	n->halted = true;
+	yield();
+	// Never resumed
+}
+
+void Sim::serialWrite(const uint8_t *data, size_t length) {
+	SimNode *n = running;
+	if (n == NULL) {
+		return;
+	}
+	n->sketch->serialData(data, length);
+	for (size_t i = 0; i < length; i++) {
+		char c = data[i];
+		if (c == '\n') {
+			if (trace) {
+				printf("%10.6f %3d: %s\n", n->clock / 1e6, n->index, n->serialLine.c_str());
+			}
+			n->sketch->serialLine(n->serialLine.c_str());
+			n->serialLine.clear();
+		} else if (c != '\r') {
+			n->serialLine += c;
+		}
+	}
+	if (n->baud == 0) {
+		return;
+	}
+	// 64 byte hardware serial buffer: print() only blocks once it is full
+	uint64_t byteTime = 10000000UL / n->baud;
+	uint64_t start = n->serialDoneAt > n->clock ? n->serialDoneAt : n->clock;
+	n->serialDoneAt = start + length * byteTime;
+	if (n->serialDoneAt > n->clock + 64 * byteTime) {
+		advance(n->serialDoneAt - n->clock - 64 * byteTime);
+	}
+}
+
+void Sim::serialFlush() {
+	SimNode *n = running;
+	if (n != NULL && n->serialDoneAt > n->clock) {
+		advance(n->serialDoneAt - n->clock);
+	}
+}
+
+void Sim::serialInput(uint16_t index, const char *data) {
+	serialInput(index, (const uint8_t *)data, strlen(data));
+}
+
+void Sim::serialInput(uint16_t index, const uint8_t *data, size_t length) {
+	SimNode *n = nodes[index];
+	uint64_t byteTime = 10000000UL / (n->baud ? n->baud : 115200);
+	uint64_t at = n->serialInputAt > now() ? n->serialInputAt : now();
+	for (size_t i = 0; i < length; i++) {
+		at += byteTime;
+		SimSerialByte b = { at, data[i] };
+		n->serialInput.push_back(b);
+	}
+	n->serialInputAt = at;
+}
+
+uint32_t Sim::random32() {
+	// xorshift32, deterministic for a given seed
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
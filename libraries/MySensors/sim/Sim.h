@@ -0,0 +1,205 @@
+/*
+ Host-native simulator for MySensors networks.
+
+ Each virtual node runs a sketch (an object with setup()/loop()) on its own
+ coroutine, with its own clock, EEPROM, serial port and simulated nRF24L01+
+ radio. The scheduler always resumes the node that is furthest behind in
+ simulated time and lets it run at most SIM_QUANTUM_US ahead of the others,
+ so radio traffic between nodes stays causally ordered.
+
+ Simulated time only moves when the firmware spends it: delays, SPI bytes,
+ serial output, EEPROM writes, sleeping and polling millis()/micros(). CPU
+ time spent in plain computation is not modelled.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Sim_h
+#define Sim_h
+
+#include "SimRadio.h"
+#include "SimEther.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <deque>
+#include <queue>
+#include <ucontext.h>
+
+#define SIM_QUANTUM_US 50          // Max lead of the running node over the others
+#define SIM_STACK_SIZE (128*1024)
+#define SIM_STACK_RESERVE (16*1024) // A node that recurses into this is halted
+#define SIM_EEPROM_SIZE 1024       // ATmega328P
+#define SIM_EEPROM_WRITE_US 3400   // Erase+write cycle of one EEPROM byte
+#define SIM_SPI_BYTE_US 2          // 8MHz SPI plus loop overhead
+#define SIM_CLOCK_READ_US 1        // Cost of a millis()/micros() call
+#define SIM_LOOP_US 10             // Arduino main loop overhead per loop()
+#define SIM_FOREVER ((uint64_t)-1)
+
+/**
+ * A sketch running on one virtual node. Subclass it and construct the
+ * MySensor/MyGateway object as a member, exactly like a global in an .ino.
+ * Globals start out zeroed on the AVR (.bss), so sketches are allocated in
+ * zeroed memory too.
+ */
+class SimSketch
+{
+  public:
+	static void *operator new(size_t size);
+	static void operator delete(void *p);
+
+	virtual ~SimSketch() {}
+	virtual void setup() {}
+	virtual void loop() = 0;
+	// Called for every complete line the node prints on its serial port
+	virtual void serialLine(const char *line) { (void)line; }
+	// Called with everything the node writes to its serial port, binary included
+	virtual void serialData(const uint8_t *data, size_t length) { (void)data; (void)length; }
+};
+
+struct SimSerialByte
+{
+	uint64_t at;          // Fully received at this time
+	uint8_t c;
+};
+
+struct SimNode
+{
+	uint16_t index;
+	SimSketch *sketch;
+	SimRadio radio;
+	uint8_t cePin;
+	uint8_t csnPin;
+	uint8_t irqPin;       // Radio IRQ output (active low)
+
+	uint64_t clock;       // Simulated time (us)
+	uint64_t slept;       // Time spent in power down, hidden from millis()/micros()
+	uint64_t idled;       // Time spent in idle sleep waiting for an interrupt
+	double wdtScale;      // Watchdog periods are this many times the nominal ones
+	uint64_t yieldAt;
+	bool halted;          // Stopped for good (wdt reset, stack overflow)
+
+	uint8_t eeprom[SIM_EEPROM_SIZE];
+	uint64_t eepromReadyAt;
+	uint32_t eepromWrites;
+
+	unsigned long baud;
+	uint64_t serialDoneAt;
+	std::string serialLine;
+	std::deque<SimSerialByte> serialInput;
+	uint64_t serialInputAt; // Last byte of serialInput received at this time
+
+	uint8_t pins[64];
+	void (*isr[2])(void);
+	void (*pinIsr[64])(void); // Pin change interrupts
+	int pinIsrMode[64];
+	bool interruptsOn;
+	bool inIsr;
+	bool irqPending;      // Edge on the IRQ pin not yet serviced
+	bool woke;            // An interrupt ran since the last idle()
+	std::vector<uint8_t> locals; // This node's values of the nodeLocal() globals
+
+	ucontext_t context;
+	char *stack;
+};
+
+class Sim
+{
+  public:
+	Sim();
+	~Sim();
+
+	/**
+	 * Add a node running the given sketch. Node indexes are handed out in order
+	 * starting at 0; they are unrelated to MySensors node ids.
+	 */
+	uint16_t addNode(SimSketch *sketch, uint8_t cePin=9, uint8_t csnPin=10, uint8_t irqPin=2);
+
+	/**
+	 * Power cycle a node between run()s: it starts over with the given sketch
+	 * (the old one is deleted), cleared RAM, a reset radio and millis() from 0.
+	 * Only its EEPROM is kept. A halted node comes back to life.
+	 */
+	void reboot(uint16_t index, SimSketch *sketch);
+
+	/**
+	 * Run all nodes until every one of them has reached the given simulated time.
+	 */
+	void run(uint64_t until);
+
+	/**
+	 * Simulated time in us. Inside a sketch this is the running node's clock,
+	 * outside it is the time the last run() reached.
+	 */
+	uint64_t now() const;
+
+	SimNode *current() const { return running; }
+	SimNode &node(uint16_t index) { return *nodes[index]; }
+	uint16_t size() const { return nodes.size(); }
+
+	// Feed bytes into a node's serial receive buffer (e.g. controller commands).
+	// They arrive one after the other at the node's baud rate, from now on.
+	void serialInput(uint16_t index, const char *data);
+	void serialInput(uint16_t index, const uint8_t *data, size_t length);
+
+	// Echo every serial line of every node to stdout
+	void setTrace(bool on) { trace = on; }
+
+	uint32_t random32();
+	void seed(uint32_t s) { rng = s ? s : 1; }
+
+	/**
+	 * Give every node a watchdog oscillator off by a random amount of up to
+	 * +-error (0.1 = 10%), like real ones. Applies to nodes added afterwards.
+	 */
+	void setWdtError(double error) { wdtError = error; }
+
+	/**
+	 * Give a firmware global its own value on every node, as if each had its
+	 * own RAM. Meant for the few globals interrupt handlers use to find their
+	 * object, the library declares them with PCINT_HANDLER_DATA(). The
+	 * registering node keeps the current value, all others start out zeroed.
+	 */
+	void nodeLocal(void *var, size_t size);
+
+	/* Used by the Arduino stand-ins */
+	void advance(uint64_t us);
+	void idle(uint64_t us);
+	void checkInterrupts();
+	void halt();
+	void serialWrite(const uint8_t *data, size_t length);
+	void serialFlush();
+
+  private:
+	struct Pending {
+		uint64_t clock;
+		uint16_t index;
+		bool operator<(const Pending &o) const { return clock > o.clock || (clock == o.clock && index > o.index); }
+	};
+
+	std::vector<SimNode *> nodes;
+	std::priority_queue<Pending> ready;
+	SimNode *running;
+	ucontext_t mainContext;
+	uint64_t reached;
+	bool trace;
+	uint32_t rng;
+	double wdtError;
+
+	struct Local {
+		uint8_t *var;
+		size_t size;
+	};
+	std::vector<Local> locals;
+
+	void yield();
+	void swapLocals(SimNode *n, bool in);
+	void start(SimNode *n);
+	static void entry(int index);
+};
+
+extern Sim Simulator;
+
+#endif
@@ -0,0 +1,466 @@
+/*
+ Arduino core, avr-libc and utility library stand-ins for the MySensors
+ simulator. Everything acts on the node that is currently running.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include <Arduino.h>
+#include <SPI.h>
+#include <avr/eeprom.h>
+#include <avr/wdt.h>
+#include "Sim.h"
+#include "../utility/LowPower.h"
+#include "../utility/MsTimer2.h"
+#include "../utility/PinChangeInt.h"
+
+HardwareSerial Serial;
+SPIClass SPI;
+LowPowerClass LowPower;
+
+/*
+ * Time
+ */
+
+unsigned long micros(void) {
+	Simulator.advance(SIM_CLOCK_READ_US);
+	SimNode *n = Simulator.current();
+	// Timer0 does not run in power down, so sleep time never shows up here
+	return n ? (unsigned long)(uint32_t)(n->clock - n->slept) : (unsigned long)(uint32_t)Simulator.now();
+}
+
+unsigned long millis(void) {
+	Simulator.advance(SIM_CLOCK_READ_US);
+	SimNode *n = Simulator.current();
+	uint64_t t = n ? n->clock - n->slept : Simulator.now();
+	return (unsigned long)(uint32_t)(t / 1000);
+}
+
+void delay(unsigned long ms) {
+	Simulator.advance((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+	Simulator.advance(us);
+}
+
+/*
+ * Pins and interrupts
+ */
+
+void pinMode(uint8_t pin, uint8_t mode) {
+	if (mode == INPUT_PULLUP) {
+		digitalWrite(pin, HIGH);
+	}
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+	SimNode *n = Simulator.current();
+	if (n == NULL) {
+		return;
+	}
+	if (pin < sizeof(n->pins)) {
+		n->pins[pin] = val;
+	}
+	if (pin == n->csnPin) {
+		n->radio.csn(val);
+	}
+	if (pin == n->cePin) {
+		n->radio.ce(val, n->clock);
+	}
+}
+
+int digitalRead(uint8_t pin) {
+	SimNode *n = Simulator.current();
+	return (n && pin < sizeof(n->pins)) ? n->pins[pin] : LOW;
+}
+
+int analogRead(uint8_t pin) {
+	(void)pin;
+	Simulator.advance(100); // One ADC conversion
+	return 0;
+}
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode) {
+	(void)mode;
+	SimNode *n = Simulator.current();
+	if (n && interrupt < 2) {
+		n->isr[interrupt] = isr;
+	}
+}
+
+void detachInterrupt(uint8_t interrupt) {
+	SimNode *n = Simulator.current();
+	if (n && interrupt < 2) {
+		n->isr[interrupt] = NULL;
+	}
+}
+
+void noInterrupts(void) {
+	SimNode *n = Simulator.current();
+	if (n) {
+		n->interruptsOn = false;
+	}
+}
+
+void interrupts(void) {
+	SimNode *n = Simulator.current();
+	if (n) {
+		n->interruptsOn = true;
+		Simulator.checkInterrupts();
+	}
+}
+
+// Only the radio IRQ pin ever changes level in the simulator
+int8_t PCintPort::attachInterrupt(uint8_t pin, PCIntvoidFuncPtr userFunc, int mode) {
+	SimNode *n = Simulator.current();
+	if (n == NULL || pin >= sizeof(n->pins)) {
+		return -1;
+	}
+	n->pinIsr[pin] = userFunc;
+	n->pinIsrMode[pin] = mode;
+	return 1;
+}
+
+void PCintPort::detachInterrupt(uint8_t pin) {
+	SimNode *n = Simulator.current();
+	if (n && pin < sizeof(n->pins)) {
+		n->pinIsr[pin] = NULL;
+	}
+}
+
+void PCintPort::handlerData(void *var, size_t size) {
+	Simulator.nodeLocal(var, size);
+}
+
+/*
+ * Random numbers (shared, seeded generator so runs are reproducible)
+ */
+
+long random(long howbig) {
+	return howbig > 0 ? (long)(Simulator.random32() % (unsigned long)howbig) : 0;
+}
+
+long random(long howsmall, long howbig) {
+	return howsmall >= howbig ? howsmall : howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+	Simulator.seed(seed);
+}
+
+/*
+ * SPI bus to the node's radio
+ */
+
+uint8_t SPIClass::transfer(uint8_t data) {
+	Simulator.advance(SIM_SPI_BYTE_US);
+	SimNode *n = Simulator.current();
+	return n ? n->radio.transfer(data, n->clock) : 0xFF;
+}
+
+/*
+ * EEPROM. The write cycle runs in the background, the next access waits for it.
+ */
+
+static uint8_t *eeprom(const void *addr) {
+	SimNode *n = Simulator.current();
+	size_t a = (size_t)addr;
+	if (n == NULL || a >= SIM_EEPROM_SIZE) {
+		static uint8_t dummy;
+		return &dummy;
+	}
+	if (n->eepromReadyAt > n->clock) {
+		Simulator.advance(n->eepromReadyAt - n->clock);
+	}
+	return &n->eeprom[a];
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr) {
+	return *eeprom(addr);
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value) {
+	*eeprom(addr) = value;
+	SimNode *n = Simulator.current();
+	if (n) {
+		n->eepromReadyAt = n->clock + SIM_EEPROM_WRITE_US;
+		n->eepromWrites++;
+	}
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value) {
+	if (eeprom_read_byte(addr) != value) {
+		eeprom_write_byte(addr, value);
+	}
+}
+
+void eeprom_read_block(void *dst, const void *addr, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		((uint8_t *)dst)[i] = eeprom_read_byte((const uint8_t *)addr + i);
+	}
+}
+
+void eeprom_write_block(const void *src, void *addr, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		eeprom_write_byte((uint8_t *)addr + i, ((const uint8_t *)src)[i]);
+	}
+}
+
+void eeprom_update_block(const void *src, void *addr, size_t n) {
+	for (size_t i = 0; i < n; i++) {
+		eeprom_update_byte((uint8_t *)addr + i, ((const uint8_t *)src)[i]);
+	}
+}
+
+bool eeprom_is_ready(void) {
+	SimNode *n = Simulator.current();
+	return n == NULL || n->eepromReadyAt <= n->clock;
+}
+
+/*
+ * Watchdog. Arming it is how the library reboots; the node just stops.
+ */
+
+void wdt_enable(uint8_t timeout) {
+	(void)timeout;
+	Simulator.halt();
+}
+
+void wdt_disable(void) {
+}
+
+void wdt_reset(void) {
+}
+
+/*
+ * Power down. The watchdog periods are the real 128kHz WDT intervals, scaled
+ * by the node's oscillator error (Simulator.setWdtError()).
+ */
+
+static const uint32_t wdtPeriodMs[] = { 16, 32, 64, 125, 250, 500, 1000, 2000, 4000, 8000 };
+
+void LowPowerClass::powerDown(period_t period, adc_t adc, bod_t bod) {
+	(void)adc; (void)bod;
+	SimNode *n = Simulator.current();
+	if (n == NULL) {
+		return;
+	}
+	if (period == SLEEP_FOREVER) {
+		// Only an external interrupt could wake us, and nothing drives the pins
+		Simulator.advance(SIM_FOREVER);
+		return;
+	}
+	uint64_t us = (uint64_t)(wdtPeriodMs[period] * 1000 * n->wdtScale);
+	n->slept += us;
+	Simulator.advance(us);
+}
+
+unsigned long LowPowerClass::wdtMicros(period_t period) {
+	SimNode *n = Simulator.current();
+	if (n == NULL || period == SLEEP_FOREVER) {
+		return 0;
+	}
+	// Busy wait, awake, so the time shows up in micros()
+	uint64_t us = (uint64_t)(wdtPeriodMs[period] * 1000 * n->wdtScale);
+	Simulator.advance(us);
+	return us;
+}
+
+void LowPowerClass::idle(period_t period, adc_t adc, timer2_t timer2, timer1_t timer1, timer0_t timer0,
+		spi_t spi, usart0_t usart0, twi_t twi) {
+	(void)adc; (void)timer2; (void)timer1; (void)spi; (void)usart0; (void)twi;
+	SimNode *n = Simulator.current();
+	if (n == NULL) {
+		return;
+	}
+	// Any interrupt wakes the CPU. With timer0 running that includes the
+	// millis() overflow interrupt every 1024us.
+	uint64_t us = period == SLEEP_FOREVER ? SIM_FOREVER : (uint64_t)wdtPeriodMs[period] * 1000;
+	if (timer0 == TIMER0_ON) {
+		uint64_t tick = 1024 - (n->clock - n->slept) % 1024;
+		if (tick < us) {
+			us = tick;
+		}
+	}
+	Simulator.idle(us);
+}
+
+void LowPowerClass::powerSave(period_t period, adc_t adc, bod_t bod, timer2_t timer2) {
+	(void)timer2;
+	powerDown(period, adc, bod);
+}
+
+void LowPowerClass::powerStandby(period_t period, adc_t adc, bod_t bod) {
+	powerDown(period, adc, bod);
+}
+
+void LowPowerClass::powerExtStandby(period_t period, adc_t adc, bod_t bod, timer2_t timer2) {
+	(void)timer2;
+	powerDown(period, adc, bod);
+}
+
+void LowPowerClass::adcNoiseReduction(period_t period, adc_t adc, timer2_t timer2) {
+	(void)timer2;
+	powerDown(period, adc, BOD_ON);
+}
+
+/*
+ * MsTimer2 only drives the gateway status leds, which nobody sees here
+ */
+
+namespace MsTimer2 {
+	unsigned long msecs;
+	void (*func)();
+	volatile unsigned long count;
+	volatile char overflowing;
+	volatile unsigned int tcnt2;
+
+	void set(unsigned long ms, void (*f)()) {
+		msecs = ms;
+		func = f;
+	}
+	void start() {}
+	void stop() {}
+	void _overflow() {}
+}
+
+/*
+ * Serial
+ */
+
+void HardwareSerial::begin(unsigned long baud) {
+	SimNode *n = Simulator.current();
+	if (n) {
+		n->baud = baud;
+	}
+}
+
+int HardwareSerial::available(void) {
+	SimNode *n = Simulator.current();
+	if (n == NULL) {
+		return 0;
+	}
+	// Only what has come in over the line so far
+	int count = 0;
+	for (std::deque<SimSerialByte>::iterator i = n->serialInput.begin(); i != n->serialInput.end() && i->at <= n->clock; ++i) {
+		count++;
+	}
+	return count;
+}
+
+int HardwareSerial::peek(void) {
+	SimNode *n = Simulator.current();
+	if (n == NULL || n->serialInput.empty() || n->serialInput.front().at > n->clock) {
+		return -1;
+	}
+	return n->serialInput.front().c;
+}
+
+int HardwareSerial::read(void) {
+	int c = peek();
+	if (c >= 0) {
+		Simulator.current()->serialInput.pop_front();
+	}
+	return c;
+}
+
+void HardwareSerial::flush(void) {
+	Simulator.serialFlush();
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+	Simulator.serialWrite(&c, 1);
+	return 1;
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size) {
+	Simulator.serialWrite(buffer, size);
+	return size;
+}
+
+size_t HardwareSerial::print(const char *str) {
+	return write((const uint8_t *)str, strlen(str));
+}
+
+size_t HardwareSerial::print(const __FlashStringHelper *str) {
+	return print((const char *)str);
+}
+
+size_t HardwareSerial::print(char c) {
+	return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(long n, int base) {
+	char buf[34];
+	return print(ltoa(n, buf, base));
+}
+
+size_t HardwareSerial::print(unsigned long n, int base) {
+	char buf[34];
+	return print(ultoa(n, buf, base));
+}
+
+size_t HardwareSerial::print(double n, int digits) {
+	char buf[34];
+	return print(dtostrf(n, 1, digits, buf));
+}
+
+size_t HardwareSerial::println(void) {
+	return print("\r\n");
+}
+
+/*
+ * Heap bounds of avr-libc's malloc(), what free RAM estimates go by. A node's
+ * heap ends where its stack may not grow into (set by Sim::run()).
+ */
+
+int __heap_start;
+int *__brkval;
+
+/*
+ * avr-libc conversions
+ */
+
+char *ultoa(unsigned long value, char *buffer, int radix) {
+	char tmp[34];
+	int i = 0;
+	do {
+		uint8_t d = value % radix;
+		tmp[i++] = d < 10 ? '0' + d : 'a' + d - 10;
+		value /= radix;
+	} while (value);
+	for (int j = 0; j < i; j++) {
+		buffer[j] = tmp[i - j - 1];
+	}
+	buffer[i] = '\0';
+	return buffer;
+}
+
+char *ltoa(long value, char *buffer, int radix) {
+	if (value < 0 && radix == 10) {
+		buffer[0] = '-';
+		ultoa(-(unsigned long)value, buffer + 1, radix);
+		return buffer;
+	}
+	return ultoa((unsigned long)value, buffer, radix);
+}
+
+char *itoa(int value, char *buffer, int radix) {
+	// AVR int is 16 bit
+	if (radix != 10) {
+		return ultoa((uint16_t)value, buffer, radix);
+	}
+	return ltoa((int16_t)value, buffer, radix);
+}
+
+char *utoa(unsigned int value, char *buffer, int radix) {
+	return ultoa((uint16_t)value, buffer, radix);
+}
+
+char *dtostrf(double value, signed char width, unsigned char prec, char *buffer) {
+	sprintf(buffer, "%*.*f", width, prec, value);
+	return buffer;
+}
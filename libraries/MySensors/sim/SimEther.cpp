@@ -0,0 +1,149 @@
+/*
+ Shared radio medium for the MySensors simulator.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "SimEther.h"
+#include "Sim.h"
+
+// Longest frame: 32 byte payload at 250kbps is just over 1.4ms
+#define AIR_HISTORY_US 5000
+
+SimEther Ether;
+
+SimEther::SimEther() : defaultLoss(0), collisionModel(SIM_COLLIDE_CHANNEL) {
+	resetCounters();
+}
+
+void SimEther::add(SimRadio *radio) {
+	radios.push_back(radio);
+	if (!links.empty()) {
+		// Keep the matrix square, the new radio starts out of everyone's range
+		size_t n = radios.size();
+		std::vector<float> grown(n * n, -1.0f);
+		for (size_t a = 0; a + 1 < n; a++) {
+			for (size_t b = 0; b + 1 < n; b++) {
+				grown[a * n + b] = links[a * (n - 1) + b];
+			}
+		}
+		links.swap(grown);
+	}
+}
+
+void SimEther::clear() {
+	radios.clear();
+	air.clear();
+	links.clear();
+	resetCounters();
+}
+
+void SimEther::resetCounters() {
+	frames = collisions = dropped = acksLost = deliveries = 0;
+}
+
+void SimEther::setLossRate(float loss) {
+	defaultLoss = loss;
+}
+
+void SimEther::isolate() {
+	links.assign(radios.size() * radios.size(), -1.0f);
+}
+
+void SimEther::link(uint16_t a, uint16_t b, float loss) {
+	if (links.empty()) {
+		isolate();
+	}
+	size_t n = radios.size();
+	if (a < n && b < n) {
+		links[a * n + b] = loss;
+		links[b * n + a] = loss;
+	}
+}
+
+void SimEther::unlink(uint16_t a, uint16_t b) {
+	link(a, b, -1.0f);
+}
+
+float SimEther::lossRate(uint16_t from, uint16_t to) const {
+	if (links.empty()) {
+		return defaultLoss;
+	}
+	size_t n = radios.size();
+	return (from < n && to < n) ? links[from * n + to] : -1.0f;
+}
+
+bool SimEther::inRange(uint16_t from, uint16_t to) const {
+	return lossRate(from, to) >= 0;
+}
+
+bool SimEther::chance(float p) {
+	return p > 0 && (Simulator.random32() % 1000000) < (uint32_t)(p * 1000000);
+}
+
+bool SimEther::overlaps(const SimFrame &frame, int32_t receiver) {
+	// Frames are handed in when they end, and the simulator keeps all nodes
+	// within a small time window of each other, so the history is nearly ordered.
+	for (std::deque<SimFrame>::iterator f = air.begin(); f != air.end(); ++f) {
+		if (f->channel == frame.channel && f->from != frame.from &&
+				f->start < frame.end && frame.start < f->end &&
+				(receiver < 0 || inRange(f->from, receiver))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SimEther::transmit(SimRadio &from, const SimFrame &frame) {
+	frames++;
+	while (!air.empty() && air.front().end + AIR_HISTORY_US < frame.start) {
+		air.pop_front();
+	}
+	bool lost = collisionModel == SIM_COLLIDE_CHANNEL && overlaps(frame, -1);
+	air.push_back(frame);
+	if (lost) {
+		collisions++;
+	}
+
+	bool acked = false;
+	uint8_t received = 0;
+	for (std::vector<SimRadio *>::iterator r = radios.begin(); !lost && r != radios.end(); ++r) {
+		SimRadio *radio = *r;
+		uint16_t to = radio->node();
+		if (radio == &from || radio->channel() != frame.channel || !radio->isListening() ||
+				!inRange(frame.from, to)) {
+			continue;
+		}
+		int8_t pipe = radio->matchPipe(frame.address);
+		if (pipe < 0) {
+			continue;
+		}
+		if (collisionModel == SIM_COLLIDE_RECEIVER && overlaps(frame, to)) {
+			collisions++;
+			continue;
+		}
+		float loss = lossRate(frame.from, to);
+		if (chance(loss)) {
+			dropped++;
+			continue;
+		}
+		uint32_t before = radio->framesReceived;
+		if (radio->deliver(frame, pipe, loss <= SIM_STRONG_LINK_LOSS)) {
+			if (chance(loss)) {
+				acksLost++;
+			} else {
+				acked = true;
+			}
+		}
+		if (radio->framesReceived != before) {
+			deliveries++;
+			received++;
+		}
+	}
+	if (watch) {
+		watch(frame, received);
+	}
+	return acked;
+}
@@ -0,0 +1,84 @@
+/*
+ Shared radio medium for the MySensors simulator.
+
+ Every simulated nRF24L01+ registers here. A frame reaches each listening
+ radio on the same channel that is in range of the sender and has a pipe
+ open on the frame address. By default every radio hears every other one;
+ isolate() and link() build a topology instead. Each link drops frames and
+ acks independently with its loss rate, and overlapping frames collide
+ according to the selected collision model.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef SimEther_h
+#define SimEther_h
+
+#include "SimRadio.h"
+#include <vector>
+#include <deque>
+#include <functional>
+
+typedef enum {
+	SIM_COLLIDE_NONE,      // Ideal medium, overlapping frames all get through
+	SIM_COLLIDE_CHANNEL,   // Any overlap on the channel destroys the later frame everywhere
+	SIM_COLLIDE_RECEIVER   // Overlap only destroys a frame at receivers in range of both senders (hidden terminals)
+} sim_collisions;
+
+// Links at or below this loss rate count as strong (RPD set, > -64dBm)
+#define SIM_STRONG_LINK_LOSS 0.1f
+
+class SimEther
+{
+  public:
+	SimEther();
+
+	void add(SimRadio *radio);
+	void clear();
+
+	/**
+	 * Link model. Until isolate() is called every radio is in range of every
+	 * other one with the default loss rate.
+	 */
+	void setLossRate(float loss);
+	void setCollisions(sim_collisions model) { collisionModel = model; }
+	void isolate();
+	void link(uint16_t a, uint16_t b, float loss=0);
+	void unlink(uint16_t a, uint16_t b);
+	bool inRange(uint16_t from, uint16_t to) const;
+	float lossRate(uint16_t from, uint16_t to) const;
+
+	// Called for every frame put on the air, with the number of radios that stored it
+	void setObserver(std::function<void(const SimFrame &, uint8_t received)> observer) { watch = observer; }
+	void resetCounters();
+
+	/**
+	 * Put a frame on the air. Called by the transmitting radio once the last
+	 * bit has gone out.
+	 * @return true if a receiver auto-acked it.
+	 */
+	bool transmit(SimRadio &from, const SimFrame &frame);
+
+	uint32_t frames;      // Frames put on the air, retransmits included
+	uint32_t collisions;  // Frames lost to an overlapping transmission (per receiver for SIM_COLLIDE_RECEIVER)
+	uint32_t dropped;     // Frames lost to link loss (per receiver)
+	uint32_t acksLost;    // Acks lost to link loss
+	uint32_t deliveries;  // Frames stored in some receiver's RX FIFO
+
+  private:
+	std::vector<SimRadio *> radios;
+	std::deque<SimFrame> air; // Recent frames, kept for collision detection
+	std::vector<float> links; // N x N loss rates, negative means out of range. Empty until isolate().
+	float defaultLoss;
+	sim_collisions collisionModel;
+	std::function<void(const SimFrame &, uint8_t)> watch;
+
+	bool chance(float p);
+	bool overlaps(const SimFrame &frame, int32_t receiver);
+};
+
+extern SimEther Ether;
+
+#endif
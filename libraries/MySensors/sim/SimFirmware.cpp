@@ -0,0 +1,190 @@
+/*
+ Controller side of over the air firmware updates for the MySensors simulator.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "SimFirmware.h"
+#include <MyMessage.h>
+#include <MySensor.h>
+#include <util/crc16.h>
+#include <stdio.h>
+#include <string.h>
+
+SimFirmware::SimFirmware() : configRequests(0), blockRequests(0), blocksSent(0), type(1), version(1) {
+}
+
+static int hexValue(char c) {
+	if (c >= '0' && c <= '9') {
+		return c - '0';
+	} else if (c >= 'a' && c <= 'f') {
+		return c - 'a' + 10;
+	} else if (c >= 'A' && c <= 'F') {
+		return c - 'A' + 10;
+	}
+	return -1;
+}
+
+// Decode pairs of hex digits, false on anything else
+static bool hexBytes(const char *s, size_t digits, std::vector<uint8_t> &bytes) {
+	if (digits & 1) {
+		return false;
+	}
+	bytes.clear();
+	for (size_t i = 0; i < digits; i += 2) {
+		int hi = hexValue(s[i]), lo = hexValue(s[i + 1]);
+		if (hi < 0 || lo < 0) {
+			return false;
+		}
+		bytes.push_back(hi << 4 | lo);
+	}
+	return true;
+}
+
+bool SimFirmware::loadHex(const char *path) {
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		perror(path);
+		return false;
+	}
+	data.clear();
+	uint32_t base = 0;
+	unsigned lineNo = 0;
+	bool ok = true, end = false;
+	char line[600];
+	while (!end && fgets(line, sizeof(line), f)) {
+		lineNo++;
+		size_t length = strcspn(line, "\r\n");
+		if (length == 0) {
+			continue;
+		}
+		std::vector<uint8_t> r;
+		// :LLAAAATT, LL data bytes, checksum
+		if (line[0] != ':' || !hexBytes(line + 1, length - 1, r) || r.size() < 5 || r.size() != (size_t)r[0] + 5) {
+			ok = false;
+			break;
+		}
+		uint8_t sum = 0;
+		for (size_t i = 0; i < r.size(); i++) {
+			sum += r[i];
+		}
+		if (sum != 0) {
+			ok = false;
+			break;
+		}
+		uint32_t address = base + (r[1] << 8 | r[2]);
+		switch (r[3]) {
+			case 0x00: // Data
+				if (data.size() < address + r[0]) {
+					data.resize(address + r[0], 0xFF);
+				}
+				memcpy(&data[address], &r[4], r[0]);
+				break;
+			case 0x01: // End of file
+				end = true;
+				break;
+			case 0x02: // Extended segment address
+				base = (uint32_t)(r[4] << 8 | r[5]) << 4;
+				break;
+			case 0x04: // Extended linear address
+				base = (uint32_t)(r[4] << 8 | r[5]) << 16;
+				break;
+			default: // Start addresses, not needed for an image
+				break;
+		}
+	}
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "%s:%u: bad record\n", path, lineNo);
+		return false;
+	}
+	if (data.size() > (size_t)0xFFFF * FIRMWARE_BLOCK_SIZE) {
+		fprintf(stderr, "%s: image too large\n", path);
+		return false;
+	}
+	data.resize((data.size() + FIRMWARE_BLOCK_SIZE - 1) / FIRMWARE_BLOCK_SIZE * FIRMWARE_BLOCK_SIZE, 0xFF);
+	return true;
+}
+
+void SimFirmware::generate(size_t size, uint32_t seed) {
+	data.resize((size + FIRMWARE_BLOCK_SIZE - 1) / FIRMWARE_BLOCK_SIZE * FIRMWARE_BLOCK_SIZE);
+	uint32_t x = seed ? seed : 1;
+	for (size_t i = 0; i < data.size(); i++) {
+		x ^= x << 13;
+		x ^= x >> 17;
+		x ^= x << 5;
+		data[i] = i < size ? (uint8_t)x : 0xFF;
+	}
+}
+
+void SimFirmware::setVersion(uint16_t _type, uint16_t _version) {
+	type = _type;
+	version = _version;
+}
+
+FirmwareConfig SimFirmware::config() const {
+	FirmwareConfig c;
+	c.type = type;
+	c.version = version;
+	c.blocks = data.size() / FIRMWARE_BLOCK_SIZE;
+	c.crc = 0xFFFF;
+	for (size_t i = 0; i < data.size(); i++) {
+		c.crc = _crc16_update(c.crc, data[i]);
+	}
+	return c;
+}
+
+bool SimFirmware::answer(const char *line, std::string &reply) {
+	unsigned int sender, sensor, command, ack, streamType;
+	int payloadAt = 0;
+	if (sscanf(line, "%u;%u;%u;%u;%u;%n", &sender, &sensor, &command, &ack, &streamType, &payloadAt) != 5 ||
+			payloadAt == 0 || command != C_STREAM) {
+		return false;
+	}
+	std::vector<uint8_t> payload;
+	if (!hexBytes(line + payloadAt, strlen(line + payloadAt), payload)) {
+		return false;
+	}
+	if (streamType == ST_FIRMWARE_CONFIG_REQUEST && payload.size() == sizeof(FirmwareConfig)) {
+		configRequests++;
+		FirmwareConfig c = config();
+		appendLine(reply, sender, ST_FIRMWARE_CONFIG_RESPONSE, &c, sizeof(c));
+		return true;
+	} else if (streamType == ST_FIRMWARE_REQUEST && payload.size() == sizeof(FirmwareRequest)) {
+		blockRequests++;
+		FirmwareRequest r;
+		memcpy(&r, &payload[0], sizeof(r));
+		if (r.type != type || r.version != version) {
+			// Asking for an image we no longer have, tell it what to fetch instead
+			FirmwareConfig c = config();
+			appendLine(reply, sender, ST_FIRMWARE_CONFIG_RESPONSE, &c, sizeof(c));
+			return true;
+		}
+		FirmwareBlock b;
+		b.type = type;
+		b.version = version;
+		for (uint16_t i = 0; i < r.count && (size_t)(r.block + i) * FIRMWARE_BLOCK_SIZE < data.size(); i++) {
+			b.block = r.block + i;
+			memcpy(b.data, &data[(size_t)b.block * FIRMWARE_BLOCK_SIZE], FIRMWARE_BLOCK_SIZE);
+			appendLine(reply, sender, ST_FIRMWARE_RESPONSE, &b, sizeof(b));
+			blocksSent++;
+		}
+		return true;
+	}
+	return false;
+}
+
+void SimFirmware::appendLine(std::string &reply, uint8_t node, uint8_t streamType, const void *payload, uint8_t length) {
+	char head[32];
+	snprintf(head, sizeof(head), "%u;%u;%u;0;%u;", node, NODE_SENSOR_ID, C_STREAM, streamType);
+	reply += head;
+	const uint8_t *p = (const uint8_t *)payload;
+	for (uint8_t i = 0; i < length; i++) {
+		static const char digits[] = "0123456789ABCDEF";
+		reply += digits[p[i] >> 4];
+		reply += digits[p[i] & 0x0F];
+	}
+	reply += '\n';
+}
@@ -0,0 +1,62 @@
+/*
+ Controller side of over the air firmware updates for the MySensors simulator.
+
+ Holds one firmware image, loaded from an Intel HEX file as produced by the
+ Arduino build or made up of random bytes, and answers the ST_FIRMWARE_*
+ requests nodes send through the gateway's serial port, the way a controller
+ would. Replies are text command lines to feed back into the gateway.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef SimFirmware_h
+#define SimFirmware_h
+
+#include <MyFirmware.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class SimFirmware
+{
+  public:
+	SimFirmware();
+
+	/**
+	 * Load the image from an Intel HEX file. Gaps and the end are padded
+	 * with 0xFF to whole blocks. Returns false (and prints why) if the file
+	 * cannot be read or a record is broken.
+	 */
+	bool loadHex(const char *path);
+
+	// Use size random bytes as the image
+	void generate(size_t size, uint32_t seed);
+
+	// Type and version the image is served as
+	void setVersion(uint16_t type, uint16_t version);
+
+	FirmwareConfig config() const;
+	const std::vector<uint8_t> &image() const { return data; }
+
+	/**
+	 * Handle one line from the gateway's serial port. Firmware requests get
+	 * their replies appended to reply, one command line each; everything
+	 * else is ignored. Returns true if the line was a firmware request.
+	 */
+	bool answer(const char *line, std::string &reply);
+
+	uint32_t configRequests;
+	uint32_t blockRequests;
+	uint32_t blocksSent;
+
+  private:
+	std::vector<uint8_t> data;
+	uint16_t type;
+	uint16_t version;
+
+	void appendLine(std::string &reply, uint8_t node, uint8_t streamType, const void *payload, uint8_t length);
+};
+
+#endif
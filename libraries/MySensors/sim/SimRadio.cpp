@@ -0,0 +1,361 @@
+/*
+ Register level model of the nRF24L01+ used by the MySensors simulator.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "SimRadio.h"
+#include "SimEther.h"
+#include "../utility/nRF24L01.h"
+#include <string.h>
+
+#define BIT(n) (1 << (n))
+#define IRQ_FLAGS (BIT(RX_DR) | BIT(TX_DS) | BIT(MAX_RT))
+
+SimRadio::SimRadio() : nodeIndex(0) {
+	reset();
+}
+
+void SimRadio::attach(uint16_t node) {
+	nodeIndex = node;
+}
+
+void SimRadio::reset() {
+	// Power on reset values from the data sheet
+	memset(reg, 0, sizeof(reg));
+	reg[CONFIG] = BIT(EN_CRC);
+	reg[EN_AA] = 0x3F;
+	reg[EN_RXADDR] = BIT(ERX_P0) | BIT(ERX_P1);
+	reg[SETUP_AW] = 0x03;
+	reg[SETUP_RETR] = 0x03;
+	reg[RF_CH] = 0x02;
+	reg[RF_SETUP] = 0x0E;
+	reg[RX_ADDR_P2] = 0xC3;
+	reg[RX_ADDR_P3] = 0xC4;
+	reg[RX_ADDR_P4] = 0xC5;
+	reg[RX_ADDR_P5] = 0xC6;
+	memset(rxAddrP0, 0xE7, SIM_ADDR_WIDTH);
+	memset(rxAddrP1, 0xC2, SIM_ADDR_WIDTH);
+	memset(txAddr, 0xE7, SIM_ADDR_WIDTH);
+	memset(lastRxId, 0, sizeof(lastRxId));
+	flags = plos = arc = 0;
+	reuse = false;
+	tx.clear();
+	rx.clear();
+	nextId = 0;
+	selected = false;
+	command = NOP;
+	position = 0;
+	ceHigh = false;
+	ceAt = txFreeAt = txAt = 0;
+	txState = TX_IDLE;
+	retries = 0;
+	framesSent = payloadsSent = payloadsFailed = framesReceived = rxOverflows = 0;
+}
+
+bool SimRadio::powered() const {
+	return reg[CONFIG] & BIT(PWR_UP);
+}
+
+bool SimRadio::isListening() const {
+	return powered() && ceHigh && (reg[CONFIG] & BIT(PRIM_RX));
+}
+
+uint8_t SimRadio::channel() const {
+	return reg[RF_CH];
+}
+
+bool SimRadio::busy() const {
+	return txState != TX_IDLE || canTransmit();
+}
+
+bool SimRadio::irq() const {
+	// CONFIG holds the MASK_* bits at the same positions as the STATUS flags
+	return flags & ~reg[CONFIG] & IRQ_FLAGS;
+}
+
+uint8_t SimRadio::status() const {
+	uint8_t pipe = rx.empty() ? 0x07 : rx.front().pipe;
+	return flags | (pipe << RX_P_NO) | (tx.full() ? BIT(TX_FULL) : 0);
+}
+
+uint8_t SimRadio::fifoStatus() const {
+	return (reuse ? BIT(TX_REUSE) : 0) |
+			(tx.full() ? BIT(FIFO_FULL) : 0) |
+			(tx.empty() ? BIT(TX_EMPTY) : 0) |
+			(rx.full() ? BIT(RX_FULL) : 0) |
+			(rx.empty() ? BIT(RX_EMPTY) : 0);
+}
+
+uint32_t SimRadio::airtime(uint8_t length) const {
+	uint8_t crc = (reg[CONFIG] & BIT(EN_CRC)) ? ((reg[CONFIG] & BIT(CRCO)) ? 2 : 1) : 0;
+	// Preamble, address, 9 bit packet control field, payload and CRC
+	uint32_t bits = 8 * (1 + SIM_ADDR_WIDTH + length + crc) + 9;
+	if (reg[RF_SETUP] & BIT(RF_DR_LOW)) {
+		return bits * 4;        // 250kbps
+	} else if (reg[RF_SETUP] & BIT(RF_DR_HIGH)) {
+		return (bits + 1) / 2;  // 2Mbps
+	}
+	return bits;                // 1Mbps
+}
+
+uint32_t SimRadio::retryDelay() const {
+	return ((reg[SETUP_RETR] >> ARD) + 1) * 250UL;
+}
+
+bool SimRadio::canTransmit() const {
+	return powered() && ceHigh && !(reg[CONFIG] & BIT(PRIM_RX)) && !tx.empty() && !(flags & BIT(MAX_RT));
+}
+
+uint8_t SimRadio::readRegister(uint8_t r, uint8_t index) const {
+	switch (r) {
+		case STATUS: return status();
+		case FIFO_STATUS: return fifoStatus();
+		case OBSERVE_TX: return (plos << PLOS_CNT) | (arc << ARC_CNT);
+		case RX_ADDR_P0: return index < SIM_ADDR_WIDTH ? rxAddrP0[index] : 0;
+		case RX_ADDR_P1: return index < SIM_ADDR_WIDTH ? rxAddrP1[index] : 0;
+		case TX_ADDR: return index < SIM_ADDR_WIDTH ? txAddr[index] : 0;
+		default: return r < sizeof(reg) ? reg[r] : 0;
+	}
+}
+
+void SimRadio::writeRegister(uint8_t r, const uint8_t *data, uint8_t length) {
+	if (length == 0) {
+		return;
+	}
+	switch (r) {
+		case STATUS:
+			flags &= ~(data[0] & IRQ_FLAGS);
+			break;
+		case FIFO_STATUS:
+		case OBSERVE_TX:
+		case RPD:
+			break;
+		case RX_ADDR_P0:
+			memcpy(rxAddrP0, data, length < SIM_ADDR_WIDTH ? length : SIM_ADDR_WIDTH);
+			break;
+		case RX_ADDR_P1:
+			memcpy(rxAddrP1, data, length < SIM_ADDR_WIDTH ? length : SIM_ADDR_WIDTH);
+			break;
+		case TX_ADDR:
+			memcpy(txAddr, data, length < SIM_ADDR_WIDTH ? length : SIM_ADDR_WIDTH);
+			break;
+		case RF_CH:
+			// Writing RF_CH resets the lost packet counter
+			plos = 0;
+			reg[r] = data[0] & 0x7F;
+			break;
+		default:
+			if (r < sizeof(reg)) {
+				reg[r] = data[0];
+			}
+	}
+}
+
+void SimRadio::csn(bool level) {
+	if (!level) {
+		selected = true;
+		position = 0;
+		command = NOP;
+	} else if (selected) {
+		endTransaction();
+		selected = false;
+	}
+}
+
+void SimRadio::ce(bool level, uint64_t now) {
+	update(now);
+	if (level && !ceHigh) {
+		ceAt = now;
+	}
+	ceHigh = level;
+}
+
+uint8_t SimRadio::transfer(uint8_t data, uint64_t now) {
+	update(now);
+	if (!selected) {
+		return 0xFF;
+	}
+	if (position == 0) {
+		// Command byte. The chip always shifts out STATUS while it arrives.
+		uint8_t s = status();
+		command = data;
+		position = 1;
+		if (command == FLUSH_TX) {
+			tx.clear();
+			reuse = false;
+			txState = TX_IDLE;
+		} else if (command == FLUSH_RX) {
+			rx.clear();
+		} else if (command == REUSE_TX_PL) {
+			reuse = true;
+		}
+		return s;
+	}
+
+	uint8_t index = position - 1;
+	if (position <= SIM_PAYLOAD_SIZE) {
+		position++;
+	}
+	if (command == R_RX_PAYLOAD) {
+		return (!rx.empty() && index < rx.front().length) ? rx.front().data[index] : 0;
+	} else if (command == R_RX_PL_WID) {
+		return rx.empty() ? 0 : rx.front().length;
+	} else if ((command & ~REGISTER_MASK) == R_REGISTER) {
+		return readRegister(command & REGISTER_MASK, index);
+	}
+	// Everything else shifts data into the chip
+	if (index < SIM_PAYLOAD_SIZE) {
+		buffer[index] = data;
+	}
+	return 0;
+}
+
+void SimRadio::endTransaction() {
+	uint8_t length = position > 0 ? position - 1 : 0;
+	if (length > SIM_PAYLOAD_SIZE) {
+		length = SIM_PAYLOAD_SIZE;
+	}
+	if ((command & ~REGISTER_MASK) == W_REGISTER) {
+		writeRegister(command & REGISTER_MASK, buffer, length);
+	} else if (command == R_RX_PAYLOAD) {
+		if (!rx.empty()) {
+			rx.pop();
+		}
+	} else if (command == W_TX_PAYLOAD || command == W_TX_PAYLOAD_NO_ACK) {
+		if (!tx.full() && length > 0) {
+			Entry &e = tx.push();
+			memcpy(e.data, buffer, length);
+			e.length = length;
+			e.noAck = command == W_TX_PAYLOAD_NO_ACK;
+			e.id = ++nextId;
+			reuse = false;
+		}
+	}
+	// ACTIVATE, W_ACK_PAYLOAD and NOP carry nothing the model keeps
+}
+
+void SimRadio::update(uint64_t now) {
+	for (;;) {
+		if (txState == TX_IDLE) {
+			if (!canTransmit()) {
+				return;
+			}
+			// Leave standby, settle the PLL and go on air
+			txAt = (ceAt > txFreeAt ? ceAt : txFreeAt) + SIM_SETTLE_US;
+			retries = 0;
+			txState = TX_AIR;
+		}
+		if (tx.empty()) {
+			// FLUSH_TX while a payload was pending
+			txState = TX_IDLE;
+			return;
+		}
+		if (txState == TX_RETRY) {
+			if (now < txAt) {
+				return;
+			}
+			txState = TX_AIR;
+		}
+		const Entry &e = tx.front();
+		if (txState == TX_AIR) {
+			uint64_t end = txAt + airtime(e.length);
+			if (now < end) {
+				return;
+			}
+			frame.from = nodeIndex;
+			frame.id = ((uint32_t)nodeIndex << 20) ^ e.id;
+			frame.channel = channel();
+			memcpy(frame.address, txAddr, SIM_ADDR_WIDTH);
+			memcpy(frame.payload, e.data, e.length);
+			frame.length = e.length;
+			frame.noAck = e.noAck;
+			frame.start = txAt;
+			frame.end = end;
+			framesSent++;
+			bool acked = Ether.transmit(*this, frame);
+			if (e.noAck) {
+				txAt = end;
+				txState = TX_ACK;
+			} else if (acked) {
+				// Turn around and receive the empty ack packet
+				txAt = end + SIM_SETTLE_US + airtime(0);
+				txState = TX_ACK;
+			} else if (retries < (reg[SETUP_RETR] & 0x0F)) {
+				retries++;
+				txAt = end + retryDelay();
+				txState = TX_RETRY;
+			} else {
+				// Give up. The payload stays in the FIFO until flushed.
+				if (plos < 15) {
+					plos++;
+				}
+				arc = retries;
+				flags |= BIT(MAX_RT);
+				payloadsFailed++;
+				txFreeAt = end + retryDelay();
+				txState = TX_IDLE;
+			}
+			continue;
+		}
+		// TX_ACK
+		if (now < txAt) {
+			return;
+		}
+		arc = retries;
+		flags |= BIT(TX_DS);
+		payloadsSent++;
+		if (!reuse) {
+			tx.pop();
+		}
+		txFreeAt = txAt;
+		txState = TX_IDLE;
+	}
+}
+
+int8_t SimRadio::matchPipe(const uint8_t *address) const {
+	// Identical addresses on several pipes are left undefined by the data sheet.
+	// MySensors opens pipe 0 and 1 on the node address and relies on relayed
+	// traffic showing up on pipe 1, so the highest matching pipe wins.
+	for (int8_t pipe = 5; pipe >= 0; pipe--) {
+		if (!(reg[EN_RXADDR] & BIT(pipe))) {
+			continue;
+		}
+		if (pipe == 0) {
+			if (memcmp(address, rxAddrP0, SIM_ADDR_WIDTH) == 0) {
+				return pipe;
+			}
+		} else if (memcmp(address + 1, rxAddrP1 + 1, SIM_ADDR_WIDTH - 1) == 0) {
+			uint8_t lsb = pipe == 1 ? rxAddrP1[0] : reg[RX_ADDR_P0 + pipe];
+			if (address[0] == lsb) {
+				return pipe;
+			}
+		}
+	}
+	return -1;
+}
+
+bool SimRadio::deliver(const SimFrame &f, uint8_t pipe, bool strong) {
+	bool autoAck = !f.noAck && (reg[EN_AA] & BIT(pipe));
+	reg[RPD] = strong ? 1 : 0;
+	if (autoAck && f.id == lastRxId[pipe]) {
+		// Retransmit of a payload whose ack got lost. Ack it again but drop it.
+		return true;
+	}
+	if (rx.full()) {
+		// No room: the chip neither stores nor acknowledges the packet
+		rxOverflows++;
+		return false;
+	}
+	Entry &e = rx.push();
+	memcpy(e.data, f.payload, f.length);
+	e.length = f.length;
+	e.pipe = pipe;
+	e.id = f.id;
+	lastRxId[pipe] = f.id;
+	flags |= BIT(RX_DR);
+	framesReceived++;
+	return autoAck;
+}
@@ -0,0 +1,130 @@
+/*
+ Register level model of the nRF24L01+ used by the MySensors simulator.
+
+ The unmodified RF24 driver talks to this model over the simulated SPI bus.
+ It implements the parts of the chip the driver touches: the register map,
+ the 3 deep TX/RX FIFOs, dynamic payloads, multiceiver pipe matching,
+ Enhanced ShockBurst auto-ack with ARD/ARC retransmits, MAX_RT, PLOS/ARC
+ observation and the IRQ line. Ack payloads are accepted but not sent.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef SimRadio_h
+#define SimRadio_h
+
+#include <stdint.h>
+
+#define SIM_FIFO_DEPTH 3
+#define SIM_PAYLOAD_SIZE 32
+#define SIM_ADDR_WIDTH 5
+#define SIM_SETTLE_US 130 // Standby to TX/RX settling time (Tstby2a)
+
+// A frame in the air
+struct SimFrame {
+	uint16_t from;                   // Index of transmitting node
+	uint32_t id;                     // Unique per payload, retransmits keep it (stands in for the ESB PID)
+	uint8_t channel;
+	uint8_t address[SIM_ADDR_WIDTH];
+	uint8_t payload[SIM_PAYLOAD_SIZE];
+	uint8_t length;
+	bool noAck;
+	uint64_t start;                  // Simulated time of first/last bit (us)
+	uint64_t end;
+};
+
+class SimRadio
+{
+  public:
+	SimRadio();
+
+	void reset();
+	void attach(uint16_t node);
+
+	/* MCU side */
+	void csn(bool level);
+	void ce(bool level, uint64_t now);
+	uint8_t transfer(uint8_t data, uint64_t now);
+	void update(uint64_t now);
+	bool busy() const;      // A transmission is queued or in progress
+	bool irq() const;       // IRQ pin asserted (the pin itself is active low)
+
+	/* Ether side */
+	uint16_t node() const { return nodeIndex; }
+	uint8_t channel() const;
+	bool isListening() const;
+	int8_t matchPipe(const uint8_t *address) const;
+	bool deliver(const SimFrame &frame, uint8_t pipe, bool strong);
+	uint32_t airtime(uint8_t length) const;
+
+	/* Counters, never cleared by the driver */
+	uint32_t framesSent;     // Every transmission attempt, retransmits included
+	uint32_t payloadsSent;   // Payloads that got TX_DS
+	uint32_t payloadsFailed; // Payloads that ended in MAX_RT
+	uint32_t framesReceived;
+	uint32_t rxOverflows;    // Frames dropped because the RX FIFO was full
+
+  private:
+	struct Entry {
+		uint8_t data[SIM_PAYLOAD_SIZE];
+		uint8_t length;
+		uint8_t pipe;   // RX FIFO: pipe the frame arrived on
+		bool noAck;     // TX FIFO: written with W_TX_PAYLOAD_NO_ACK
+		uint32_t id;
+	};
+	struct Fifo {
+		Entry entry[SIM_FIFO_DEPTH];
+		uint8_t head;
+		uint8_t count;
+		void clear() { head = count = 0; }
+		bool empty() const { return count == 0; }
+		bool full() const { return count == SIM_FIFO_DEPTH; }
+		Entry &front() { return entry[head]; }
+		const Entry &front() const { return entry[head]; }
+		Entry &push() { Entry &e = entry[(head + count) % SIM_FIFO_DEPTH]; count++; return e; }
+		void pop() { head = (head + 1) % SIM_FIFO_DEPTH; count--; }
+	};
+	enum TxState { TX_IDLE, TX_AIR, TX_RETRY, TX_ACK };
+
+	uint16_t nodeIndex;
+	uint8_t reg[0x20];
+	uint8_t rxAddrP0[SIM_ADDR_WIDTH];
+	uint8_t rxAddrP1[SIM_ADDR_WIDTH];
+	uint8_t txAddr[SIM_ADDR_WIDTH];
+	uint8_t flags;           // RX_DR, TX_DS, MAX_RT bits of STATUS
+	uint8_t plos;
+	uint8_t arc;
+	bool reuse;
+	Fifo tx;
+	Fifo rx;
+	uint32_t lastRxId[6];
+	uint32_t nextId;
+
+	// SPI transaction in progress
+	bool selected;
+	uint8_t command;
+	uint8_t position;
+	uint8_t buffer[SIM_PAYLOAD_SIZE];
+
+	// Transmitter state machine
+	bool ceHigh;
+	uint64_t ceAt;
+	uint64_t txFreeAt;
+	TxState txState;
+	uint64_t txAt;
+	uint8_t retries;
+	SimFrame frame;
+
+	uint8_t status() const;
+	uint8_t fifoStatus() const;
+	uint8_t readRegister(uint8_t r, uint8_t index) const;
+	void writeRegister(uint8_t r, const uint8_t *data, uint8_t length);
+	void endTransaction();
+	bool powered() const;
+	bool canTransmit() const;
+	uint32_t retryDelay() const;
+};
+
+#endif
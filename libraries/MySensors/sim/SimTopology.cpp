@@ -0,0 +1,143 @@
+/*
+ Network layouts for the MySensors simulator.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#include "SimTopology.h"
+#include "SimEther.h"
+#include <math.h>
+#include <deque>
+
+void SimTopology::begin(uint16_t nodes) {
+	edges.clear();
+	depth.assign(nodes, SIM_UNREACHABLE);
+	parent.assign(nodes, 0);
+	repeater.assign(nodes, false);
+}
+
+void SimTopology::connect(uint16_t a, uint16_t b, float loss) {
+	Edge e = { a, b, loss };
+	edges.push_back(e);
+}
+
+void SimTopology::finish() {
+	uint16_t n = size();
+	std::vector<std::vector<uint16_t> > adjacent(n);
+	for (size_t i = 0; i < edges.size(); i++) {
+		adjacent[edges[i].a].push_back(edges[i].b);
+		adjacent[edges[i].b].push_back(edges[i].a);
+	}
+	std::deque<uint16_t> queue;
+	depth[0] = 0;
+	queue.push_back(0);
+	while (!queue.empty()) {
+		uint16_t a = queue.front();
+		queue.pop_front();
+		for (size_t i = 0; i < adjacent[a].size(); i++) {
+			uint16_t b = adjacent[a][i];
+			if (depth[b] == SIM_UNREACHABLE && depth[a] + 1 < SIM_UNREACHABLE) {
+				depth[b] = depth[a] + 1;
+				parent[b] = a;
+				if (a != 0) {
+					repeater[a] = true;
+				}
+				queue.push_back(b);
+			}
+		}
+	}
+}
+
+uint8_t SimTopology::maxDepth() const {
+	uint8_t m = 0;
+	for (size_t i = 0; i < depth.size(); i++) {
+		if (depth[i] != SIM_UNREACHABLE && depth[i] > m) {
+			m = depth[i];
+		}
+	}
+	return m;
+}
+
+void SimTopology::star(uint16_t sensors) {
+	begin(sensors + 1);
+	for (uint16_t a = 0; a <= sensors; a++) {
+		for (uint16_t b = a + 1; b <= sensors; b++) {
+			connect(a, b);
+		}
+	}
+	finish();
+}
+
+void SimTopology::chain(uint16_t nodes) {
+	begin(nodes + 1);
+	for (uint16_t i = 1; i <= nodes; i++) {
+		connect(i - 1, i);
+	}
+	finish();
+}
+
+void SimTopology::tree(uint16_t nodes, uint8_t branch) {
+	begin(nodes + 1);
+	if (branch == 0) {
+		branch = 1;
+	}
+	for (uint16_t i = 1; i <= nodes; i++) {
+		uint16_t up = (i - 1) / branch;
+		connect(up, i);
+		// Siblings share the air around their parent
+		for (uint16_t s = up * branch + 1; s < i; s++) {
+			connect(s, i);
+		}
+	}
+	finish();
+}
+
+void SimTopology::grid(uint16_t nodes, uint16_t width) {
+	begin(nodes + 1);
+	if (width == 0) {
+		width = 1;
+	}
+	for (uint16_t i = 0; i <= nodes; i++) {
+		if ((i + 1) % width != 0 && i + 1 <= nodes) {
+			connect(i, i + 1);
+		}
+		if (i + width <= nodes) {
+			connect(i, i + width);
+		}
+	}
+	finish();
+}
+
+void SimTopology::scatter(uint16_t nodes, float range, uint32_t seed) {
+	begin(nodes + 1);
+	std::vector<float> x(nodes + 1), y(nodes + 1);
+	uint32_t r = seed ? seed : 1;
+	x[0] = y[0] = 0.5f;
+	for (uint16_t i = 1; i <= nodes; i++) {
+		// Own xorshift so the layout does not depend on the simulator's stream
+		r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+		x[i] = (r % 10000) / 10000.0f;
+		r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+		y[i] = (r % 10000) / 10000.0f;
+	}
+	for (uint16_t a = 0; a <= nodes; a++) {
+		for (uint16_t b = a + 1; b <= nodes; b++) {
+			float d = sqrtf((x[a] - x[b]) * (x[a] - x[b]) + (y[a] - y[b]) * (y[a] - y[b])) / range;
+			if (d < 1.0f) {
+				// Clean up close, marginal at the edge of range
+				connect(a, b, d > 0.7f ? (d - 0.7f) : 0.0f);
+			}
+		}
+	}
+	finish();
+}
+
+void SimTopology::apply(float loss) const {
+	Ether.isolate();
+	for (size_t i = 0; i < edges.size(); i++) {
+		float l = edges[i].loss + loss;
+		Ether.link(edges[i].a, edges[i].b, l > 1.0f ? 1.0f : l);
+	}
+}
@@ -0,0 +1,64 @@
+/*
+ Network layouts for the MySensors simulator.
+
+ Node index 0 is always the gateway. A topology only decides who is in
+ radio range of whom; the nodes still find their parents themselves. The
+ breadth first tree from the gateway gives each node its ideal hop depth,
+ and every node that some other node needs to reach the gateway is marked
+ as a repeater.
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef SimTopology_h
+#define SimTopology_h
+
+#include <stdint.h>
+#include <vector>
+
+#define SIM_UNREACHABLE 0xFF
+
+class SimTopology
+{
+  public:
+	// Gateway plus sensors, everybody in range of everybody
+	void star(uint16_t sensors);
+	// Gateway - 1 - 2 - ... - n, each node only hears its neighbours
+	void chain(uint16_t nodes);
+	// Node i hangs off node (i-1)/branch; children of one parent hear each other
+	void tree(uint16_t nodes, uint8_t branch);
+	// Rows of the given width with the gateway in a corner, 4-neighbour links
+	void grid(uint16_t nodes, uint16_t width);
+	// Nodes dropped at random in a unit square around a central gateway.
+	// Nodes closer than range are linked; links get lossier towards the edge.
+	void scatter(uint16_t nodes, float range, uint32_t seed);
+
+	/**
+	 * Install the links in the ether. Call after all nodes have been added to
+	 * the simulator. Every link gets the given loss rate on top of its own.
+	 */
+	void apply(float loss) const;
+
+	uint16_t size() const { return depth.size(); }
+	uint8_t maxDepth() const;
+
+	std::vector<uint8_t> depth;   // Hops to the gateway, SIM_UNREACHABLE if cut off
+	std::vector<uint16_t> parent; // Next hop on a shortest path to the gateway
+	std::vector<bool> repeater;
+
+  private:
+	struct Edge {
+		uint16_t a;
+		uint16_t b;
+		float loss;
+	};
+	std::vector<Edge> edges;
+
+	void begin(uint16_t nodes);
+	void connect(uint16_t a, uint16_t b, float loss=0);
+	void finish();
+};
+
+#endif
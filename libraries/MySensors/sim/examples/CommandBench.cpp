@@ -0,0 +1,261 @@
+/*
+ Actuator command latency benchmark.
+
+ A gateway and N nodes laid out as a star, chain, tree or grid (see
+ SimTopology.h) with static parents. Every node that relays for no other node
+ sends a burst of V_VAR1 readings each interval, so the repeaters have plenty
+ to forward. The repeaters stay awake as actuators: every few hundred
+ milliseconds the controller sets V_LIGHT on one of them, picked at random,
+ and the run measures how long the command takes from the gateway's serial
+ port to the actuator's msgCallback, overall and by hop depth, while the
+ readings keep coming.
+
+ Usage: CommandBench [key=value ...]
+   topology=star|chain|tree|grid           (tree)
+   nodes=N          nodes, 1-250           (30)
+   branch=N         children per node for tree  (3)
+   width=N          grid width             (5)
+   loss=P           frame/ack loss on every link (0)
+   interval=MS      time between bursts of readings (1000)
+   burst=N          readings per burst     (4)
+   commands=MS      time between commands  (300)
+   warmup=S         simulated seconds before measuring (10)
+   seconds=S        simulated seconds measured (60)
+   seed=N                                  (1)
+   trace=0|1        echo every node's serial output (0)
+*/
+
+#include "Sim.h"
+#include "SimTopology.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+static unsigned long interval;
+static uint8_t burst;
+static unsigned long commandEvery;
+static uint64_t measureFrom, measureUntil;
+static SimTopology topology;
+static std::vector<uint16_t> actuators;
+
+struct Command {
+	uint64_t sent;
+	uint8_t depth;
+};
+static std::map<unsigned long, Command> commandsInFlight; // By command number
+static std::vector<uint64_t> latencies;
+static std::vector<std::vector<uint64_t> > latenciesByDepth;
+static uint32_t commandsSent;
+static uint32_t readingsSent, readingsIn;
+
+static void actuatorGot(const MyMessage &m) {
+	if (mGetCommand(m) != C_SET || m.type != V_LIGHT || mGetAck(m)) {
+		return;
+	}
+	std::map<unsigned long, Command>::iterator it = commandsInFlight.find(m.getULong());
+	if (it != commandsInFlight.end()) {
+		uint64_t latency = Simulator.now() - it->second.sent;
+		latencies.push_back(latency);
+		latenciesByDepth[it->second.depth].push_back(latency);
+		commandsInFlight.erase(it);
+	}
+}
+
+class Node : public SimSketch
+{
+  public:
+	Node(uint8_t id, bool repeater, uint8_t parent) :
+		id(id), repeater(repeater), parent(parent), msg(0, V_VAR1) {}
+
+	void setup() {
+		delay(random(1000));
+		gw.begin(repeater ? actuatorGot : NULL, id, repeater, parent);
+		if (repeater) {
+			// Also gives the gateway and the repeaters on the way a route here
+			gw.present(1, S_LIGHT, true);
+		}
+		gw.wait(random(interval));
+	}
+
+	void loop() {
+		if (!repeater) {
+			for (uint8_t i = 0; i < burst; i++) {
+				bool counted = Simulator.now() >= measureFrom && Simulator.now() < measureUntil;
+				readingsSent += counted;
+				gw.send(msg.set((unsigned long)counted));
+			}
+		}
+		gw.wait(interval);
+	}
+
+  private:
+	uint8_t id;
+	bool repeater;
+	uint8_t parent;
+	MySensor gw;
+	MyMessage msg;
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	Gateway() : number(0), nextAt(0) {}
+
+	void setup() {
+		gw.begin();
+		nextAt = Simulator.now() + 2000000;
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+		if (!actuators.empty() && Simulator.now() >= nextAt) {
+			// What a controller would write to the serial port
+			nextAt += commandEvery * 1000;
+			uint16_t to = actuators[random(actuators.size())];
+			char line[32];
+			snprintf(line, sizeof(line), "%u;1;%u;0;%u;%lu\n", to, C_SET, V_LIGHT, ++number);
+			if (Simulator.now() >= measureFrom && Simulator.now() < measureUntil) {
+				Command c = { Simulator.now(), topology.depth[to] };
+				commandsInFlight[number] = c;
+				commandsSent++;
+			}
+			for (const char *p = line; *p; p++) {
+				gw.parse(*p);
+			}
+		}
+	}
+
+	void serialLine(const char *line) {
+		unsigned int sender, sensor, command, ack, type;
+		unsigned long value;
+		if (sscanf(line, "%u;%u;%u;%u;%u;%lu", &sender, &sensor, &command, &ack, &type, &value) == 6 &&
+				command == C_SET && type == V_VAR1 && value == 1) {
+			readingsIn++;
+		}
+	}
+
+  private:
+	MyGateway gw;
+	unsigned long number;
+	uint64_t nextAt;
+};
+
+static double percentile(const std::vector<uint64_t> &v, double p) {
+	if (v.empty()) {
+		return 0;
+	}
+	return v[(size_t)(p * (v.size() - 1))] / 1000.0;
+}
+
+static double mean(const std::vector<uint64_t> &v) {
+	double sum = 0;
+	for (size_t i = 0; i < v.size(); i++) {
+		sum += v[i];
+	}
+	return v.empty() ? 0 : sum / v.size() / 1000.0;
+}
+
+int main(int argc, char **argv) {
+	std::map<std::string, std::string> opt;
+	opt["topology"] = "tree";
+	opt["nodes"] = "30";
+	opt["branch"] = "3";
+	opt["width"] = "5";
+	opt["loss"] = "0";
+	opt["interval"] = "1000";
+	opt["burst"] = "4";
+	opt["commands"] = "300";
+	opt["warmup"] = "10";
+	opt["seconds"] = "60";
+	opt["seed"] = "1";
+	opt["trace"] = "0";
+	for (int i = 1; i < argc; i++) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq || !opt.count(std::string(argv[i], eq - argv[i]))) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+		opt[std::string(argv[i], eq - argv[i])] = eq + 1;
+	}
+
+	int nodes = atoi(opt["nodes"].c_str());
+	float loss = atof(opt["loss"].c_str());
+	int warmup = atoi(opt["warmup"].c_str());
+	int seconds = atoi(opt["seconds"].c_str());
+	uint32_t seed = atol(opt["seed"].c_str());
+	interval = atol(opt["interval"].c_str());
+	burst = atoi(opt["burst"].c_str());
+	commandEvery = atol(opt["commands"].c_str());
+	if (nodes < 1 || nodes > 250) {
+		fprintf(stderr, "nodes must be 1-250\n");
+		return 1;
+	}
+	Simulator.seed(seed);
+	Simulator.setTrace(opt["trace"] == "1");
+
+	const std::string &t = opt["topology"];
+	if (t == "star") {
+		topology.star(nodes);
+	} else if (t == "chain") {
+		topology.chain(nodes);
+	} else if (t == "tree") {
+		topology.tree(nodes, atoi(opt["branch"].c_str()));
+	} else if (t == "grid") {
+		topology.grid(nodes, atoi(opt["width"].c_str()));
+	} else {
+		fprintf(stderr, "unknown topology %s\n", t.c_str());
+		return 1;
+	}
+
+	Simulator.addNode(new Gateway());
+	for (int i = 1; i <= nodes; i++) {
+		Simulator.addNode(new Node(i, topology.repeater[i], topology.parent[i]));
+		if (topology.repeater[i]) {
+			actuators.push_back(i);
+		}
+	}
+	topology.apply(loss);
+	if (actuators.empty()) {
+		fprintf(stderr, "no repeaters to command in this layout\n");
+		return 1;
+	}
+
+	uint8_t maxDepth = topology.maxDepth();
+	latenciesByDepth.resize(maxDepth + 1);
+	measureFrom = (uint64_t)warmup * 1000000;
+	measureUntil = measureFrom + (uint64_t)seconds * 1000000;
+
+	clock_t start = clock();
+	Simulator.run(measureFrom);
+	Ether.resetCounters();
+	// A little longer for the last commands and readings to arrive
+	Simulator.run(measureUntil + 2000000);
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("%s, %d nodes, %u actuators, depth %u, loss %.3f, %u readings every %lu ms, command every %lu ms, seed %u\n",
+			t.c_str(), nodes, (unsigned)actuators.size(), maxDepth, loss, burst, interval, commandEvery, seed);
+	printf("commands: sent %u, arrived %u (%.1f%%)\n", commandsSent, (unsigned)latencies.size(),
+			commandsSent ? 100.0 * latencies.size() / commandsSent : 0.0);
+	printf("command latency ms: mean %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f\n", mean(latencies),
+			percentile(latencies, 0.50), percentile(latencies, 0.95),
+			percentile(latencies, 0.99), percentile(latencies, 1.0));
+	for (uint8_t d = 1; d <= maxDepth; d++) {
+		std::vector<uint64_t> &v = latenciesByDepth[d];
+		std::sort(v.begin(), v.end());
+		if (!v.empty()) {
+			printf("  depth %u: arrived %u, mean %.2f p50 %.2f p95 %.2f max %.2f\n", d, (unsigned)v.size(), mean(v),
+					percentile(v, 0.50), percentile(v, 0.95), percentile(v, 1.0));
+		}
+	}
+	printf("readings: sent %u, delivered %u (%.1f%%)\n", readingsSent, readingsIn,
+			readingsSent ? 100.0 * readingsIn / readingsSent : 0.0);
+	printf("air: frames %u, collisions %u, lost %u, acks lost %u\n", Ether.frames, Ether.collisions,
+			Ether.dropped, Ether.acksLost);
+	printf("host: %.2f s wall\n", wall);
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ Commands to sleeping nodes benchmark.
+
+ A gateway and N nodes laid out as a star, chain, tree or grid (see
+ SimTopology.h) with static parents. Repeaters wait(), every other node wakes
+ once per interval, sends one V_VAR1 reading and sleep()s again. Every few
+ seconds the controller sets V_LIGHT on one of the sleeping nodes, picked at
+ random, and the run counts how many of these commands arrive and how long
+ after they were written to the gateway's serial port, and how long the
+ sleeping nodes stayed awake each time they woke. A command that did not
+ arrive but a later one to the same node did counts as replaced, not lost.
+
+ Usage: MailboxBench [key=value ...]
+   topology=star|chain|tree|grid           (tree)
+   nodes=N          nodes, 1-250           (30)
+   branch=N         children per node for tree  (3)
+   width=N          grid width             (5)
+   loss=P           frame/ack loss on every link (0)
+   interval=MS      time between readings  (10000)
+   commands=MS      time between commands  (2000)
+   warmup=S         simulated seconds before measuring (30)
+   seconds=S        simulated seconds measured (300)
+   seed=N                                  (1)
+   trace=0|1        echo every node's serial output (0)
+*/
+
+#include "Sim.h"
+#include "SimTopology.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+static unsigned long interval;
+static unsigned long commandEvery;
+static uint64_t measureFrom, measureUntil;
+static SimTopology topology;
+static std::vector<uint16_t> sleepers;
+
+struct Command {
+	uint64_t sent;
+	uint8_t to;
+};
+static std::map<unsigned long, Command> commandsInFlight; // By command number
+static std::vector<uint64_t> latencies;
+static uint32_t commandsSent, commandsSuperseded;
+static uint32_t readingsSent, readingsIn;
+static uint64_t wakes, awakeMs;
+
+static void sleeperGot(const MyMessage &m) {
+	if (mGetCommand(m) != C_SET || m.type != V_LIGHT || mGetAck(m)) {
+		return;
+	}
+	std::map<unsigned long, Command>::iterator it = commandsInFlight.find(m.getULong());
+	if (it == commandsInFlight.end()) {
+		return;
+	}
+	latencies.push_back(Simulator.now() - it->second.sent);
+	uint8_t to = it->second.to;
+	commandsInFlight.erase(it++);
+	// Earlier commands to this node that have not arrived were replaced by
+	// this one on the way
+	for (std::map<unsigned long, Command>::iterator i = commandsInFlight.begin(); i != it;) {
+		if (i->second.to == to) {
+			commandsSuperseded++;
+			commandsInFlight.erase(i++);
+		} else {
+			++i;
+		}
+	}
+}
+
+class Node : public SimSketch
+{
+  public:
+	Node(uint8_t id, bool repeater, uint8_t parent) :
+		id(id), repeater(repeater), parent(parent), msg(0, V_VAR1) {}
+
+	void setup() {
+		delay(random(1000));
+		gw.begin(repeater ? NULL : sleeperGot, id, repeater, parent);
+		if (!repeater) {
+			gw.sleep(random(interval));
+		}
+	}
+
+	void loop() {
+		if (repeater) {
+			gw.wait(interval);
+			return;
+		}
+		bool counted = Simulator.now() >= measureFrom && Simulator.now() < measureUntil;
+		unsigned long wokeAt = millis();
+		readingsSent += counted;
+		gw.send(msg.set((unsigned long)counted));
+		// Awake time of this wake up is only known once sleep() powered down
+		gw.sleep(interval);
+		if (counted) {
+			wakes++;
+			awakeMs += millis() - wokeAt;
+		}
+	}
+
+  private:
+	uint8_t id;
+	bool repeater;
+	uint8_t parent;
+	MySensor gw;
+	MyMessage msg;
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	Gateway() : number(0), nextAt(0) {}
+
+	void setup() {
+		gw.begin();
+		nextAt = Simulator.now() + 2000000;
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+		if (Simulator.now() >= nextAt) {
+			// What a controller would write to the serial port
+			nextAt += commandEvery * 1000;
+			uint16_t to = sleepers[random(sleepers.size())];
+			char line[32];
+			snprintf(line, sizeof(line), "%u;1;%u;0;%u;%lu\n", to, C_SET, V_LIGHT, ++number);
+			if (Simulator.now() >= measureFrom && Simulator.now() < measureUntil) {
+				Command c = { Simulator.now(), (uint8_t)to };
+				commandsInFlight[number] = c;
+				commandsSent++;
+			}
+			for (const char *p = line; *p; p++) {
+				gw.parse(*p);
+			}
+		}
+	}
+
+	void serialLine(const char *line) {
+		unsigned int sender, sensor, command, ack, type;
+		unsigned long value;
+		if (sscanf(line, "%u;%u;%u;%u;%u;%lu", &sender, &sensor, &command, &ack, &type, &value) == 6 &&
+				command == C_SET && type == V_VAR1 && value == 1) {
+			readingsIn++;
+		}
+	}
+
+  private:
+	MyGateway gw;
+	unsigned long number;
+	uint64_t nextAt;
+};
+
+static double percentile(const std::vector<uint64_t> &v, double p) {
+	if (v.empty()) {
+		return 0;
+	}
+	return v[(size_t)(p * (v.size() - 1))] / 1000.0;
+}
+
+static double mean(const std::vector<uint64_t> &v) {
+	double sum = 0;
+	for (size_t i = 0; i < v.size(); i++) {
+		sum += v[i];
+	}
+	return v.empty() ? 0 : sum / v.size() / 1000.0;
+}
+
+int main(int argc, char **argv) {
+	std::map<std::string, std::string> opt;
+	opt["topology"] = "tree";
+	opt["nodes"] = "30";
+	opt["branch"] = "3";
+	opt["width"] = "5";
+	opt["loss"] = "0";
+	opt["interval"] = "10000";
+	opt["commands"] = "2000";
+	opt["warmup"] = "30";
+	opt["seconds"] = "300";
+	opt["seed"] = "1";
+	opt["trace"] = "0";
+	for (int i = 1; i < argc; i++) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq || !opt.count(std::string(argv[i], eq - argv[i]))) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+		opt[std::string(argv[i], eq - argv[i])] = eq + 1;
+	}
+
+	int nodes = atoi(opt["nodes"].c_str());
+	float loss = atof(opt["loss"].c_str());
+	int warmup = atoi(opt["warmup"].c_str());
+	int seconds = atoi(opt["seconds"].c_str());
+	uint32_t seed = atol(opt["seed"].c_str());
+	interval = atol(opt["interval"].c_str());
+	commandEvery = atol(opt["commands"].c_str());
+	if (nodes < 1 || nodes > 250) {
+		fprintf(stderr, "nodes must be 1-250\n");
+		return 1;
+	}
+	Simulator.seed(seed);
+	Simulator.setTrace(opt["trace"] == "1");
+
+	const std::string &t = opt["topology"];
+	if (t == "star") {
+		topology.star(nodes);
+	} else if (t == "chain") {
+		topology.chain(nodes);
+	} else if (t == "tree") {
+		topology.tree(nodes, atoi(opt["branch"].c_str()));
+	} else if (t == "grid") {
+		topology.grid(nodes, atoi(opt["width"].c_str()));
+	} else {
+		fprintf(stderr, "unknown topology %s\n", t.c_str());
+		return 1;
+	}
+
+	Simulator.addNode(new Gateway());
+	for (int i = 1; i <= nodes; i++) {
+		Simulator.addNode(new Node(i, topology.repeater[i], topology.parent[i]));
+		if (!topology.repeater[i]) {
+			sleepers.push_back(i);
+		}
+	}
+	topology.apply(loss);
+
+	measureFrom = (uint64_t)warmup * 1000000;
+	measureUntil = measureFrom + (uint64_t)seconds * 1000000;
+
+	clock_t start = clock();
+	Simulator.run(measureFrom);
+	Ether.resetCounters();
+	// Long enough for every node to wake once more and get the last commands
+	Simulator.run(measureUntil + (uint64_t)interval * 1000 + 2000000);
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("%s, %d nodes, %u sleeping, depth %u, loss %.3f, reading every %lu ms, command every %lu ms, seed %u\n",
+			t.c_str(), nodes, (unsigned)sleepers.size(), topology.maxDepth(), loss, interval, commandEvery, seed);
+	printf("commands: sent %u, arrived %u (%.1f%%), replaced by a later one %u, lost %u\n", commandsSent,
+			(unsigned)latencies.size(), commandsSent ? 100.0 * latencies.size() / commandsSent : 0.0,
+			commandsSuperseded, commandsSent - (unsigned)latencies.size() - commandsSuperseded);
+	printf("command latency ms: mean %.2f p50 %.2f p95 %.2f max %.2f\n", mean(latencies),
+			percentile(latencies, 0.50), percentile(latencies, 0.95), percentile(latencies, 1.0));
+	printf("readings: sent %u, delivered %u (%.1f%%)\n", readingsSent, readingsIn,
+			readingsSent ? 100.0 * readingsIn / readingsSent : 0.0);
+	printf("sleeping nodes: awake %.1f ms per wake up\n", wakes ? (double)awakeMs / wakes : 0.0);
+	printf("air: frames %u, collisions %u, lost %u, acks lost %u\n", Ether.frames, Ether.collisions,
+			Ether.dropped, Ether.acksLost);
+	printf("host: %.2f s wall\n", wall);
+	return 0;
+}
@@ -0,0 +1,392 @@
+/*
+ Mesh routing benchmark.
+
+ A gateway and N nodes laid out as a star, chain, tree, grid or random
+ scatter (see SimTopology.h). Nodes that other nodes depend on run as
+ repeaters and wait() between readings, all others sleep. Every node sends a
+ V_VAR1 sequence number each interval, starting at a random phase, and finds
+ its parent itself unless parents=static is given. phase=same starts every
+ sleeping node right after boot instead, as sketches that sleep(SLEEP_TIME)
+ do, and phase=slots has them sleepSlot() (with boot=0 they all power up at
+ once). With ack=1 every reading asks the gateway for an ack and the nodes
+ send it again until it comes (see setAckCallback()).
+
+ After the warmup the counters are reset and the run measures delivery,
+ readings that reached the controller more than once, end-to-end latency
+ (send() on the node to the line leaving the gateway's serial port) overall
+ and by hop depth, radio retransmissions, MAX_RT failures, find parent
+ traffic, EEPROM writes and how much of the time repeaters spend
+ idle waiting for an interrupt (only with RF24_IRQ_PIN, see the Makefile).
+ Readings sent in the last few seconds are not counted as they may still be
+ on their way.
+
+ Usage: MeshBench [key=value ...]
+   topology=star|chain|tree|grid|scatter   (tree)
+   nodes=N          sensor/repeater nodes, 1-250          (30)
+   branch=N         children per node for tree            (3)
+   width=N          grid width, nodes/width rows          (5)
+   range=R          scatter radio range, unit square      (0.3)
+   loss=P           frame/ack loss on every link, 0-1     (0)
+   collisions=none|channel|receiver                       (receiver)
+   interval=MS      time between readings                 (10000)
+   boot=S           nodes power up at random within S s   (5)
+   warmup=S         simulated seconds before measuring    (30)
+   seconds=S        simulated seconds measured            (120)
+   parents=auto|static                                    (auto)
+   phase=random|same|slots  when sleeping nodes report    (random)
+   wdt=E            watchdog clock error, each node within +-E (0)
+   ack=0|1          readings sent with ack                 (0)
+   seed=N                                                 (1)
+   trace=0|1        echo every node's serial output       (0)
+*/
+
+#include "Sim.h"
+#include "SimTopology.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <map>
+#include <set>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <time.h>
+
+#define GRACE_US 5000000ULL
+
+static unsigned long interval = 10000;
+static unsigned long boot = 5000;
+static std::string phase;
+static uint64_t measureFrom, measureUntil;
+static SimTopology topology;
+
+struct Reading {
+	uint64_t sent;
+	uint8_t depth;
+};
+static std::map<uint32_t, Reading> inFlight; // (node id << 16 | seq) -> send
+static std::set<uint32_t> delivered;         // Readings that reached the controller
+static std::vector<uint64_t> latencies;
+static std::vector<std::vector<uint64_t> > latenciesByDepth;
+static std::vector<uint32_t> sentByDepth;
+static uint32_t sent, firstHopOk, duplicates;
+static uint32_t findParent, findParentResponses;
+static bool withAck;
+static uint32_t acksOk, acksFailed;
+
+static void ackDone(const MyMessage &m, bool acked) {
+	(void)m;
+	if (Simulator.now() >= measureFrom) {
+		(acked ? acksOk : acksFailed)++;
+	}
+}
+
+class Node : public SimSketch
+{
+  public:
+	Node(uint8_t id, bool repeater, uint8_t parent) :
+		id(id), repeater(repeater), parent(parent), seq(0), msg(0, V_VAR1) {}
+
+	void setup() {
+		delay(random(boot));
+		gw.begin(NULL, id, repeater, parent);
+		gw.setAckCallback(ackDone);
+		if (repeater) {
+			gw.wait(random(interval));
+		} else if (phase == "random") {
+			gw.sleep(random(interval));
+		}
+	}
+
+	void loop() {
+		uint64_t now = Simulator.now();
+		bool counted = now >= measureFrom && now < measureUntil;
+		if (counted) {
+			uint8_t depth = topology.depth[id];
+			Reading r = { now, depth };
+			inFlight[((uint32_t)id << 16) | seq] = r;
+			sent++;
+			sentByDepth[depth]++;
+		}
+		if (gw.send(msg.set((unsigned long)seq), withAck) && counted) {
+			firstHopOk++;
+		}
+		seq = (seq + 1) & 0xFFFF;
+		if (repeater) {
+			gw.wait(interval);
+		} else if (phase == "slots") {
+			gw.sleepSlot(interval);
+		} else {
+			gw.sleep(interval);
+		}
+	}
+
+	MySensor &sensor() { return gw; }
+
+  private:
+	uint8_t id;
+	bool repeater;
+	uint8_t parent;
+	uint16_t seq;
+	MySensor gw;
+	MyMessage msg;
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+	}
+
+	void serialLine(const char *line) {
+		unsigned int sender, sensor, command, ack, type;
+		unsigned long value;
+		if (sscanf(line, "%u;%u;%u;%u;%u;%lu", &sender, &sensor, &command, &ack, &type, &value) != 6 ||
+				command != C_SET || type != V_VAR1) {
+			return;
+		}
+		uint32_t key = (sender << 16) | (uint32_t)value;
+		std::map<uint32_t, Reading>::iterator it = inFlight.find(key);
+		if (it != inFlight.end()) {
+			uint64_t latency = Simulator.now() - it->second.sent;
+			latencies.push_back(latency);
+			latenciesByDepth[it->second.depth].push_back(latency);
+			inFlight.erase(it);
+			delivered.insert(key);
+		} else if (delivered.count(key)) {
+			duplicates++;
+		}
+	}
+
+  private:
+	MyGateway gw;
+};
+
+static void observe(const SimFrame &frame, uint8_t received) {
+	(void)received;
+	if (frame.length < HEADER_SIZE) {
+		return;
+	}
+	const MyMessage &m = *(const MyMessage *)frame.payload;
+	if (mGetCommand(m) != C_INTERNAL) {
+		return;
+	}
+	if (m.type == I_FIND_PARENT) {
+		findParent++;
+	} else if (m.type == I_FIND_PARENT_RESPONSE) {
+		findParentResponses++;
+	}
+}
+
+static double percentile(const std::vector<uint64_t> &v, double p) {
+	if (v.empty()) {
+		return 0;
+	}
+	return v[(size_t)(p * (v.size() - 1))] / 1000.0;
+}
+
+static double mean(const std::vector<uint64_t> &v) {
+	double sum = 0;
+	for (size_t i = 0; i < v.size(); i++) {
+		sum += v[i];
+	}
+	return v.empty() ? 0 : sum / v.size() / 1000.0;
+}
+
+static uint64_t repeaterIdle() {
+	uint64_t idled = 0;
+	for (uint16_t i = 1; i < Simulator.size(); i++) {
+		if (topology.repeater[i]) {
+			idled += Simulator.node(i).idled;
+		}
+	}
+	return idled;
+}
+
+static uint32_t eepromWrites() {
+	uint32_t writes = 0;
+	for (uint16_t i = 0; i < Simulator.size(); i++) {
+		writes += Simulator.node(i).eepromWrites;
+	}
+	return writes;
+}
+
+static void radioTotals(uint32_t &retransmits, uint32_t &failed) {
+	retransmits = failed = 0;
+	for (uint16_t i = 0; i < Simulator.size(); i++) {
+		SimRadio &r = Simulator.node(i).radio;
+		retransmits += r.framesSent - r.payloadsSent - r.payloadsFailed;
+		failed += r.payloadsFailed;
+	}
+}
+
+int main(int argc, char **argv) {
+	std::map<std::string, std::string> opt;
+	opt["topology"] = "tree";
+	opt["nodes"] = "30";
+	opt["branch"] = "3";
+	opt["width"] = "5";
+	opt["range"] = "0.3";
+	opt["loss"] = "0";
+	opt["collisions"] = "receiver";
+	opt["interval"] = "10000";
+	opt["boot"] = "5";
+	opt["warmup"] = "30";
+	opt["seconds"] = "120";
+	opt["parents"] = "auto";
+	opt["phase"] = "random";
+	opt["wdt"] = "0";
+	opt["ack"] = "0";
+	opt["seed"] = "1";
+	opt["trace"] = "0";
+	for (int i = 1; i < argc; i++) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq || !opt.count(std::string(argv[i], eq - argv[i]))) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+		opt[std::string(argv[i], eq - argv[i])] = eq + 1;
+	}
+
+	int nodes = atoi(opt["nodes"].c_str());
+	interval = atol(opt["interval"].c_str());
+	boot = atol(opt["boot"].c_str()) * 1000;
+	int warmup = atoi(opt["warmup"].c_str());
+	int seconds = atoi(opt["seconds"].c_str());
+	float loss = atof(opt["loss"].c_str());
+	uint32_t seed = atol(opt["seed"].c_str());
+	bool staticParents = opt["parents"] == "static";
+	phase = opt["phase"];
+	withAck = opt["ack"] == "1";
+	if (phase != "random" && phase != "same" && phase != "slots") {
+		fprintf(stderr, "unknown phase %s\n", phase.c_str());
+		return 1;
+	}
+	if (nodes < 1 || nodes > 250) {
+		fprintf(stderr, "nodes must be 1-250\n");
+		return 1;
+	}
+	Simulator.seed(seed);
+	Simulator.setTrace(opt["trace"] == "1");
+	Simulator.setWdtError(atof(opt["wdt"].c_str()));
+
+	const std::string &t = opt["topology"];
+	if (t == "star") {
+		topology.star(nodes);
+	} else if (t == "chain") {
+		topology.chain(nodes);
+	} else if (t == "tree") {
+		topology.tree(nodes, atoi(opt["branch"].c_str()));
+	} else if (t == "grid") {
+		topology.grid(nodes, atoi(opt["width"].c_str()));
+	} else if (t == "scatter") {
+		topology.scatter(nodes, atof(opt["range"].c_str()), seed);
+	} else {
+		fprintf(stderr, "unknown topology %s\n", t.c_str());
+		return 1;
+	}
+
+	const std::string &c = opt["collisions"];
+	Ether.setCollisions(c == "none" ? SIM_COLLIDE_NONE : c == "channel" ? SIM_COLLIDE_CHANNEL : SIM_COLLIDE_RECEIVER);
+
+	Simulator.addNode(new Gateway());
+	for (int i = 1; i <= nodes; i++) {
+		Simulator.addNode(new Node(i, topology.repeater[i], staticParents ? topology.parent[i] : AUTO));
+	}
+	topology.apply(loss);
+	Ether.setObserver(observe);
+
+	uint8_t maxDepth = topology.maxDepth();
+	latenciesByDepth.resize(maxDepth + 1);
+	sentByDepth.resize(SIM_UNREACHABLE + 1);
+	measureFrom = (uint64_t)warmup * 1000000;
+	measureUntil = measureFrom + (uint64_t)seconds * 1000000;
+	if (measureUntil > measureFrom + GRACE_US) {
+		measureUntil -= GRACE_US;
+	}
+
+	clock_t start = clock();
+	Simulator.run(measureFrom);
+	uint32_t retransmits0, failed0;
+	radioTotals(retransmits0, failed0);
+	uint64_t idled0 = repeaterIdle();
+	uint32_t eepromWrites0 = eepromWrites();
+	Ether.resetCounters();
+	findParent = findParentResponses = 0;
+#ifdef NODE_STATS
+	for (uint16_t i = 1; i < Simulator.size(); i++) {
+		((Node *)Simulator.node(i).sketch)->sensor().clearStats();
+	}
+#endif
+	Simulator.run(measureFrom + (uint64_t)seconds * 1000000);
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+	uint32_t retransmits, failed;
+	radioTotals(retransmits, failed);
+	retransmits -= retransmits0;
+	failed -= failed0;
+	uint64_t idled = repeaterIdle() - idled0;
+	uint16_t repeaters = 0;
+	for (uint16_t i = 1; i < Simulator.size(); i++) {
+		repeaters += topology.repeater[i];
+	}
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("%s, %d nodes, depth %u, loss %.3f, collisions %s, parents %s, phase %s, interval %lu ms, seed %u\n",
+			t.c_str(), nodes, maxDepth, loss, c.c_str(), staticParents ? "static" : "auto", phase.c_str(), interval, seed);
+	printf("measured %d s after %d s warmup\n", seconds, warmup);
+	printf("sent %u, first hop ok %u, delivered %u (%.1f%%), %.2f msg/s\n", sent, firstHopOk,
+			(unsigned)latencies.size(), sent ? 100.0 * latencies.size() / sent : 0.0,
+			(double)latencies.size() / seconds);
+	printf("duplicates at the controller %u\n", duplicates);
+	if (withAck) {
+		printf("acks: acked %u, given up %u\n", acksOk, acksFailed);
+	}
+	printf("latency ms: mean %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f\n", mean(latencies),
+			percentile(latencies, 0.50), percentile(latencies, 0.95),
+			percentile(latencies, 0.99), percentile(latencies, 1.0));
+	for (uint8_t d = 1; d <= maxDepth; d++) {
+		std::vector<uint64_t> &v = latenciesByDepth[d];
+		std::sort(v.begin(), v.end());
+		printf("  depth %u: sent %u, delivered %.1f%%, mean %.2f p50 %.2f p95 %.2f\n", d, sentByDepth[d],
+				sentByDepth[d] ? 100.0 * v.size() / sentByDepth[d] : 0.0, mean(v),
+				percentile(v, 0.50), percentile(v, 0.95));
+	}
+	printf("radio: retransmits %u, max retries failures %u\n", retransmits, failed);
+	printf("air: frames %u, collisions %u, lost %u, acks lost %u\n", Ether.frames, Ether.collisions,
+			Ether.dropped, Ether.acksLost);
+	printf("find parent: requests %u, responses %u\n", findParent, findParentResponses);
+	printf("eeprom writes %u\n", eepromWrites() - eepromWrites0);
+	printf("repeaters: %u, cpu idle %.1f%%\n", repeaters,
+			repeaters ? 100.0 * idled / ((double)seconds * 1000000 * repeaters) : 0.0);
+#ifdef NODE_STATS
+	// Most relayed messages, from the nodes' own statistics
+	uint16_t busiest = 0;
+	for (uint16_t i = 1; i < Simulator.size(); i++) {
+		if (topology.repeater[i] && (busiest == 0 ||
+				((Node *)Simulator.node(i).sketch)->sensor().getStats().relayed >
+				((Node *)Simulator.node(busiest).sketch)->sensor().getStats().relayed)) {
+			busiest = i;
+		}
+	}
+	if (busiest) {
+		const NodeStats &s = ((Node *)Simulator.node(busiest).sketch)->sensor().getStats();
+		uint32_t slow = 0;
+		for (uint8_t b = 5; b < STATS_SEND_BUCKETS; b++) {
+			slow += s.sendTime[b];
+		}
+		printf("busiest repeater: node %u, relayed %u, duplicates %u, tx ok %u, fail %u, retries %u, sends >= 16 ms %u\n",
+				busiest, s.relayed, s.duplicates, s.txOk, s.txFail, s.txRetries, slow);
+	}
+#endif
+	uint16_t halted = 0;
+	for (uint16_t i = 0; i < Simulator.size(); i++) {
+		halted += Simulator.node(i).halted;
+	}
+	printf("halted nodes %u\n", halted);
+	printf("host: %.2f s wall, %.1fx real time\n", wall, wall > 0 ? (warmup + seconds) / wall : 0.0);
+	return 0;
+}
@@ -0,0 +1,232 @@
+/*
+ Over the air firmware update benchmark.
+
+ A gateway and N nodes laid out as a star, chain or tree (see SimTopology.h)
+ with static parents, all awake: they wait() between readings. The
+ controller serves one firmware image through the gateway, read from an
+ Intel HEX file or made up of random bytes. Every node that relays for no
+ other node, or with update=all every node, or with update=last only the last
+ one (the farthest from the gateway in a chain), asks for it after begin()
+ with requestFirmware() and keeps the blocks it gets in RAM. With the whole
+ image in and the CRC right the node writes the new firmware config to EEPROM
+ and reboots, which stops it in the simulator: a repeater that is done no
+ longer relays for the nodes behind it.
+
+ The controller answers at once; what limits the transfer is the radio path
+ and the gateway's serial port, 115200 baud, that carries the requests and the
+ blocks.
+
+ Reports how long each node took from its first block to the reboot, the
+ rate, what the controller was asked for and sent, and whether every stored
+ image and EEPROM config match what was served.
+
+ Usage: OtaBench [key=value ...]
+   topology=star|chain|tree                        (star)
+   nodes=N          nodes, 1-250                   (1)
+   update=leaves|all|last  nodes that update       (leaves)
+   branch=N         children per node for tree     (3)
+   loss=P           frame/ack loss on every link   (0)
+   size=BYTES       random image of this size      (16384)
+   hex=FILE         Intel HEX image instead
+   seconds=S        give up after S simulated s    (600)
+   seed=N                                          (1)
+   trace=0|1        echo every node's serial output (0)
+*/
+
+#include "Sim.h"
+#include "SimFirmware.h"
+#include "SimTopology.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <time.h>
+
+static SimFirmware firmware;
+static SimTopology topology;
+static std::vector<std::vector<uint8_t> > images; // By node index
+static std::vector<uint64_t> firstBlockAt;
+
+static void storeBlock(uint16_t block, const uint8_t *data) {
+	uint16_t i = Simulator.current()->index;
+	if (block == 0) {
+		firstBlockAt[i] = Simulator.now();
+	}
+	std::vector<uint8_t> &image = images[i];
+	size_t at = (size_t)block * FIRMWARE_BLOCK_SIZE;
+	if (image.size() < at + FIRMWARE_BLOCK_SIZE) {
+		image.resize(at + FIRMWARE_BLOCK_SIZE);
+	}
+	memcpy(&image[at], data, FIRMWARE_BLOCK_SIZE);
+}
+
+class Node : public SimSketch
+{
+  public:
+	Node(uint8_t id, bool repeater, uint8_t parent, bool update) :
+		id(id), repeater(repeater), parent(parent), update(update) {}
+
+	void setup() {
+		delay(random(1000));
+		gw.begin(NULL, id, repeater, parent);
+		if (update) {
+			gw.requestFirmware(storeBlock);
+		}
+	}
+
+	void loop() {
+		gw.wait(1000);
+	}
+
+  private:
+	uint8_t id;
+	bool repeater;
+	uint8_t parent;
+	bool update;
+	MySensor gw;
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+		while (Serial.available()) {
+			gw.parse(Serial.read());
+		}
+	}
+
+	void serialLine(const char *line) {
+		std::string reply;
+		if (firmware.answer(line, reply) && !reply.empty()) {
+			Simulator.serialInput(0, reply.c_str());
+		}
+	}
+
+  private:
+	MyGateway gw;
+};
+
+int main(int argc, char **argv) {
+	std::map<std::string, std::string> opt;
+	opt["topology"] = "star";
+	opt["nodes"] = "1";
+	opt["update"] = "leaves";
+	opt["branch"] = "3";
+	opt["loss"] = "0";
+	opt["size"] = "16384";
+	opt["hex"] = "";
+	opt["seconds"] = "600";
+	opt["seed"] = "1";
+	opt["trace"] = "0";
+	for (int i = 1; i < argc; i++) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq || !opt.count(std::string(argv[i], eq - argv[i]))) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+		opt[std::string(argv[i], eq - argv[i])] = eq + 1;
+	}
+
+	int nodes = atoi(opt["nodes"].c_str());
+	const std::string &update = opt["update"];
+	if (update != "leaves" && update != "all" && update != "last") {
+		fprintf(stderr, "unknown update %s\n", update.c_str());
+		return 1;
+	}
+	float loss = atof(opt["loss"].c_str());
+	int seconds = atoi(opt["seconds"].c_str());
+	uint32_t seed = atol(opt["seed"].c_str());
+	if (nodes < 1 || nodes > 250) {
+		fprintf(stderr, "nodes must be 1-250\n");
+		return 1;
+	}
+	if (!opt["hex"].empty()) {
+		if (!firmware.loadHex(opt["hex"].c_str())) {
+			return 1;
+		}
+	} else {
+		firmware.generate(atol(opt["size"].c_str()), seed);
+	}
+	FirmwareConfig config = firmware.config();
+	if (config.blocks == 0) {
+		fprintf(stderr, "empty image\n");
+		return 1;
+	}
+	Simulator.seed(seed);
+	Simulator.setTrace(opt["trace"] == "1");
+
+	const std::string &t = opt["topology"];
+	if (t == "star") {
+		topology.star(nodes);
+	} else if (t == "chain") {
+		topology.chain(nodes);
+	} else if (t == "tree") {
+		topology.tree(nodes, atoi(opt["branch"].c_str()));
+	} else {
+		fprintf(stderr, "unknown topology %s\n", t.c_str());
+		return 1;
+	}
+
+	Simulator.addNode(new Gateway());
+	int updating = 0;
+	for (int i = 1; i <= nodes; i++) {
+		bool updates = update == "all" || (update == "leaves" && !topology.repeater[i]) || (update == "last" && i == nodes);
+		updating += updates;
+		Simulator.addNode(new Node(i, topology.repeater[i], topology.parent[i], updates));
+	}
+	topology.apply(loss);
+	images.resize(nodes + 1);
+	firstBlockAt.assign(nodes + 1, 0);
+
+	// Run until every node has rebooted into the new firmware
+	clock_t start = clock();
+	std::vector<uint64_t> doneAt(nodes + 1, 0);
+	int done = 0;
+	for (uint64_t until = 10000; done < updating && until <= (uint64_t)seconds * 1000000; until += 10000) {
+		Simulator.run(until);
+		for (int i = 1; i <= nodes; i++) {
+			if (!doneAt[i] && Simulator.node(i).halted) {
+				doneAt[i] = Simulator.now();
+				done++;
+			}
+		}
+	}
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	int imagesOk = 0;
+	double sum = 0, longest = 0, last = 0;
+	for (int i = 1; i <= nodes; i++) {
+		if (!doneAt[i]) {
+			continue;
+		}
+		const uint8_t *eeprom = Simulator.node(i).eeprom + EEPROM_FIRMWARE_TYPE_ADDRESS;
+		if (images[i] == firmware.image() && memcmp(eeprom, &config, sizeof(config)) == 0) {
+			imagesOk++;
+		}
+		double took = (doneAt[i] - firstBlockAt[i]) / 1e6;
+		sum += took;
+		longest = took > longest ? took : longest;
+		last = doneAt[i] / 1e6 > last ? doneAt[i] / 1e6 : last;
+	}
+	size_t bytes = firmware.image().size();
+	uint32_t needed = (uint32_t)config.blocks * done;
+
+	printf("%s, %d nodes, depth %u, loss %.3f, image %u bytes (%u blocks), window %u, seed %u\n",
+			t.c_str(), nodes, topology.maxDepth(), loss, (unsigned)bytes, config.blocks, FIRMWARE_WINDOW, seed);
+	printf("updated %d/%d nodes, image ok %d, all done after %.2f s\n", done, updating, imagesOk, last);
+	if (done) {
+		printf("per node: mean %.2f s, max %.2f s, %.0f bytes/s\n", sum / done, longest, bytes * done / sum);
+	}
+	printf("controller: config requests %u, block requests %u, blocks sent %u (%.1f%% more than needed)\n",
+			firmware.configRequests, firmware.blockRequests, firmware.blocksSent,
+			needed ? 100.0 * ((double)firmware.blocksSent - needed) / needed : 0.0);
+	printf("air: frames %u, collisions %u, lost %u, acks lost %u\n", Ether.frames, Ether.collisions, Ether.dropped, Ether.acksLost);
+	printf("host: %.2f s wall\n", wall);
+	return done == updating && imagesOk == updating ? 0 : 1;
+}
@@ -0,0 +1,188 @@
+/*
+ Reboot benchmark.
+
+ A gateway and N nodes laid out as a star, chain or tree (see SimTopology.h)
+ with static parents. Every node that is no repeater sends a V_VAR1 reading,
+ counting up across reboots, every interval; the repeaters and the gateway
+ drop the copies of messages they have seen before by sender and sequence
+ number. Every reboot ms the sending nodes are power cycled: they start over
+ with empty RAM and millis() from 0, only their EEPROM is kept.
+
+ Readings a node sends right after a reboot must not look like the ones it
+ sent just before, or the duplicate caches drop them. The run counts how many
+ of the first few readings after each reboot reach the controller, and how
+ many readings do overall.
+
+ Usage: RebootBench [key=value ...]
+   topology=star|chain|tree                (chain)
+   nodes=N          nodes, 1-250           (2)
+   branch=N         children per node for tree  (3)
+   loss=P           frame/ack loss on every link (0)
+   interval=MS      time between readings  (1000)
+   reboot=MS        time between reboots   (5000)
+   first=N          readings after a reboot that are checked (3)
+   reboots=N        reboots of every sending node (20)
+   seed=N                                  (1)
+*/
+
+#include "Sim.h"
+#include "SimTopology.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <map>
+#include <set>
+#include <string>
+#include <time.h>
+
+static unsigned long interval;
+static unsigned first;
+static SimTopology topology;
+
+static uint32_t value[256];   // Next reading of each node, kept across reboots
+static std::set<uint32_t> firstAfterReboot; // (node id << 24 | value) of the checked readings
+static std::set<uint32_t> delivered;
+static uint32_t sent;
+
+class Node : public SimSketch
+{
+  public:
+	Node(uint8_t id, bool repeater, uint8_t parent) :
+		id(id), repeater(repeater), parent(parent), readings(0), msg(0, V_VAR1) {}
+
+	void setup() {
+		gw.begin(NULL, id, repeater, parent);
+	}
+
+	void loop() {
+		if (repeater) {
+			gw.wait(interval);
+			return;
+		}
+		if (readings++ < first) {
+			firstAfterReboot.insert(((uint32_t)id << 24) | value[id]);
+		}
+		sent++;
+		gw.send(msg.set((unsigned long)value[id]++));
+		gw.wait(interval);
+	}
+
+  private:
+	uint8_t id;
+	bool repeater;
+	uint8_t parent;
+	unsigned readings;  // Since the last reboot
+	MySensor gw;
+	MyMessage msg;
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+	}
+
+	void serialLine(const char *line) {
+		unsigned int sender, sensor, command, ack, type;
+		unsigned long v;
+		if (sscanf(line, "%u;%u;%u;%u;%u;%lu", &sender, &sensor, &command, &ack, &type, &v) == 6 &&
+				command == C_SET && type == V_VAR1 && sender < 256) {
+			delivered.insert(((uint32_t)sender << 24) | v);
+		}
+	}
+
+  private:
+	MyGateway gw;
+};
+
+int main(int argc, char **argv) {
+	std::map<std::string, std::string> opt;
+	opt["topology"] = "chain";
+	opt["nodes"] = "2";
+	opt["branch"] = "3";
+	opt["loss"] = "0";
+	opt["interval"] = "1000";
+	opt["reboot"] = "5000";
+	opt["first"] = "3";
+	opt["reboots"] = "20";
+	opt["seed"] = "1";
+	for (int i = 1; i < argc; i++) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq || !opt.count(std::string(argv[i], eq - argv[i]))) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+		opt[std::string(argv[i], eq - argv[i])] = eq + 1;
+	}
+
+	int nodes = atoi(opt["nodes"].c_str());
+	float loss = atof(opt["loss"].c_str());
+	interval = atol(opt["interval"].c_str());
+	unsigned long reboot = atol(opt["reboot"].c_str());
+	first = atoi(opt["first"].c_str());
+	int reboots = atoi(opt["reboots"].c_str());
+	uint32_t seed = atol(opt["seed"].c_str());
+	if (nodes < 1 || nodes > 250) {
+		fprintf(stderr, "nodes must be 1-250\n");
+		return 1;
+	}
+	Simulator.seed(seed);
+
+	const std::string &t = opt["topology"];
+	if (t == "star") {
+		topology.star(nodes);
+	} else if (t == "chain") {
+		topology.chain(nodes);
+	} else if (t == "tree") {
+		topology.tree(nodes, atoi(opt["branch"].c_str()));
+	} else {
+		fprintf(stderr, "unknown topology %s\n", t.c_str());
+		return 1;
+	}
+
+	Simulator.addNode(new Gateway());
+	for (int i = 1; i <= nodes; i++) {
+		Simulator.addNode(new Node(i, topology.repeater[i], topology.parent[i]));
+	}
+	topology.apply(loss);
+
+	clock_t start = clock();
+	uint64_t at = 0;
+	for (int r = 0; r < reboots; r++) {
+		at += (uint64_t)reboot * 1000;
+		Simulator.run(at);
+		// Only the readings after a reboot can be taken for old ones, not
+		// those of the first boot
+		if (r == 0) {
+			firstAfterReboot.clear();
+		}
+		for (int i = 1; i <= nodes; i++) {
+			if (!topology.repeater[i]) {
+				Simulator.reboot(i, new Node(i, false, topology.parent[i]));
+			}
+		}
+	}
+	// Time for the last readings to arrive
+	Simulator.run(at + (uint64_t)reboot * 1000);
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	unsigned firstOk = 0;
+	for (std::set<uint32_t>::iterator i = firstAfterReboot.begin(); i != firstAfterReboot.end(); ++i) {
+		firstOk += delivered.count(*i);
+	}
+	printf("%s, %d nodes, loss %.3f, readings every %lu ms, reboots every %lu ms, seed %u\n",
+			t.c_str(), nodes, loss, interval, reboot, seed);
+	printf("first %u readings after a reboot: sent %u, delivered %u (%.1f%%)\n", first,
+			(unsigned)firstAfterReboot.size(), firstOk,
+			firstAfterReboot.empty() ? 0.0 : 100.0 * firstOk / firstAfterReboot.size());
+	printf("all readings: sent %u, delivered %u (%.1f%%)\n", sent, (unsigned)delivered.size(),
+			sent ? 100.0 * delivered.size() / sent : 0.0);
+	printf("air: frames %u, collisions %u, lost %u, acks lost %u\n", Ether.frames, Ether.collisions,
+			Ether.dropped, Ether.acksLost);
+	printf("host: %.2f s wall\n", wall);
+	return 0;
+}
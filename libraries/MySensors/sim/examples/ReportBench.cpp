@@ -0,0 +1,233 @@
+/*
+ Change reporting benchmark.
+
+ A gateway and N sleeping nodes laid out as a star, chain, tree or grid (see
+ SimTopology.h) with static parents; repeaters wait() and report nothing.
+ Each sleeping node wakes once per interval and reads a temperature, a slow
+ swing of a few degrees with a 0.1 degree jitter the way a DHT reads, and a
+ motion sensor that changes state a few times an hour.
+
+ mode=send reports as the Multisensor sketch did: the temperature whenever it
+ differs from the last reading, the motion state on every wake up. mode=report
+ uses MyReport with the given dead-band and heartbeat for the temperature and
+ a heartbeat for the motion state.
+
+ The run counts messages and frames, and at every wake up, before the new
+ readings are reported, how far the controller's temperature is from the
+ true one and whether it has the right motion state.
+
+ Usage: ReportBench [key=value ...]
+   mode=send|report                        (report)
+   topology=star|chain|tree|grid           (star)
+   nodes=N          nodes, 1-250           (20)
+   branch=N         children per node for tree  (3)
+   width=N          grid width             (5)
+   loss=P           frame/ack loss on every link (0)
+   interval=MS      time between readings  (30000)
+   deadband=C       temperature dead-band  (0.5)
+   heartbeat=MS     heartbeat of both children (3600000)
+   seconds=S        simulated seconds measured (7200)
+   seed=N                                  (1)
+*/
+
+#include "Sim.h"
+#include "SimTopology.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <MyReport.h>
+#include <map>
+#include <string>
+#include <math.h>
+#include <time.h>
+
+#define CHILD_ID_TEMP 1
+#define CHILD_ID_MOTION 2
+
+static bool useReport;
+static unsigned long interval;
+static float deadband;
+static unsigned long heartbeat;
+static uint64_t measureFrom, measureUntil;
+static SimTopology topology;
+
+static float controllerTemp[256];
+static int controllerMotion[256];
+static uint32_t messages, samples, motionWrong, motionChanges;
+static double tempError;
+
+class Node : public SimSketch
+{
+  public:
+	Node(uint8_t id, bool repeater, uint8_t parent) :
+		id(id), repeater(repeater), parent(parent), lastTemp(NAN), tripped(false),
+		msgTemp(CHILD_ID_TEMP, V_TEMP), msgMotion(CHILD_ID_MOTION, V_TRIPPED),
+		temp(gw, msgTemp), motion(gw, msgMotion) {}
+
+	void setup() {
+		delay(random(1000));
+		gw.begin(NULL, id, repeater, parent);
+		temp.setDeadband(deadband).setInterval(0, heartbeat);
+		motion.setInterval(0, heartbeat);
+		if (!repeater) {
+			gw.sleep(random(interval));
+		}
+	}
+
+	void loop() {
+		if (repeater) {
+			gw.wait(interval);
+			return;
+		}
+		// Each node swings with its own phase over an hour or so
+		double t = Simulator.now() / 1e6;
+		float truth = 21 + 2 * sin(t / (3000 + 20 * id) + id);
+		float reading = floor(truth * 10 + 0.5 + (int)random(3) - 1) / 10;
+		// A state change on average every 20 minutes
+		if (random(1200000UL / interval) == 0) {
+			tripped = !tripped;
+			motionChanges += counted();
+		}
+		if (counted()) {
+			samples++;
+			tempError += fabs(controllerTemp[id] - truth);
+			motionWrong += controllerMotion[id] != tripped;
+		}
+		if (useReport) {
+			messages += temp.update(reading, 1) && counted();
+			messages += motion.update(tripped) && counted();
+		} else {
+			if (reading != lastTemp) {
+				lastTemp = reading;
+				gw.send(msgTemp.set(reading, 1));
+				messages += counted();
+			}
+			gw.send(msgMotion.set(tripped ? "1" : "0"));
+			messages += counted();
+		}
+		gw.sleep(interval);
+	}
+
+  private:
+	uint8_t id;
+	bool repeater;
+	uint8_t parent;
+	float lastTemp;
+	bool tripped;
+	MySensor gw;
+	MyMessage msgTemp;
+	MyMessage msgMotion;
+	MyReport temp;
+	MyReport motion;
+
+	bool counted() {
+		return Simulator.now() >= measureFrom && Simulator.now() < measureUntil;
+	}
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+	}
+
+	void serialLine(const char *line) {
+		unsigned int sender, sensor, command, ack, type;
+		float value;
+		if (sscanf(line, "%u;%u;%u;%u;%u;%f", &sender, &sensor, &command, &ack, &type, &value) == 6 &&
+				command == C_SET && sender < 256) {
+			if (sensor == CHILD_ID_TEMP && type == V_TEMP) {
+				controllerTemp[sender] = value;
+			} else if (sensor == CHILD_ID_MOTION && type == V_TRIPPED) {
+				controllerMotion[sender] = (int)value;
+			}
+		}
+	}
+
+  private:
+	MyGateway gw;
+};
+
+int main(int argc, char **argv) {
+	std::map<std::string, std::string> opt;
+	opt["mode"] = "report";
+	opt["topology"] = "star";
+	opt["nodes"] = "20";
+	opt["branch"] = "3";
+	opt["width"] = "5";
+	opt["loss"] = "0";
+	opt["interval"] = "30000";
+	opt["deadband"] = "0.5";
+	opt["heartbeat"] = "3600000";
+	opt["seconds"] = "7200";
+	opt["seed"] = "1";
+	for (int i = 1; i < argc; i++) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq || !opt.count(std::string(argv[i], eq - argv[i]))) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+		opt[std::string(argv[i], eq - argv[i])] = eq + 1;
+	}
+
+	int nodes = atoi(opt["nodes"].c_str());
+	float loss = atof(opt["loss"].c_str());
+	int seconds = atoi(opt["seconds"].c_str());
+	uint32_t seed = atol(opt["seed"].c_str());
+	useReport = opt["mode"] == "report";
+	interval = atol(opt["interval"].c_str());
+	deadband = atof(opt["deadband"].c_str());
+	heartbeat = atol(opt["heartbeat"].c_str());
+	if (nodes < 1 || nodes > 250) {
+		fprintf(stderr, "nodes must be 1-250\n");
+		return 1;
+	}
+	Simulator.seed(seed);
+
+	const std::string &t = opt["topology"];
+	if (t == "star") {
+		topology.star(nodes);
+	} else if (t == "chain") {
+		topology.chain(nodes);
+	} else if (t == "tree") {
+		topology.tree(nodes, atoi(opt["branch"].c_str()));
+	} else if (t == "grid") {
+		topology.grid(nodes, atoi(opt["width"].c_str()));
+	} else {
+		fprintf(stderr, "unknown topology %s\n", t.c_str());
+		return 1;
+	}
+
+	Simulator.addNode(new Gateway());
+	unsigned sleeping = 0;
+	for (int i = 1; i <= nodes; i++) {
+		Simulator.addNode(new Node(i, topology.repeater[i], topology.parent[i]));
+		sleeping += !topology.repeater[i];
+	}
+	topology.apply(loss);
+
+	// The controller has heard every node before the measurement starts
+	measureFrom = (uint64_t)interval * 2000;
+	measureUntil = measureFrom + (uint64_t)seconds * 1000000;
+
+	clock_t start = clock();
+	Simulator.run(measureFrom);
+	Ether.resetCounters();
+	Simulator.run(measureUntil);
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	printf("%s, %s, %d nodes, %u sleeping, loss %.3f, readings every %lu ms, dead-band %.2f, heartbeat %lu ms, seed %u\n",
+			opt["mode"].c_str(), t.c_str(), nodes, sleeping, loss, interval, deadband, heartbeat, seed);
+	printf("messages: %u, %.1f per sleeping node and hour\n", messages,
+			sleeping ? messages * 3600.0 / seconds / sleeping : 0.0);
+	printf("controller: temperature off by %.3f on average, motion state wrong %.2f%% of the time, %u changes\n",
+			samples ? tempError / samples : 0.0, samples ? 100.0 * motionWrong / samples : 0.0, motionChanges);
+	printf("air: frames %u, collisions %u, lost %u, acks lost %u\n", Ether.frames, Ether.collisions,
+			Ether.dropped, Ether.acksLost);
+	printf("host: %.2f s wall\n", wall);
+	return 0;
+}
@@ -0,0 +1,163 @@
+/*
+ Star network throughput.
+
+ A gateway and N sensor nodes one hop away. Every sensor sends a V_VAR1
+ reading every interval (with a random phase) and keeps process()ing in
+ between. Reports delivered messages per simulated second and the latency
+ from send() on the node to the line leaving the gateway's serial port.
+ With binary=1 the controller switches the gateway to binary frames first.
+
+ Usage: StarThroughput [nodes=20] [interval_ms=1000] [seconds=60] [seed=1] [binary=0]
+*/
+
+#include "Sim.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <time.h>
+#include <util/crc16.h>
+
+static unsigned long interval = 1000;
+static bool binary;
+static std::map<uint32_t, uint64_t> inFlight; // (node id << 16 | seq) -> send time
+static std::vector<uint64_t> latencies;
+static uint32_t sent, firstHopOk, serialBytes;
+
+static void delivered(uint8_t sender, unsigned long seq) {
+	std::map<uint32_t, uint64_t>::iterator it = inFlight.find(((uint32_t)sender << 16) | (uint32_t)seq);
+	if (it != inFlight.end()) {
+		latencies.push_back(Simulator.now() - it->second);
+		inFlight.erase(it);
+	}
+}
+
+class Sensor : public SimSketch
+{
+  public:
+	Sensor(uint8_t id) : id(id), seq(0), msg(0, V_VAR1) {}
+
+	void setup() {
+		gw.begin(NULL, id, false, GATEWAY_ADDRESS);
+		gw.wait(random(interval));
+	}
+
+	void loop() {
+		inFlight[((uint32_t)id << 16) | seq] = Simulator.now();
+		sent++;
+		if (gw.send(msg.set((unsigned long)seq))) {
+			firstHopOk++;
+		}
+		seq = (seq + 1) & 0xFFFF;
+		gw.wait(interval);
+	}
+
+  private:
+	uint8_t id;
+	uint16_t seq;
+	MySensor gw;
+	MyMessage msg;
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+		while (Serial.available()) {
+			gw.parse(Serial.read());
+		}
+	}
+
+	void serialLine(const char *line) {
+		unsigned int sender, sensor, command, ack, type;
+		unsigned long value;
+		if (binary || sscanf(line, "%u;%u;%u;%u;%u;%lu", &sender, &sensor, &command, &ack, &type, &value) != 6 ||
+				command != C_SET || type != V_VAR1) {
+			return;
+		}
+		delivered(sender, value);
+	}
+
+	void serialData(const uint8_t *data, size_t length) {
+		serialBytes += length;
+		for (size_t i = 0; binary && i < length; i++) {
+			// Text lines before the switch are skipped, they never contain FRAME_START
+			if (frame.empty() && data[i] != FRAME_START) {
+				continue;
+			}
+			frame.push_back(data[i]);
+			if (frame.size() > 2 && frame.size() == (size_t)frame[1] + 3) {
+				uint8_t crc = 0;
+				for (size_t j = 1; j < frame.size() - 1; j++) {
+					crc = _crc_ibutton_update(crc, frame[j]);
+				}
+				MyMessage &m = *(MyMessage *)&frame[2];
+				if (crc == frame.back() && mGetCommand(m) == C_SET && m.type == V_VAR1) {
+					delivered(m.sender, m.getULong());
+				}
+				frame.clear();
+			}
+		}
+	}
+
+  private:
+	MyGateway gw;
+	std::vector<uint8_t> frame;
+};
+
+static double percentile(std::vector<uint64_t> &v, double p) {
+	if (v.empty()) {
+		return 0;
+	}
+	size_t i = (size_t)(p * (v.size() - 1));
+	return v[i] / 1000.0;
+}
+
+int main(int argc, char **argv) {
+	int nodes = argc > 1 ? atoi(argv[1]) : 20;
+	interval = argc > 2 ? atol(argv[2]) : 1000;
+	int seconds = argc > 3 ? atoi(argv[3]) : 60;
+	Simulator.seed(argc > 4 ? atol(argv[4]) : 1);
+	binary = argc > 5 && atoi(argv[5]) == 1;
+	if (nodes < 1 || nodes > 254) {
+		fprintf(stderr, "nodes must be 1-254\n");
+		return 1;
+	}
+
+	Simulator.addNode(new Gateway());
+	if (binary) {
+		Simulator.serialInput(0, "0;0;3;0;15;1\n");
+	}
+	for (int i = 1; i <= nodes; i++) {
+		Simulator.addNode(new Sensor(i));
+	}
+
+	clock_t start = clock();
+	Simulator.run((uint64_t)seconds * 1000000);
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	std::sort(latencies.begin(), latencies.end());
+	double sum = 0;
+	for (size_t i = 0; i < latencies.size(); i++) {
+		sum += latencies[i];
+	}
+	printf("nodes %d, interval %lu ms, %d s simulated\n", nodes, interval, seconds);
+	printf("sent %u, first hop ok %u, delivered %u (%.1f%%)\n", sent, firstHopOk,
+			(unsigned)latencies.size(), sent ? 100.0 * latencies.size() / sent : 0.0);
+	printf("delivered rate %.2f msg/s\n", (double)latencies.size() / seconds);
+	printf("latency ms: mean %.2f p50 %.2f p95 %.2f p99 %.2f max %.2f\n",
+			latencies.empty() ? 0 : sum / latencies.size() / 1000.0,
+			percentile(latencies, 0.50), percentile(latencies, 0.95),
+			percentile(latencies, 0.99), percentile(latencies, 1.0));
+	printf("gateway serial: %u bytes, %.1f%% of %lu baud%s\n", serialBytes,
+			100.0 * serialBytes * 10 / ((double)seconds * BAUD_RATE), (unsigned long)BAUD_RATE, binary ? ", binary frames" : "");
+	printf("air: frames %u, collisions %u\n", Ether.frames, Ether.collisions);
+	printf("host: %.2f s wall, %.1fx real time\n", wall, wall > 0 ? seconds / wall : 0.0);
+	return 0;
+}
@@ -0,0 +1,328 @@
+/*
+ Bulk data streaming benchmark.
+
+ A gateway and N nodes laid out as a star, chain or tree (see SimTopology.h)
+ with static parents. Every node that relays for no other node, or with
+ send=last only the last one, waits two seconds and then sends a capture of
+ the given size to the gateway in 64 byte pieces, with streamBegin(),
+ streamWrite() and streamEnd(). The controller puts each stream together
+ from the gateway's serial output by sequence number and checks it against
+ what the node sent.
+
+ With mode=send the nodes hand-chunk the capture into plain send()s of
+ MAX_PAYLOAD bytes instead, each acked by the next hop only, for comparison;
+ the controller then only counts the bytes that arrive.
+
+ Reports how long each node took from the first write to the end, the rate,
+ the bytes that arrived intact and the radio traffic.
+
+ Usage: StreamBench [key=value ...]
+   topology=star|chain|tree                        (star)
+   nodes=N          nodes, 1-250                   (1)
+   send=leaves|last nodes that send                (leaves)
+   branch=N         children per node for tree     (3)
+   loss=P           frame/ack loss on every link   (0)
+   bytes=N          capture size                   (4096)
+   mode=stream|send                                (stream)
+   binary=0|1       gateway in binary frame mode   (1)
+   seconds=S        give up after S simulated s    (300)
+   seed=N                                          (1)
+   trace=0|1        echo every node's serial output (0)
+*/
+
+#include "Sim.h"
+#include "SimTopology.h"
+#include <MySensor.h>
+#include <MyGateway.h>
+#include <map>
+#include <vector>
+#include <string>
+#include <time.h>
+#include <util/crc16.h>
+
+static SimTopology topology;
+static bool streaming = true;
+static size_t captureSize;
+static std::vector<std::vector<uint8_t> > captures; // By node id, what it sends
+static std::vector<uint64_t> startedAt, endedAt;
+static std::vector<bool> endedOk;
+static std::vector<std::map<uint16_t, std::vector<uint8_t> > > segments; // By node id and sequence number
+static std::vector<int> endSeq;         // Sequence number of the end segment, -1 before it came
+static std::vector<uint32_t> bytesIn;   // Payload bytes the controller got, by node id
+static uint32_t duplicates;
+
+// Controller side: one message as the gateway passed it on
+static void controllerGot(const MyMessage &m) {
+	uint8_t length = mGetLength(m);
+	if (!streaming) {
+		if (mGetCommand(m) == C_SET && m.type == V_VAR1) {
+			bytesIn[m.sender] += length;
+		}
+		return;
+	}
+	if (mGetCommand(m) != C_STREAM || m.type != ST_IMAGE || length < STREAM_HEADER_SIZE) {
+		return;
+	}
+	const StreamSegment *s = (const StreamSegment *)m.getCustom();
+	std::map<uint16_t, std::vector<uint8_t> > &got = segments[m.sender];
+	if (got.count(s->seq)) {
+		duplicates++;
+		return;
+	}
+	got[s->seq].assign(s->data, s->data + length - STREAM_HEADER_SIZE);
+	bytesIn[m.sender] += length - STREAM_HEADER_SIZE;
+	if (length == STREAM_HEADER_SIZE) {
+		endSeq[m.sender] = s->seq;
+	}
+}
+
+static int hexValue(char c) {
+	return c <= '9' ? c - '0' : (c & ~0x20) - 'A' + 10;
+}
+
+class Node : public SimSketch
+{
+  public:
+	Node(uint8_t id, bool repeater, uint8_t parent, bool sends) :
+		id(id), repeater(repeater), parent(parent), sends(sends) {}
+
+	void setup() {
+		delay(random(1000));
+		gw.begin(NULL, id, repeater, parent);
+		gw.wait(2000);
+		if (!sends) {
+			return;
+		}
+		const std::vector<uint8_t> &capture = captures[id];
+		startedAt[id] = Simulator.now();
+		bool ok = true;
+		if (streaming) {
+			gw.streamBegin(1, ST_IMAGE);
+			for (size_t at = 0; ok && at < capture.size(); at += 64) {
+				size_t n = capture.size() - at < 64 ? capture.size() - at : 64;
+				ok = gw.streamWrite(&capture[at], n);
+			}
+			ok = ok && gw.streamEnd();
+		} else {
+			MyMessage msg(1, V_VAR1);
+			for (size_t at = 0; at < capture.size(); at += MAX_PAYLOAD) {
+				size_t n = capture.size() - at < MAX_PAYLOAD ? capture.size() - at : MAX_PAYLOAD;
+				gw.send(msg.set((void *)&capture[at], n));
+			}
+		}
+		endedAt[id] = Simulator.now();
+		endedOk[id] = ok;
+	}
+
+	void loop() {
+		gw.wait(1000);
+	}
+
+  private:
+	uint8_t id;
+	bool repeater;
+	uint8_t parent;
+	bool sends;
+	MySensor gw;
+};
+
+class Gateway : public SimSketch
+{
+  public:
+	Gateway(bool binary) : binary(binary) {}
+
+	void setup() {
+		gw.begin();
+	}
+
+	void loop() {
+		gw.processRadioMessage();
+		while (Serial.available()) {
+			gw.parse(Serial.read());
+		}
+	}
+
+	void serialLine(const char *line) {
+		unsigned int sender, sensor, command, ack, type;
+		int payloadAt = 0;
+		if (binary || sscanf(line, "%u;%u;%u;%u;%u;%n", &sender, &sensor, &command, &ack, &type, &payloadAt) != 5 ||
+				payloadAt == 0) {
+			return;
+		}
+		// Streams and custom payloads come as hex
+		MyMessage m;
+		m.sender = sender;
+		m.type = type;
+		mSetCommand(m, command);
+		const char *hex = line + payloadAt;
+		uint8_t length = 0;
+		for (; hex[0] && hex[1] && length < MAX_PAYLOAD; hex += 2) {
+			m.data[length++] = hexValue(hex[0]) << 4 | hexValue(hex[1]);
+		}
+		mSetLength(m, length);
+		controllerGot(m);
+	}
+
+	void serialData(const uint8_t *data, size_t length) {
+		for (size_t i = 0; binary && i < length; i++) {
+			// Text lines before the switch are skipped, they never contain FRAME_START
+			if (frame.empty() && data[i] != FRAME_START) {
+				continue;
+			}
+			frame.push_back(data[i]);
+			if (frame.size() > 2 && frame.size() == (size_t)frame[1] + 3) {
+				uint8_t crc = 0;
+				for (size_t j = 1; j < frame.size() - 1; j++) {
+					crc = _crc_ibutton_update(crc, frame[j]);
+				}
+				if (crc == frame.back()) {
+					controllerGot(*(MyMessage *)&frame[2]);
+				}
+				frame.clear();
+			}
+		}
+	}
+
+  private:
+	bool binary;
+	MyGateway gw;
+	std::vector<uint8_t> frame;
+};
+
+int main(int argc, char **argv) {
+	std::map<std::string, std::string> opt;
+	opt["topology"] = "star";
+	opt["nodes"] = "1";
+	opt["send"] = "leaves";
+	opt["branch"] = "3";
+	opt["loss"] = "0";
+	opt["bytes"] = "4096";
+	opt["mode"] = "stream";
+	opt["binary"] = "1";
+	opt["seconds"] = "300";
+	opt["seed"] = "1";
+	opt["trace"] = "0";
+	for (int i = 1; i < argc; i++) {
+		const char *eq = strchr(argv[i], '=');
+		if (!eq || !opt.count(std::string(argv[i], eq - argv[i]))) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 1;
+		}
+		opt[std::string(argv[i], eq - argv[i])] = eq + 1;
+	}
+
+	int nodes = atoi(opt["nodes"].c_str());
+	float loss = atof(opt["loss"].c_str());
+	int seconds = atoi(opt["seconds"].c_str());
+	uint32_t seed = atol(opt["seed"].c_str());
+	bool binary = opt["binary"] == "1";
+	captureSize = atol(opt["bytes"].c_str());
+	streaming = opt["mode"] != "send";
+	if (nodes < 1 || nodes > 250) {
+		fprintf(stderr, "nodes must be 1-250\n");
+		return 1;
+	}
+	if (opt["mode"] != "stream" && opt["mode"] != "send") {
+		fprintf(stderr, "unknown mode %s\n", opt["mode"].c_str());
+		return 1;
+	}
+	const std::string &sendOpt = opt["send"];
+	if (sendOpt != "leaves" && sendOpt != "last") {
+		fprintf(stderr, "unknown send %s\n", sendOpt.c_str());
+		return 1;
+	}
+	Simulator.seed(seed);
+	Simulator.setTrace(opt["trace"] == "1");
+
+	const std::string &t = opt["topology"];
+	if (t == "star") {
+		topology.star(nodes);
+	} else if (t == "chain") {
+		topology.chain(nodes);
+	} else if (t == "tree") {
+		topology.tree(nodes, atoi(opt["branch"].c_str()));
+	} else {
+		fprintf(stderr, "unknown topology %s\n", t.c_str());
+		return 1;
+	}
+
+	captures.resize(nodes + 1);
+	startedAt.assign(nodes + 1, 0);
+	endedAt.assign(nodes + 1, 0);
+	endedOk.assign(nodes + 1, false);
+	segments.resize(nodes + 1);
+	endSeq.assign(nodes + 1, -1);
+	bytesIn.assign(nodes + 1, 0);
+
+	Simulator.addNode(new Gateway(binary));
+	if (binary) {
+		Simulator.serialInput(0, "0;0;3;0;15;1\n");
+	}
+	int sending = 0;
+	for (int i = 1; i <= nodes; i++) {
+		bool sends = sendOpt == "last" ? i == nodes : !topology.repeater[i];
+		sending += sends;
+		// Made up capture, different for every node
+		uint32_t x = seed * 7919 + i;
+		captures[i].resize(captureSize);
+		for (size_t j = 0; j < captureSize; j++) {
+			x ^= x << 13;
+			x ^= x >> 17;
+			x ^= x << 5;
+			captures[i][j] = x;
+		}
+		Simulator.addNode(new Node(i, topology.repeater[i], topology.parent[i], sends));
+	}
+	topology.apply(loss);
+
+	// Run until every sender is through, and a little longer for the last
+	// messages to reach the controller
+	clock_t start = clock();
+	uint64_t until = 10000;
+	for (int done = 0; done < sending && until <= (uint64_t)seconds * 1000000; until += 10000) {
+		Simulator.run(until);
+		done = 0;
+		for (int i = 1; i <= nodes; i++) {
+			done += endedAt[i] != 0;
+		}
+	}
+	Simulator.run(until + 500000);
+	double wall = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+	int done = 0, intact = 0;
+	uint32_t arrived = 0;
+	double sum = 0, longest = 0;
+	for (int i = 1; i <= nodes; i++) {
+		arrived += bytesIn[i];
+		if (!endedAt[i]) {
+			continue;
+		}
+		done++;
+		double took = (endedAt[i] - startedAt[i]) / 1e6;
+		sum += took;
+		longest = took > longest ? took : longest;
+		if (streaming && endedOk[i] && endSeq[i] >= 0 && (int)segments[i].size() == endSeq[i] + 1) {
+			std::vector<uint8_t> whole;
+			for (std::map<uint16_t, std::vector<uint8_t> >::iterator s = segments[i].begin(); s != segments[i].end(); ++s) {
+				whole.insert(whole.end(), s->second.begin(), s->second.end());
+			}
+			intact += whole == captures[i];
+		}
+	}
+
+	printf("%s, %d nodes, depth %u, loss %.3f, %u bytes each, %s, window %u, %s, seed %u\n",
+			t.c_str(), nodes, topology.maxDepth(), loss, (unsigned)captureSize, streaming ? "stream" : "send",
+			STREAM_WINDOW, binary ? "binary" : "text", seed);
+	printf("done %d/%d nodes", done, sending);
+	if (streaming) {
+		printf(", intact %d", intact);
+	}
+	printf(", controller got %u of %u bytes\n", arrived, (unsigned)(captureSize * sending));
+	if (done) {
+		printf("per node: mean %.2f s, max %.2f s, %.0f bytes/s\n", sum / done, longest, captureSize * done / sum);
+	}
+	printf("air: frames %u, collisions %u, lost %u, acks lost %u; duplicates at the controller %u\n",
+			Ether.frames, Ether.collisions, Ether.dropped, Ether.acksLost, duplicates);
+	printf("host: %.2f s wall\n", wall);
+	return streaming && intact != sending ? 1 : 0;
+}
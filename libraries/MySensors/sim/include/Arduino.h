@@ -0,0 +1,118 @@
+/*
+ Host stand-in for the Arduino core, used by the MySensors network simulator.
+
+ Only the parts of the core that the MySensors library and the RF24 driver
+ touch are provided. Time, pins, serial and EEPROM are all per virtual node
+ and are routed through the simulator (see Sim.h).
+
+ This program is free software; you can redistribute it and/or
+ modify it under the terms of the GNU General Public License
+ version 2 as published by the Free Software Foundation.
+*/
+
+#ifndef Arduino_h
+#define Arduino_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <avr/pgmspace.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define DEC 10
+#define HEX 16
+
+#define B1 1
+#define B11 3
+#define B111 7
+#define B1111 15
+#define B11111 31
+#define B111111 63
+
+#ifndef _BV
+#define _BV(bit) (1 << (bit))
+#endif
+
+// Arduino's min()/max() are macros that happily compare mixed types.
+// Templates keep that behaviour without clobbering std::min/std::max.
+template<class A, class B> inline A min(A a, B b) { return (b < a) ? (A)b : a; }
+template<class A, class B> inline A max(A a, B b) { return (a < b) ? (A)b : a; }
+
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+void detachInterrupt(uint8_t interrupt);
+void noInterrupts(void);
+void interrupts(void);
+
+long random(long howbig);
+long random(long howsmall, long howbig);
+void randomSeed(unsigned long seed);
+
+// avr-libc number conversion helpers
+char *itoa(int value, char *buffer, int radix);
+char *utoa(unsigned int value, char *buffer, int radix);
+char *ltoa(long value, char *buffer, int radix);
+char *ultoa(unsigned long value, char *buffer, int radix);
+char *dtostrf(double value, signed char width, unsigned char prec, char *buffer);
+
+class __FlashStringHelper;
+#define F(string_literal) (reinterpret_cast<const __FlashStringHelper *>(PSTR(string_literal)))
+
+class HardwareSerial
+{
+  public:
+	void begin(unsigned long baud);
+	void end() {}
+	int available(void);
+	int read(void);
+	int peek(void);
+	void flush(void);
+	size_t write(uint8_t c);
+	size_t write(const uint8_t *buffer, size_t size);
+	size_t print(const char *str);
+	size_t print(const __FlashStringHelper *str);
+	size_t print(char c);
+	size_t print(long n, int base=DEC);
+	size_t print(unsigned long n, int base=DEC);
+	size_t print(int n, int base=DEC) { return print((long)n, base); }
+	size_t print(unsigned int n, int base=DEC) { return print((unsigned long)n, base); }
+	size_t print(unsigned char n, int base=DEC) { return print((unsigned long)n, base); }
+	size_t print(double n, int digits=2);
+	size_t println(void);
+	template<class T> size_t println(T value) { size_t n = print(value); return n + println(); }
+	template<class T> size_t println(T value, int base) { size_t n = print(value, base); return n + println(); }
+	operator bool() { return true; }
+};
+
+extern HardwareSerial Serial;
+
+#endif
@@ -0,0 +1,23 @@
+/*
+ Host stand-in for avr-libc <avr/eeprom.h>. Each virtual node owns a
+ 1 KiB EEPROM image (ATmega328P) and pays the ~3.4 ms write cycle in
+ simulated time, like the real eeprom_write_byte() busy-wait does.
+*/
+
+#ifndef _AVR_EEPROM_H_
+#define _AVR_EEPROM_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define E2END 0x3FF
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *addr, size_t n);
+void eeprom_write_block(const void *src, void *addr, size_t n);
+void eeprom_update_block(const void *src, void *addr, size_t n);
+bool eeprom_is_ready(void);
+
+#endif
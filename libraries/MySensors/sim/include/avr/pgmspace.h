@@ -0,0 +1,41 @@
+/*
+ Host stand-in for avr-libc <avr/pgmspace.h>. Flash and RAM share one
+ address space on the host, so every _P helper maps to its plain version.
+*/
+
+#ifndef __PGMSPACE_H_
+#define __PGMSPACE_H_
+
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+
+#ifndef PROGMEM
+#define PROGMEM
+#endif
+#ifndef PSTR
+#define PSTR(s) (s)
+#endif
+
+#define pgm_read_byte(addr) (*(const unsigned char *)(addr))
+#define pgm_read_word(addr) (*(addr))
+#define pgm_read_dword(addr) (*(addr))
+
+#define strlen_P strlen
+#define strcpy_P strcpy
+#define strncpy_P strncpy
+#define strcmp_P strcmp
+#define strncmp_P strncmp
+#define strcat_P strcat
+#define memcpy_P memcpy
+#define sprintf_P sprintf
+#define snprintf_P snprintf
+#define vsnprintf_P vsnprintf
+#define printf_P printf
+
+typedef char prog_char;
+typedef uint8_t prog_uint8_t;
+typedef uint16_t prog_uint16_t;
+
+#endif
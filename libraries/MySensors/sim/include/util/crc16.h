@@ -0,0 +1,28 @@
+/*
+ Host stand-in for avr-libc <util/crc16.h>, only the CRCs the library uses.
+*/
+
+#ifndef _UTIL_CRC16_H_
+#define _UTIL_CRC16_H_
+
+#include <stdint.h>
+
+// Dallas/Maxim CRC-8, polynomial x^8 + x^5 + x^4 + 1, LSB first
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data) {
+	crc ^= data;
+	for (uint8_t i = 0; i < 8; i++) {
+		crc = (crc & 0x01) ? (crc >> 1) ^ 0x8C : crc >> 1;
+	}
+	return crc;
+}
+
+// CRC-16, polynomial x^16 + x^15 + x^2 + 1, LSB first
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t data) {
+	crc ^= data;
+	for (uint8_t i = 0; i < 8; i++) {
+		crc = (crc & 0x01) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+#endif
@@ -28,6 +28,7 @@
 #include <avr/wdt.h>
 #include <avr/power.h>
 #include <avr/interrupt.h>
+#include <Arduino.h>
 #include "LowPower.h"
 
 // Only Pico Power devices can change BOD settings through software
@@ -840,6 +841,31 @@ void	LowPowerClass::powerExtStandby(period_t period, adc_t adc, bod_t bod,
 	#endif
 }
 
+/*******************************************************************************
+* Name: wdtMicros
+* Description: Time one watchdog period against the system clock. The 
+*			   watchdog runs off its own 128 kHz RC oscillator, which can be 
+*			   off by 10% or more with supply voltage and temperature. Stays 
+*			   awake with Timer 0 running and busy waits for the watchdog 
+*			   interrupt, so use a short period.
+*
+* Argument  	Description
+* =========  	===========
+* 1. period   Watchdog period to time, SLEEP_15MS to SLEEP_8S
+*
+* Returns the length of the period in microseconds.
+*
+*******************************************************************************/
+unsigned long LowPowerClass::wdtMicros(period_t period)
+{
+	wdt_enable(period);
+	unsigned long start = micros();
+	WDTCSR |= (1 << WDIE);
+	// The ISR disables the watchdog, which clears WDIE
+	while (WDTCSR & (1 << WDIE));
+	return micros() - start;
+}
+
 /*******************************************************************************
 * Name: ISR (WDT_vect)
 * Description: Watchdog Timer interrupt service routine. This routine is 
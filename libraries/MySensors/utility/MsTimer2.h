@@ -3,7 +3,7 @@
 
 #ifdef __AVR__
 #include <avr/interrupt.h>
-#else
+#elif !defined(MYSENSORS_SIM)
 #error MsTimer2 library only works on AVR architecture
 #endif
 
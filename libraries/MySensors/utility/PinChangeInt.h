@@ -95,6 +95,22 @@ Version 2.11 (beta) Mon Nov 12 09:33:06 CST 2012
 
 #define PCINT_VERSION 2190 // This number MUST agree with the version number, above.
 
+#if defined(MYSENSORS_SIM)
+// Host simulation build: no pin change hardware, the simulator provides these
+#include <Arduino.h>
+typedef void (*PCIntvoidFuncPtr)(void);
+// Like the AVR version below, so the simulator sees what the library sees there
+#undef DEBUG
+class PCintPort {
+public:
+	static		int8_t attachInterrupt(uint8_t pin, PCIntvoidFuncPtr userFunc, int mode);
+	static		void detachInterrupt(uint8_t pin);
+	// All nodes share one process, each keeps its own value of the global
+	static		void handlerData(void *var, size_t size);
+};
+#define PCINT_HANDLER_DATA(var) PCintPort::handlerData(&(var), sizeof(var))
+#else
+
 #include "stddef.h"
 
 // Thanks to Maurice Beelen, nms277, Akesson Karlpetter, and Orly Andico for these fixes.
@@ -618,4 +634,11 @@ uint16_t getPCIntVersion () {
 }
 #endif // GET_PCINT_VERSION
 #endif // #ifndef LIBCALL_PINCHANGEINT *************************************************************
+#endif // MYSENSORS_SIM
+
+#ifndef PCINT_HANDLER_DATA
+// Declares a global an attached handler uses to find its object. Nothing to
+// do on the chip, the simulator keeps one per node.
+#define PCINT_HANDLER_DATA(var)
+#endif
 #endif // #ifndef PinChangeInt_h *******************************************************************
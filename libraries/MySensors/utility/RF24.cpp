@@ -824,6 +824,25 @@ bool RF24::txStandBy(uint32_t timeout){
 }
 /****************************************************************************/
 
+rf24_tx_status_e RF24::txStandByPoll(){
+
+	uint8_t status = get_status();
+	if( ! ( status & ( _BV(TX_DS) | _BV(MAX_RT) ))){
+		return RF24_TX_BUSY;
+	}
+
+	ce(LOW);				   //Set STANDBY-I mode
+	write_register(STATUS,_BV(TX_DS) | _BV(MAX_RT) );
+
+	//Max retries exceeded
+	if( status & _BV(MAX_RT)){
+		flush_tx();
+		return RF24_TX_FAILED;
+	}
+	return RF24_TX_OK;
+}
+/****************************************************************************/
+
 void RF24::maskIRQ(bool tx, bool fail, bool rx){
 
 	write_register(CONFIG, ( read_register(CONFIG) ) | fail << MASK_MAX_RT | tx << MASK_TX_DS | rx << MASK_RX_DR  );
@@ -890,8 +909,9 @@ void RF24::read( void* buf, uint8_t len ){
   // Fetch the payload
   read_payload( buf, len );
 
-  //Clear the two possible interrupt flags with one command
-  write_register(STATUS,_BV(RX_DR) | _BV(MAX_RT) | _BV(TX_DS) );
+  //Clear the receive interrupt flag only, TX_DS and MAX_RT may belong to a
+  //transmission that is still being polled with txStandByPoll()
+  write_register(STATUS,_BV(RX_DR) );
 
 }
 
@@ -1179,6 +1199,13 @@ bool RF24::testRPD(void)
 
 /****************************************************************************/
 
+uint8_t RF24::getARC(void)
+{
+  return read_register(OBSERVE_TX) & 0x0F;
+}
+
+/****************************************************************************/
+
 void RF24::setPALevel(uint8_t level)
 {
 
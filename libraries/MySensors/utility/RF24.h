@@ -40,6 +40,12 @@ typedef enum { RF24_1MBPS = 0, RF24_2MBPS, RF24_250KBPS } rf24_datarate_e;
  */
 typedef enum { RF24_CRC_DISABLED = 0, RF24_CRC_8, RF24_CRC_16 } rf24_crclength_e;
 
+/**
+ * Outcome of a single payload write
+ * @see txStandByPoll()
+ */
+typedef enum { RF24_TX_BUSY = 0, RF24_TX_OK, RF24_TX_FAILED } rf24_tx_status_e;
+
 /**
  * Driver for nRF24L01(+) 2.4GHz Wireless Transceiver
  */
@@ -389,6 +395,22 @@ public:
    */
    bool txStandBy(uint32_t timeout);
 
+  /**
+   * Non-blocking counterpart of txStandBy() for a single payload started with
+   * startFastWrite(). Call it repeatedly until it stops returning RF24_TX_BUSY.
+   * @code
+   *			radio.startFastWrite(&buf,32,0);
+   *			while( radio.txStandByPoll() == RF24_TX_BUSY ){
+   *				// Do something useful while the radio retries
+   *			}
+   * @endcode
+   * @note Only the TX flags are cleared, RX_DR is left alone.
+   * @return RF24_TX_BUSY while the payload is still being sent or retried, RF24_TX_OK
+   * once it is acked (or sent, when multicast) and RF24_TX_FAILED when the retries ran
+   * out. In both final states the radio is back in Standby-I and a failed payload is flushed.
+   */
+   rf24_tx_status_e txStandByPoll();
+
   /**
    * Write an ack payload for the specified pipe
    *
@@ -534,6 +556,14 @@ public:
    */
   bool testRPD(void) ;
 
+  /**
+   * Number of retransmissions of the last payload sent (ARC_CNT in
+   * OBSERVE_TX). Reset when the next payload goes out.
+   *
+   * @return Auto retransmit count, 0-15
+   */
+  uint8_t getARC(void);
+
   /**
    * Test whether this is a real radio, or a mock shim for
    * debugging.  Setting either pin to 0xff is the way to
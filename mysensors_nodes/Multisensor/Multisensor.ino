@@ -1,5 +1,6 @@
 #include <SPI.h>
 #include <MySensor.h>  
+#include <MyReport.h>
 #include <DHT.h>  
 
 #define CHILD_ID_HUM 0
@@ -9,15 +10,17 @@
 #define MOTION_INPUT_SENSOR 3
 #define INTERRUPT MOTION_INPUT_SENSOR-2 // Usually the interrupt = pin -2 (on uno/nano anyway)
 unsigned long SLEEP_TIME = 30000; // Sleep time between reads (in milliseconds)
+unsigned long HEARTBEAT = 3600000; // Send values again after an hour without a change (in milliseconds)
 
 MySensor gw;
 DHT dht;
-float lastTemp;
-float lastHum;
 boolean metric = true; 
 MyMessage msgHum(CHILD_ID_HUM, V_HUM);
 MyMessage msgTemp(CHILD_ID_TEMP, V_TEMP);
 MyMessage msg(CHILD_ID_MOTION, V_TRIPPED);
+MyReport humReport(gw, msgHum);
+MyReport tempReport(gw, msgTemp);
+MyReport motionReport(gw, msg);
 
 void setup()  
 { 
@@ -33,6 +36,11 @@ void setup()
   gw.present(CHILD_ID_MOTION, S_MOTION);
 
   metric = gw.getConfig().isMetric;
+
+  // Only changes of at least half a degree or one percent are sent
+  tempReport.setDeadband(0.5).setInterval(0, HEARTBEAT);
+  humReport.setDeadband(1).setInterval(0, HEARTBEAT);
+  motionReport.setInterval(0, HEARTBEAT);
 }
 
 void loop()      
@@ -42,30 +50,28 @@ void loop()
   float temperature = dht.getTemperature();
   if (isnan(temperature)) {
       Serial.println("Failed reading temperature from DHT");
-  } else if (temperature != lastTemp) {
-    lastTemp = temperature;
+  } else {
     if (!metric) {
       temperature = dht.toFahrenheit(temperature);
     }
-    gw.send(msgTemp.set(temperature, 1));
-    Serial.print("T: ");
-    Serial.println(temperature);
+    if (tempReport.update(temperature, 1)) {
+      Serial.print("T: ");
+      Serial.println(temperature);
+    }
   }
   
   float humidity = dht.getHumidity();
   if (isnan(humidity)) {
       Serial.println("Failed reading humidity from DHT");
-  } else if (humidity != lastHum) {
-      lastHum = humidity;
-      gw.send(msgHum.set(humidity, 1));
+  } else if (humReport.update(humidity, 1)) {
       Serial.print("H: ");
       Serial.println(humidity);
   }
 
   boolean tripped = digitalRead(MOTION_INPUT_SENSOR) == HIGH; 
-  gw.send(msg.set(tripped?"1":"0"));  // Send tripped value to gw 
+  motionReport.update(tripped);  // Send tripped value to gw when it changed
 
-  gw.sleep(INTERRUPT,CHANGE, SLEEP_TIME);  
+  gw.sleepSlot(INTERRUPT,CHANGE, SLEEP_TIME);  
 }
 
 